@@ -0,0 +1,117 @@
+// arena allocator
+// gives each controller, image and tracer one cache line aligned region of
+// memory that is freed in one call - no per-buffer frees to forget and no
+// heap fragmentation from thousands of short-lived sessions
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+// header room at the start of a block - allocations stay cache line aligned
+#define ARENA_BLOCK_HEADER ((sizeof(JWD1797ArenaBlock) + JWD1797_ARENA_ALIGN - 1) \
+  & ~(unsigned long)(JWD1797_ARENA_ALIGN - 1))
+
+/* a new zeroed block of at least size bytes. Huge page blocks are whole huge
+  pages - explicit ones (MAP_HUGETLB) if the host has them reserved,
+  otherwise transparent huge pages are asked for. NULL if there is no
+  memory. */
+JWD1797ArenaBlock* newJWD1797ArenaBlock(JWD1797Arena* arena, unsigned long size) {
+  JWD1797ArenaBlock* block = NULL;
+  if(arena->flags & JWD1797_ARENA_HUGE_PAGES) {
+    size = (size + JWD1797_HUGE_PAGE_SIZE - 1) & ~(JWD1797_HUGE_PAGE_SIZE - 1);
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(map != MAP_FAILED) {arena->huge_pages++;}
+    else {
+      map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(map == MAP_FAILED) {return NULL;}
+      madvise(map, size, MADV_HUGEPAGE);
+    }
+    // anonymous mappings are already zeroed
+    block = (JWD1797ArenaBlock*)map;
+    block->mapped = 1;
+  }
+  else {
+    size = (size + JWD1797_ARENA_ALIGN - 1) & ~(unsigned long)(JWD1797_ARENA_ALIGN - 1);
+    block = (JWD1797ArenaBlock*)aligned_alloc(JWD1797_ARENA_ALIGN, size);
+    if(block == NULL) {return NULL;}
+    memset(block, 0, size);
+  }
+  block->size = size;
+  block->used = ARENA_BLOCK_HEADER;
+  arena->reserved += size;
+  return block;
+}
+
+void freeJWD1797ArenaBlock(JWD1797ArenaBlock* block) {
+  if(block->mapped) {munmap(block, block->size);}
+  else {free(block);}
+}
+
+/* arena that grows in blocks of block_size bytes (larger allocations get a
+  block of their own). flags: JWD1797_ARENA_HUGE_PAGES or 0. NULL if there is
+  no memory. */
+JWD1797Arena* newJWD1797Arena(unsigned long block_size, int flags) {
+  // the arena itself is the first allocation of its first block
+  JWD1797Arena bootstrap = {NULL, block_size, flags, 0, 0};
+  unsigned long first = ARENA_BLOCK_HEADER + sizeof(JWD1797Arena) + block_size;
+  JWD1797ArenaBlock* block = newJWD1797ArenaBlock(&bootstrap, first);
+  if(block == NULL) {return NULL;}
+  JWD1797Arena* arena = (JWD1797Arena*)((char*)block + block->used);
+  block->used += (sizeof(JWD1797Arena) + JWD1797_ARENA_ALIGN - 1)
+    & ~(unsigned long)(JWD1797_ARENA_ALIGN - 1);
+  *arena = bootstrap;
+  arena->blocks = block;
+  return arena;
+}
+
+// frees every block of the arena - and with it the arena and all allocations
+void freeJWD1797Arena(JWD1797Arena* arena) {
+  if(arena == NULL) {return;}
+  JWD1797ArenaBlock* block = arena->blocks;
+  while(block != NULL) {
+    JWD1797ArenaBlock* next = block->next;
+    freeJWD1797ArenaBlock(block);
+    block = next;
+  }
+}
+
+/* size zeroed bytes from the arena, aligned to a cache line. NULL if there
+  is no memory. */
+void* allocJWD1797Arena(JWD1797Arena* arena, unsigned long size) {
+  size = (size + JWD1797_ARENA_ALIGN - 1) & ~(unsigned long)(JWD1797_ARENA_ALIGN - 1);
+  JWD1797ArenaBlock* block = arena->blocks;
+  if(block->size - block->used < size) {
+    unsigned long block_size = ARENA_BLOCK_HEADER + size;
+    if(block_size < arena->block_size) {block_size = arena->block_size;}
+    JWD1797ArenaBlock* fresh = newJWD1797ArenaBlock(arena, block_size);
+    if(fresh == NULL) {return NULL;}
+    /* a block made for one large allocation goes behind the current block,
+      which keeps serving the small ones */
+    if(fresh->size - ARENA_BLOCK_HEADER - size < block->size - block->used) {
+      fresh->next = block->next;
+      block->next = fresh;
+    }
+    else {
+      fresh->next = block;
+      arena->blocks = fresh;
+    }
+    block = fresh;
+  }
+  void* p = (char*)block + block->used;
+  block->used += size;
+  return p;
+}
+
+// copy of string s in the arena
+char* copyJWD1797ArenaString(JWD1797Arena* arena, const char* s) {
+  char* copy = (char*)allocJWD1797Arena(arena, strlen(s) + 1);
+  if(copy != NULL) {strcpy(copy, s);}
+  return copy;
+}
+
+// bytes the arena holds (all of its blocks)
+unsigned long getJWD1797ArenaSize(JWD1797Arena* arena) {
+  return arena->reserved;
+}
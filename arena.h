@@ -0,0 +1,33 @@
+// arena allocator (header)
+
+// every allocation starts on its own cache line
+#define JWD1797_ARENA_ALIGN 64
+// back the blocks with huge pages where the host has them
+#define JWD1797_ARENA_HUGE_PAGES 1
+#define JWD1797_HUGE_PAGE_SIZE (2UL << 20)
+
+/* a block of arena memory. Allocations are carved from it one after the
+  other and are only given back when the whole arena is freed. */
+typedef struct JWD1797ArenaBlock {
+  struct JWD1797ArenaBlock* next;
+  unsigned long size;   // bytes in the block, this header included
+  unsigned long used;
+  int mapped;           // from mmap() (huge pages) - otherwise aligned_alloc()
+} JWD1797ArenaBlock;
+
+/* one owner's memory (a controller, an image, a tracer) - freed all at once
+  with freeJWD1797Arena(). The arena lives in its first block. Not thread
+  safe: only the owner allocates. */
+typedef struct JWD1797Arena {
+  JWD1797ArenaBlock* blocks;  // the block allocations come from first
+  unsigned long block_size;
+  int flags;
+  int huge_pages;             // blocks that got explicit huge pages
+  unsigned long reserved;     // bytes in all blocks
+} JWD1797Arena;
+
+JWD1797Arena* newJWD1797Arena(unsigned long, int);
+void freeJWD1797Arena(JWD1797Arena*);
+void* allocJWD1797Arena(JWD1797Arena*, unsigned long);
+char* copyJWD1797ArenaString(JWD1797Arena*, const char*);
+unsigned long getJWD1797ArenaSize(JWD1797Arena*);
@@ -0,0 +1,374 @@
+// benchmark MAIN for jwd1797
+// Joe Matta
+
+/* measures how fast the WD1797 runs a DOS-like workload (seek every track and
+  read all of its sectors with a multi-record READ SECTOR) for different
+  coarse stepping quanta, with byte level (DRQ) transfers and with the high
+  level emulation (HLE) of READ SECTOR that hands every sector to a host DMA
+  callback, with the sectors read through the data FIFO, and byte level again
+  with the activity tracer recording and with the pin waveform (VCD) dump on. The controller runs quiet so only the
+  results are printed.
+  Then the whole disk is imaged through READ TRACK into a track sink, byte
+  level and without emulation, and finally the address mark scanners index
+  every track of the formatted disk, and the cost of starting a session -
+  a new controller loading its own image, a new controller sharing the image
+  and a controller from the pool - is measured. Last, the emulated throughput
+  (KB/s) and the mean rotational wait of sequential single sector DOS reads
+  are compared for different sector interleaves and cylinder skews of the
+  disk image, and the byte level workload is run on 360K, 720K and 1.2M disks
+  to compare the host cost of their track timings. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "jwd1797.h"
+#include "mark_scanner.h"
+#include "tracer.h"
+#include "vcd_writer.h"
+
+// host instruction timings (microseconds) - same list as testMain.c
+double instruction_times[7] = {0.8, 1.6, 1.0, 1.2, 2.6, 2.8, 4.0};
+
+typedef struct {
+  unsigned long host_calls;     // advanceJWD1797() calls (CPU instructions)
+  unsigned long bytes_read;     // data bytes received through DRQ or DMA
+  double emulated_us;           // emulated time covered by the workload
+} BenchResult;
+
+double hostSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* runs instructions until the command is no longer BUSY, servicing DRQ by
+  reading the data register like a CPU polling loop would */
+void runUntilDone(JWD1797* w, BenchResult* r) {
+  unsigned int status;
+  do {
+    double instr_t = instruction_times[rand()%7];
+    advanceJWD1797(w, instr_t);
+    r->host_calls++;
+    r->emulated_us += instr_t;
+    status = readJWD1797(w, 0xB0);
+    // DRQ status bit
+    if((status >> 1) & 1) {
+      readJWD1797(w, 0xB3);
+      r->bytes_read++;
+    }
+  } while(status & 1);
+}
+
+// HLE DMA callback - the bytes land in guest memory without DRQ
+void benchDMA(void* context, const unsigned char* data, unsigned int len) {
+  (void)data;
+  ((BenchResult*)context)->bytes_read += len;
+}
+
+// disk image the imaging runs fill
+typedef struct {
+  unsigned char* data;
+  unsigned long bytes;
+} BenchImage;
+
+// track sink of the imaging runs - appends the bytes to the image
+void benchTrackSink(void* context, int cylinder, int head,
+  const unsigned char* data, unsigned int len, int last) {
+  (void)cylinder; (void)head; (void)last; // tracks arrive in order
+  BenchImage* image = (BenchImage*)context;
+  memcpy(image->data + image->bytes, data, len);
+  image->bytes += len;
+}
+
+/* images the disk with a byte level READ TRACK of every track, the host
+  servicing DRQ. Returns the emulated time it took (microseconds). */
+double imageDiskByteLevel(JWD1797* w, BenchImage* image) {
+  BenchResult r = {0, 0, 0.0};
+  powerOnJWD1797(w);
+  setJWD1797Quantum(w, 0.0);
+  setJWD1797TrackSink(w, benchTrackSink, image);
+  for(unsigned int cyl = 0; cyl < w->cylinders; cyl++) {
+    // SEEK cylinder - load head, 6 ms step rate
+    writeJWD1797(w, 0xB3, cyl);
+    writeJWD1797(w, 0xB0, 0b00011000);
+    runUntilDone(w, &r);
+    for(unsigned int side = 0; side < w->num_heads; side++) {
+      // READ TRACK - side select
+      writeJWD1797(w, 0xB0, 0b11100000 | (side << 1));
+      runUntilDone(w, &r);
+    }
+  }
+  setJWD1797TrackSink(w, NULL, NULL);
+  return r.emulated_us;
+}
+
+// repetitions of the address mark scan of the whole formatted disk
+#define SCAN_REPEATS 1000
+// sessions started per spin-up measurement
+#define SPINUP_REPEATS 1000
+// events kept by the tracer of the traced run (later ones are counted only)
+#define TRACE_CAPACITY (1 << 20)
+
+/* guest work after each sector of the sequential DOS reads (copying the
+  sector out of the DOS buffer, the next call) - longer than the gap to the
+  next sector, so a disk in order loses a rotation per sector */
+#define DOS_SECTOR_WORK_US 3000.0
+// cylinders read by each sequential DOS read run
+#define DOS_CYLINDERS 8
+
+// transfer mode of a run
+#define MODE_BYTE 0     // byte level DRQ transfers
+#define MODE_HLE 1      // HLE DMA transfers
+#define MODE_TRACE 2    // byte level, activity tracer recording
+#define MODE_VCD 3      // byte level, pin waveform dump on
+#define MODE_FIFO 4     // DRQ transfers through the data FIFO
+// file of the VCD run (removed afterwards)
+#define VCD_FILE "bench_pins.vcd"
+
+void runWorkload(JWD1797* w, double quantum_us, int mode, BenchResult* r) {
+  powerOnJWD1797(w);
+  setJWD1797Quantum(w, quantum_us);
+  setJWD1797DMACallback(w, benchDMA, r);
+  setJWD1797HLE(w, mode == MODE_HLE);
+  setJWD1797DataFIFO(w, mode == MODE_FIFO);
+  // RESTORE - load head, 6 ms step rate
+  writeJWD1797(w, 0xB0, 0b00001000);
+  runUntilDone(w, r);
+  for(unsigned int cyl = 0; cyl < w->cylinders; cyl++) {
+    // SEEK cylinder - load head, 6 ms step rate
+    writeJWD1797(w, 0xB3, cyl);
+    writeJWD1797(w, 0xB0, 0b00011000);
+    runUntilDone(w, r);
+    for(unsigned int side = 0; side < w->num_heads; side++) {
+      // READ SECTOR 1..n - multiple records, side select
+      writeJWD1797(w, 0xB2, 1);
+      writeJWD1797(w, 0xB0, 0b10010000 | (side << 1));
+      runUntilDone(w, r);
+    }
+  }
+}
+
+/* reads the first DOS_CYLINDERS cylinders the way DOS reads a file - one
+  single sector READ SECTOR after the other, sector 1..n of side 0, then side
+  1, then a step to the next cylinder - with the guest working in between.
+  The sectors arrive by HLE DMA, which keeps the timing of the byte level
+  transfer. */
+void runDOSReads(JWD1797* w, BenchResult* r) {
+  powerOnJWD1797(w);
+  setJWD1797Quantum(w, 0.0);
+  setJWD1797DMACallback(w, benchDMA, r);
+  setJWD1797HLE(w, 1);
+  // RESTORE - load head, 6 ms step rate
+  writeJWD1797(w, 0xB0, 0b00001000);
+  runUntilDone(w, r);
+  for(unsigned int cyl = 0; cyl < DOS_CYLINDERS && cyl < w->cylinders; cyl++) {
+    // STEP-IN (after cylinder 0) - update track register, load head, 6 ms step rate
+    if(cyl > 0) {
+      writeJWD1797(w, 0xB0, 0b01011000);
+      runUntilDone(w, r);
+    }
+    for(unsigned int side = 0; side < w->num_heads; side++) {
+      for(unsigned int sector = 1; sector <= w->sectors_per_track; sector++) {
+        // READ SECTOR - single record, side select
+        writeJWD1797(w, 0xB2, sector);
+        writeJWD1797(w, 0xB0, 0b10000000 | (side << 1));
+        runUntilDone(w, r);
+        advanceJWD1797(w, DOS_SECTOR_WORK_US);
+        r->host_calls++;
+        r->emulated_us += DOS_SECTOR_WORK_US;
+      }
+    }
+  }
+  setJWD1797HLE(w, 0);
+}
+
+/* writes a raw disk image of size bytes (a sector number pattern) for the
+  disk format runs */
+void writeBenchImage(const char* path, long size) {
+  FILE* f = fopen(path, "wb");
+  for(long i = 0; i < size; i++) {fputc((int)(((i >> 9) * 31 + i) & 0xFF), f);}
+  fclose(f);
+}
+
+int main(void) {
+  // quanta to compare (microseconds) - 0 cycles the controller every instruction
+  double quanta[] = {0.0, 32.0, 100.0, 1000.0, 0.0, 1000.0, 0.0, 100.0, 1000.0,
+    0.0, 0.0};
+  int modes[] = {MODE_BYTE, MODE_BYTE, MODE_BYTE, MODE_BYTE, MODE_HLE, MODE_HLE,
+    MODE_FIFO, MODE_FIFO, MODE_FIFO, MODE_TRACE, MODE_VCD};
+  const char* mode_names[] = {"byte", "HLE", "trace", "VCD", "FIFO"};
+  unsigned long vcd_changes = 0;
+  JWD1797Tracer* tracer = newJWD1797Tracer(TRACE_CAPACITY);
+  int num_quanta = sizeof(quanta)/sizeof(quanta[0]);
+
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin"};
+  JWD1797* jwd1797 = newJWD1797(&config);
+  srand(1);
+
+  printf("\n%6s %10s %14s %14s %12s %10s %10s\n", "mode", "quantum_us",
+    "host_calls/s", "cycles/s", "emu_s/host_s", "bytes", "lost");
+  for(int q = 0; q < num_quanta; q++) {
+    BenchResult r = {0, 0, 0.0};
+    double start = hostSeconds();
+    JWD1797VCDWriter* vcd = NULL;
+    if(modes[q] == MODE_TRACE) {setJWD1797Tracer(jwd1797, tracer, 1);}
+    if(modes[q] == MODE_VCD) {
+      vcd = openJWD1797VCD(VCD_FILE, "jwd1797");
+      if(vcd != NULL) {setJWD1797VCD(jwd1797, vcd);}
+    }
+    runWorkload(jwd1797, quanta[q], modes[q], &r);
+    if(vcd != NULL) {
+      // closing writes out the rest of the buffer - part of the cost
+      setJWD1797VCD(jwd1797, NULL);
+      vcd_changes = getJWD1797VCDChanges(vcd);
+      closeJWD1797VCD(vcd);
+    }
+    double elapsed = hostSeconds() - start;
+    setJWD1797Tracer(jwd1797, NULL, 0);
+    /* controller cycles: one per instruction without a quantum, otherwise one
+      per elapsed quantum */
+    double cycles = quanta[q] > 0.0 ? r.emulated_us/quanta[q] : (double)r.host_calls;
+    // bytes the host never saw because DRQ was not serviced in time
+    unsigned long disk_bytes = jwd1797->cylinders * jwd1797->num_heads
+      * jwd1797->sectors_per_track * jwd1797->sector_length;
+    printf("%6s %10.1f %14.0f %14.0f %12.2f %10lu %10lu\n",
+      mode_names[modes[q]], quanta[q],
+      r.host_calls/elapsed, cycles/elapsed, (r.emulated_us/1e6)/elapsed,
+      r.bytes_read, disk_bytes - r.bytes_read);
+  }
+  printf("%s%lu%s%lu%s\n", "traced run: ", getJWD1797TraceEventCount(tracer),
+    " events kept, ", getJWD1797TraceDropped(tracer), " dropped (buffer full)");
+  freeJWD1797Tracer(tracer);
+  FILE* vcd_file = fopen(VCD_FILE, "rb");
+  if(vcd_file != NULL) {
+    fseek(vcd_file, 0, SEEK_END);
+    printf("%s%lu%s%ld%s\n", "VCD run: ", vcd_changes, " pin changes, ",
+      ftell(vcd_file), " bytes");
+    fclose(vcd_file);
+    remove(VCD_FILE);
+  }
+
+  // whole disk images through the track sink
+  BenchImage image = {(unsigned char*)malloc(jwd1797->image->formatted_disk_size), 0};
+  double start = hostSeconds();
+  double emulated_us = imageDiskByteLevel(jwd1797, &image);
+  double elapsed = hostSeconds() - start;
+  printf("\n%8s %12s %12s %12s\n", "imaging", "bytes", "host_ms", "MB/s");
+  printf("%8s %12lu %12.1f %12.2f %s%.0f%s\n", "byte", image.bytes, elapsed*1e3,
+    image.bytes/elapsed/1e6, "(emulated ", emulated_us/1e3, " ms)");
+  start = hostSeconds();
+  for(int rep = 0; rep < SCAN_REPEATS; rep++) {
+    image.bytes = 0;
+    captureJWD1797Disk(jwd1797, benchTrackSink, &image);
+  }
+  elapsed = (hostSeconds() - start)/SCAN_REPEATS;
+  printf("%8s %12lu %12.4f %12.0f\n", "direct", image.bytes, elapsed*1e3,
+    image.bytes/elapsed/1e6);
+  free(image.data);
+
+  // address mark scanners over every formatted track of the disk
+  unsigned int (*scanners[])(const unsigned char*, unsigned int, unsigned int,
+    unsigned int*, unsigned int) = {scanAddressMarksScalar, scanAddressMarksSSE2,
+    scanAddressMarksAVX2};
+  const char* scanner_names[] = {"scalar", "SSE2", "AVX2"};
+  JWD1797Image* img = jwd1797->image;
+  unsigned int marks[4 * JWD1797_MAX_SECTORS_PER_TRACK];
+  printf("\n%8s %12s %12s %10s\n", "scanner", "us/image", "MB/s", "marks");
+  for(int sc = 0; sc < 3; sc++) {
+    unsigned long found = 0;
+    double start = hostSeconds();
+    for(int rep = 0; rep < SCAN_REPEATS; rep++) {
+      found = 0;
+      for(unsigned int t = 0; t < img->num_tracks; t++) {
+        found += scanners[sc](img->formattedDiskArray + img->tracks[t].formatted_offset,
+          img->tracks[t].formatted_length, 0, marks, 4 * JWD1797_MAX_SECTORS_PER_TRACK);
+      }
+    }
+    double elapsed = (hostSeconds() - start)/SCAN_REPEATS;
+    printf("%8s %12.1f %12.0f %10lu\n", scanner_names[sc], elapsed*1e6,
+      img->formatted_disk_size/elapsed/1e6, found);
+  }
+  // full layout index (scan + ID fields) of every track
+  JWD1797TrackDescriptor scanned;
+  unsigned int offsets[JWD1797_MAX_SECTORS_PER_TRACK];
+  start = hostSeconds();
+  for(int rep = 0; rep < SCAN_REPEATS; rep++) {
+    for(unsigned int t = 0; t < img->num_tracks; t++) {
+      scanned = img->tracks[t];
+      indexJWD1797Track(img->formattedDiskArray + scanned.formatted_offset,
+        scanned.formatted_length, &scanned, offsets, img->sectors_per_track);
+    }
+  }
+  printf("%s%s%s%.1f%s\n", "layout index (", getAddressMarkScannerName(), "): ",
+    (hostSeconds() - start)/SCAN_REPEATS*1e6, " us/image");
+
+
+  /* session spin-up - get a controller in the reset state, write a sector
+    like a short session would, and let it go */
+  const char* spinup_names[] = {"load", "shared", "pool"};
+  JWD1797Config shared_config = {.image_path = "Z_DOS_ver1.bin", .image = img};
+  JWD1797Pool* pool = newJWD1797Pool(&shared_config, 1);
+  printf("\n%8s %12s\n", "spin-up", "us/session");
+  for(int kind = 0; kind < 3; kind++) {
+    double start = hostSeconds();
+    for(int rep = 0; rep < SPINUP_REPEATS; rep++) {
+      JWD1797* w = kind == 0 ? newJWD1797(&config) :
+        kind == 1 ? newJWD1797(&shared_config) : acquireJWD1797(pool);
+      getJWD1797SectorPtrForWrite(w, rep % w->cylinders, 0, 1, NULL)[0] = 0xE5;
+      if(kind == 2) {returnJWD1797(pool, w);}
+      else {freeJWD1797(w);}
+    }
+    printf("%8s %12.2f\n", spinup_names[kind],
+      (hostSeconds() - start)/SPINUP_REPEATS*1e6);
+  }
+  freeJWD1797Pool(pool);
+
+  /* sequential DOS reads for each sector interleave and cylinder skew - the
+    disk image is laid out again for every setting */
+  unsigned int interleaves[] = {1, 2, 3};
+  unsigned int skews[] = {0, 1, 2};
+  printf("\n%10s %6s %12s %12s %12s %12s\n", "interleave", "skew", "bytes",
+    "emulated_s", "KB/s", "wait_bytes");
+  for(int i = 0; i < 3; i++) {
+    for(int k = 0; k < 3; k++) {
+      JWD1797Config layout_config = {.image_path = "Z_DOS_ver1.bin",
+        .interleave = interleaves[i], .skew = skews[k]};
+      JWD1797* w = newJWD1797(&layout_config);
+      BenchResult r = {0, 0, 0.0};
+      runDOSReads(w, &r);
+      // mean rotational wait of a READ SECTOR from the controller statistics
+      JWD1797Stats stats;
+      getJWD1797Stats(w, &stats);
+      printf("%10u %6u %12lu %12.2f %12.2f %12.0f\n", interleaves[i], skews[k],
+        r.bytes_read, r.emulated_us/1e6, r.bytes_read/1024.0/(r.emulated_us/1e6),
+        (double)stats.rotational_wait[1].sum/stats.rotational_wait[1].samples);
+      freeJWD1797(w);
+    }
+  }
+
+  /* byte level workload on each disk format - HD tracks pass twice the bytes
+    per instruction the DD ones do */
+  const char* format_images[] = {"Z_DOS_ver1.bin", "bench_720.img", "bench_1200.img"};
+  long format_sizes[] = {0, 737280, 1228800};
+  printf("\n%22s %10s %12s %10s %14s %12s\n", "format", "bytes", "emulated_s",
+    "KB/s", "host_calls/s", "emu_s/host_s");
+  for(int f = 0; f < 3; f++) {
+    if(format_sizes[f] > 0) {writeBenchImage(format_images[f], format_sizes[f]);}
+    JWD1797Config format_config = {.image_path = format_images[f],
+      .no_cache = format_sizes[f] > 0};
+    JWD1797* w = newJWD1797(&format_config);
+    BenchResult r = {0, 0, 0.0};
+    double start = hostSeconds();
+    runWorkload(w, 0.0, MODE_BYTE, &r);
+    double elapsed = hostSeconds() - start;
+    printf("%22s %10lu %12.2f %10.2f %14.0f %12.1f\n", w->format->name, r.bytes_read,
+      r.emulated_us/1e6, r.bytes_read/1024.0/(r.emulated_us/1e6),
+      r.host_calls/elapsed, r.emulated_us/1e6/elapsed);
+    freeJWD1797(w);
+    if(format_sizes[f] > 0) {remove(format_images[f]);}
+  }
+
+  freeJWD1797(jwd1797);
+  return 0;
+}
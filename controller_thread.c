@@ -0,0 +1,241 @@
+// threaded front end of the WD1797
+// runs a controller on its own thread, off the CPU emulation thread - see
+// startJWD1797Thread()
+
+#include <stdlib.h>
+#include <sched.h>
+#include "jwd1797.h"
+#include "controller_thread.h"
+
+// empty ring checks before the controller thread goes to sleep
+#define THREAD_IDLE_SPINS 2000
+
+/* publishes the controller state for the CPU side (sequence lock writer).
+  The port values are what readJWD1797() would return now. A FIFO transfer
+  resolves DRQ, lost data and the data byte at the host's time - unless the
+  FIFO is not filled up to there, then a read has to run the controller and
+  is marked to run on the controller thread. */
+void publishJWD1797Snapshot(JWD1797Thread* t) {
+  JWD1797* w = t->w;
+  unsigned int status = w->statusRegister, data = w->dataRegister, read_sync = 0;
+  int drq = w->drq;
+  if(w->fifo_transfer) {
+    JWD1797DataFIFO* fifo = w->data_fifo;
+    unsigned long long now = w->emulated_time_ns + w->quantum_accumulator_ns;
+    // ports 0xB0 and 0xB3
+    if(w->command_done || now > fifo->complete_ns) {read_sync = 0b00001001;}
+    else {
+      stepJWD1797DataFIFO(fifo, now);
+      if(w->currentCommandType == 2) {
+        status = (status & 0b11111001) | getJWD1797DataFIFOStatus(fifo, now);
+        drq = (status >> 1) & 1;
+      }
+      data = fifo->value;
+    }
+  }
+  unsigned long seq = t->seq;
+  __atomic_store_n(&t->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  JWD1797Snapshot* s = &t->snapshot;
+  __atomic_store_n(&s->consumed, t->tail, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->emulated_time_ns, w->emulated_time_ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->ports[0], status, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->ports[1], w->trackRegister, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->ports[2], w->sectorRegister, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->ports[3], data, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->ports[4], w->controlLatch, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->ports[5], w->controlStatus, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->read_sync, read_sync, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->read_value, t->read_value, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->drq, drq, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->intrq, w->intrq, __ATOMIC_RELAXED);
+  __atomic_store_n(&t->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* copies the last published snapshot (sequence lock reader) - retried while
+  the controller thread is writing it */
+void getJWD1797ThreadSnapshot(JWD1797Thread* t, JWD1797Snapshot* snapshot) {
+  JWD1797Snapshot* s = &t->snapshot;
+  while(1) {
+    unsigned long seq = __atomic_load_n(&t->seq, __ATOMIC_ACQUIRE);
+    if(seq & 1) {
+      sched_yield();
+      continue;
+    }
+    snapshot->consumed = __atomic_load_n(&s->consumed, __ATOMIC_RELAXED);
+    snapshot->emulated_time_ns = __atomic_load_n(&s->emulated_time_ns, __ATOMIC_RELAXED);
+    for(int i = 0; i < 6; i++) {
+      snapshot->ports[i] = __atomic_load_n(&s->ports[i], __ATOMIC_RELAXED);
+    }
+    snapshot->read_sync = __atomic_load_n(&s->read_sync, __ATOMIC_RELAXED);
+    snapshot->read_value = __atomic_load_n(&s->read_value, __ATOMIC_RELAXED);
+    snapshot->drq = __atomic_load_n(&s->drq, __ATOMIC_RELAXED);
+    snapshot->intrq = __atomic_load_n(&s->intrq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&t->seq, __ATOMIC_RELAXED) == seq) {return;}
+  }
+}
+
+/* waits until there are ops to run. Spins a while, then sleeps on the wake
+  condition - the CPU side checks sleeping after every post, and both sides
+  order their flag and index with a full fence so a post is never missed. */
+void waitJWD1797ThreadOps(JWD1797Thread* t) {
+  for(int spin = 0; spin < THREAD_IDLE_SPINS; spin++) {
+    if(__atomic_load_n(&t->head, __ATOMIC_ACQUIRE) != t->tail) {return;}
+    if(spin % 64 == 63) {sched_yield();}
+  }
+  pthread_mutex_lock(&t->lock);
+  __atomic_store_n(&t->sleeping, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  while(__atomic_load_n(&t->head, __ATOMIC_ACQUIRE) == t->tail) {
+    pthread_cond_wait(&t->wake, &t->lock);
+  }
+  __atomic_store_n(&t->sleeping, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&t->lock);
+}
+
+/* controller thread - runs the posted ops in batches. Time advances in a row
+  are run as one advanceJWD1797() up to the next port access (the CPU's time
+  horizon), so the controller fast paths see the whole stretch. */
+void* runJWD1797Thread(void* arg) {
+  JWD1797Thread* t = (JWD1797Thread*)arg;
+  JWD1797* w = t->w;
+  int running = 1;
+  while(running) {
+    waitJWD1797ThreadOps(t);
+    unsigned long head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+    unsigned long tail = t->tail;
+    unsigned long long advance_ns = 0;
+    int advances = 0;
+    for(; tail != head && running; tail++) {
+      JWD1797ThreadOp* op = &t->ring[tail % JWD1797_THREAD_RING_SIZE];
+      if(op->op == JWD1797_THREAD_ADVANCE) {
+        // same rounding as advanceJWD1797()
+        advance_ns += (unsigned long long)(op->us*1000.0 + 0.5);
+        if(advances++ > 0) {t->merged++;}
+        continue;
+      }
+      if(advances > 0) {
+        advanceJWD1797(w, advance_ns/1000.0);
+        advance_ns = 0;
+        advances = 0;
+      }
+      if(op->op == JWD1797_THREAD_WRITE) {writeJWD1797(w, op->port, op->value);}
+      else if(op->op == JWD1797_THREAD_READ) {t->read_value = readJWD1797(w, op->port);}
+      else {running = 0;}
+    }
+    if(advances > 0) {advanceJWD1797(w, advance_ns/1000.0);}
+    __atomic_store_n(&t->tail, tail, __ATOMIC_RELEASE);
+    t->batches++;
+    publishJWD1797Snapshot(t);
+  }
+  return NULL;
+}
+
+/* queues an op for the controller thread - waits while the ring is full and
+  wakes the controller thread if it sleeps */
+void postJWD1797ThreadOp(JWD1797Thread* t, unsigned int op, unsigned int port,
+  unsigned int value, double us) {
+  unsigned long head = t->head;
+  while(head - t->tail_cache >= JWD1797_THREAD_RING_SIZE) {
+    t->tail_cache = __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE);
+    if(head - t->tail_cache >= JWD1797_THREAD_RING_SIZE) {sched_yield();}
+  }
+  JWD1797ThreadOp* slot = &t->ring[head % JWD1797_THREAD_RING_SIZE];
+  slot->op = op;
+  slot->port = port;
+  slot->value = value;
+  slot->us = us;
+  __atomic_store_n(&t->head, head + 1, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&t->sleeping, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&t->lock);
+    pthread_cond_signal(&t->wake);
+    pthread_mutex_unlock(&t->lock);
+  }
+}
+
+/* starts a thread that runs controller w. From here on the CPU side only
+  reaches the controller through the *JWD1797Thread() functions - until
+  syncJWD1797Thread() or stopJWD1797Thread() hand it back. A DMA callback,
+  track sink, tracer or VCD dump set on w runs on the controller thread.
+  NULL if the thread can not be started. */
+JWD1797Thread* startJWD1797Thread(JWD1797* w) {
+  JWD1797Thread* t = (JWD1797Thread*)aligned_alloc(64, sizeof(JWD1797Thread));
+  if(t == NULL) {return NULL;}
+  t->w = w;
+  t->head = 0;
+  t->tail_cache = 0;
+  t->sync_reads = 0;
+  t->tail = 0;
+  t->sleeping = 0;
+  t->batches = 0;
+  t->merged = 0;
+  t->read_value = 0;
+  t->seq = 0;
+  pthread_mutex_init(&t->lock, NULL);
+  pthread_cond_init(&t->wake, NULL);
+  publishJWD1797Snapshot(t);
+  if(pthread_create(&t->thread, NULL, runJWD1797Thread, t) != 0) {
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->wake);
+    free(t);
+    return NULL;
+  }
+  return t;
+}
+
+/* runs what is queued, ends the controller thread and frees it. The
+  controller belongs to the caller again. */
+void stopJWD1797Thread(JWD1797Thread* t) {
+  if(t == NULL) {return;}
+  postJWD1797ThreadOp(t, JWD1797_THREAD_STOP, 0, 0, 0.0);
+  pthread_join(t->thread, NULL);
+  pthread_mutex_destroy(&t->lock);
+  pthread_cond_destroy(&t->wake);
+  free(t);
+}
+
+// writeJWD1797() on the controller thread - returns at once
+void writeJWD1797Thread(JWD1797Thread* t, unsigned int port_addr, unsigned int value) {
+  postJWD1797ThreadOp(t, JWD1797_THREAD_WRITE, port_addr, value, 0.0);
+}
+
+/* advanceJWD1797() on the controller thread - returns at once. The time
+  posted is the horizon the controller thread may run up to. */
+void advanceJWD1797Thread(JWD1797Thread* t, double us) {
+  postJWD1797ThreadOp(t, JWD1797_THREAD_ADVANCE, 0, 0, us);
+}
+
+/* waits until the controller thread has run every op posted so far and
+  copies the snapshot it published then (snapshot may be NULL). The CPU side
+  may touch the controller directly until it posts again. */
+void syncJWD1797Thread(JWD1797Thread* t, JWD1797Snapshot* snapshot) {
+  JWD1797Snapshot s;
+  int spin = 0;
+  while(1) {
+    getJWD1797ThreadSnapshot(t, &s);
+    if(s.consumed == t->head) {break;}
+    if(++spin % 64 == 0) {sched_yield();}
+  }
+  if(snapshot != NULL) {*snapshot = s;}
+}
+
+/* readJWD1797() for the CPU side. Once the controller thread has run
+  everything posted before, the value comes from the snapshot - exactly what
+  a direct read would return - and the read itself (clearing INTRQ or DRQ,
+  taking a FIFO byte) is posted to run on the controller thread before
+  anything later, without waiting for it. Only a read the snapshot could not
+  resolve waits for the controller thread to run it. */
+unsigned int readJWD1797Thread(JWD1797Thread* t, unsigned int port_addr) {
+  JWD1797Snapshot s;
+  syncJWD1797Thread(t, &s);
+  postJWD1797ThreadOp(t, JWD1797_THREAD_READ, port_addr, 0, 0.0);
+  if(port_addr < 0xB0 || port_addr > 0xB5) {return 0;}
+  if(s.read_sync & (1 << (port_addr - 0xB0))) {
+    t->sync_reads++;
+    syncJWD1797Thread(t, &s);
+    return s.read_value;
+  }
+  return s.ports[port_addr - 0xB0];
+}
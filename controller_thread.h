@@ -0,0 +1,66 @@
+// threaded front end of the WD1797 (header)
+
+#include <pthread.h>
+
+// ops the CPU side can queue - a power of two
+#define JWD1797_THREAD_RING_SIZE 1024
+
+// queued op kinds
+#define JWD1797_THREAD_WRITE 0     // writeJWD1797(port, value)
+#define JWD1797_THREAD_READ 1      // readJWD1797(port), value in the snapshot
+#define JWD1797_THREAD_ADVANCE 2   // advanceJWD1797(us)
+#define JWD1797_THREAD_STOP 3      // leave the controller thread
+
+typedef struct {
+  unsigned int op;
+  unsigned int port;
+  unsigned int value;
+  double us;
+} JWD1797ThreadOp;
+
+/* controller state the CPU side reads without touching the controller -
+  published by the controller thread after every batch of ops */
+typedef struct {
+  unsigned long consumed;              // ops done when it was published
+  unsigned long long emulated_time_ns;
+  unsigned int ports[6];               // value a read of port 0xB0 + n returns
+  unsigned int read_sync;              // bit n - a read of 0xB0 + n must run first
+  unsigned int read_value;             // what the last queued read returned
+  int drq;
+  int intrq;
+} JWD1797Snapshot;
+
+/* one controller run on its own thread. The CPU side (one thread) posts port
+  accesses and time advances through a single producer / single consumer
+  ring; the controller thread takes them in batches and runs all the time
+  posted before the next port access in one go. Reads resolve against the
+  snapshot, published with a sequence lock. Each index and the snapshot sit on
+  their own cache lines. */
+typedef struct {
+  JWD1797* w;
+  pthread_t thread;
+  JWD1797ThreadOp ring[JWD1797_THREAD_RING_SIZE];
+  // CPU side
+  unsigned long head __attribute__((aligned(64)));   // next op posted
+  unsigned long tail_cache;    // tail as the CPU side last saw it
+  unsigned long sync_reads;    // reads the snapshot could not resolve
+  // controller thread side
+  unsigned long tail __attribute__((aligned(64)));   // next op to run
+  int sleeping;                // waiting on wake for ops
+  unsigned long batches;
+  unsigned long merged;        // advances run together with the one before
+  unsigned int read_value;     // value of the last read op run
+  // snapshot - odd seq while it is being written
+  unsigned long seq __attribute__((aligned(64)));
+  JWD1797Snapshot snapshot;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} JWD1797Thread;
+
+JWD1797Thread* startJWD1797Thread(JWD1797*);
+void stopJWD1797Thread(JWD1797Thread*);
+void writeJWD1797Thread(JWD1797Thread*, unsigned int, unsigned int);
+unsigned int readJWD1797Thread(JWD1797Thread*, unsigned int);
+void advanceJWD1797Thread(JWD1797Thread*, double);
+void syncJWD1797Thread(JWD1797Thread*, JWD1797Snapshot*);
+void getJWD1797ThreadSnapshot(JWD1797Thread*, JWD1797Snapshot*);
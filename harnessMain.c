@@ -0,0 +1,203 @@
+// multi-instance harness MAIN for jwd1797
+// Joe Matta
+
+/* creates N independent JWD1797 controllers and drives a scripted workload on
+  each one (RESTORE, then random SEEK/READ SECTOR/READ ADDRESS sequences like
+  the ones in testFunctions.c) on a work-stealing thread pool. Sessions take
+  their controller from a controller pool bound to the one formatted image
+  and give it back when they are done. The same set of
+  sessions is run with 1, 2, 4, ... threads to show how the controller scales
+  across cores.
+    ./harness_jwd [sessions] [max_threads] [commands_per_session] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "jwd1797.h"
+#include "thread_pool.h"
+
+#define DISK_IMAGE "Z_DOS_ver1.bin"
+// give up on a command that is still BUSY after this many instructions
+#define MAX_INSTRUCTIONS_PER_COMMAND 2000000
+
+// host instruction timings (microseconds) - same list as testMain.c
+double instruction_times[7] = {0.8, 1.6, 1.0, 1.2, 2.6, 2.8, 4.0};
+
+/* per-session results. Each session is written by exactly one worker and is
+  padded to its own cache line so neighbouring sessions never false-share. */
+typedef struct {
+  int id;
+  int commands;
+  unsigned int seed;
+  const unsigned char* payload;   // shared, read-only reference image
+  JWD1797Pool* controllers;       // controllers bound to the shared image
+  double emulated_us;
+  unsigned long bytes_read;
+  unsigned long bad_bytes;        // READ SECTOR bytes that differ from the image
+  unsigned long timeouts;         // commands that never finished
+} __attribute__((aligned(64))) Session;
+
+double hostSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* runs instructions until the command is no longer BUSY. DRQ is serviced by
+  reading the data register; if expected is not NULL the bytes are compared
+  against it. */
+void runSessionCommand(JWD1797* w, Session* s, const unsigned char* expected,
+  unsigned int expected_len) {
+  unsigned int status;
+  unsigned int received = 0;
+  int instructions = 0;
+  do {
+    double instr_t = instruction_times[rand_r(&s->seed)%7];
+    doJWD1797Cycle(w, instr_t);
+    s->emulated_us += instr_t;
+    status = readJWD1797(w, 0xB0);
+    // DRQ status bit
+    if((status >> 1) & 1) {
+      unsigned char r_byte = (unsigned char)readJWD1797(w, 0xB3);
+      if(expected != NULL && received < expected_len &&
+        r_byte != expected[received]) {s->bad_bytes++;}
+      received++;
+      s->bytes_read++;
+    }
+    if(++instructions >= MAX_INSTRUCTIONS_PER_COMMAND) {
+      s->timeouts++;
+      // terminate the command (force interrupt, no INTRQ)
+      writeJWD1797(w, 0xB0, 0xD0);
+      doJWD1797Cycle(w, instr_t);
+      break;
+    }
+  } while(status & 1);
+}
+
+// one complete session: take a controller, run the script, give it back
+void runSession(void* arg) {
+  Session* s = (Session*)arg;
+  // every controller shares the one formatted base image
+  JWD1797* w = acquireJWD1797(s->controllers);
+
+  // RESTORE - load head, 6 ms step rate
+  writeJWD1797(w, 0xB0, 0b00001000);
+  runSessionCommand(w, s, NULL, 0);
+
+  for(int c = 0; c < s->commands; c++) {
+    int cyl = rand_r(&s->seed) % w->cylinders;
+    int side = rand_r(&s->seed) % w->num_heads;
+    int sector = (rand_r(&s->seed) % w->sectors_per_track) + 1;
+    // SEEK - load head, 6 ms step rate
+    writeJWD1797(w, 0xB3, cyl);
+    writeJWD1797(w, 0xB0, 0b00011000);
+    runSessionCommand(w, s, NULL, 0);
+    if(rand_r(&s->seed) % 4 == 0) {
+      // READ ADDRESS - side select
+      writeJWD1797(w, 0xB0, 0b11000000 | (side << 1));
+      runSessionCommand(w, s, NULL, 0);
+    }
+    else {
+      // READ SECTOR - single record, side select
+      unsigned long offset = ((cyl * w->num_heads + side) * w->sectors_per_track
+        + (sector - 1)) * w->sector_length;
+      writeJWD1797(w, 0xB2, sector);
+      writeJWD1797(w, 0xB0, 0b10000000 | (side << 1));
+      runSessionCommand(w, s, s->payload + offset, w->sector_length);
+    }
+  }
+  returnJWD1797(s->controllers, w);
+}
+
+// loads the raw image payload used to check the bytes each session reads
+unsigned char* loadPayload(const char* fileName) {
+  FILE* f = fopen(fileName, "rb");
+  if(f == NULL) {return NULL;}
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  rewind(f);
+  unsigned char* payload = size < 0 ? NULL : (unsigned char*)malloc(size);
+  if(payload != NULL && fread(payload, 1, size, f) != (size_t)size) {
+    free(payload);
+    payload = NULL;
+  }
+  fclose(f);
+  return payload;
+}
+
+int main(int argc, char* argv[]) {
+  int num_sessions = argc > 1 ? atoi(argv[1]) : 64;
+  int max_threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int commands = argc > 3 ? atoi(argv[3]) : 8;
+  if(max_threads < 1) {max_threads = 1;}
+
+  unsigned char* payload = loadPayload(DISK_IMAGE);
+  if(payload == NULL) {
+    printf("%s\n", "ERROR: could not load disk image " DISK_IMAGE);
+    return 1;
+  }
+  // format the disk once - sessions only add their own written tracks
+  JWD1797Config image_config = {.image_path = DISK_IMAGE};
+  JWD1797Image* image = loadJWD1797Image(&image_config);
+  if(image == NULL) {
+    printf("%s\n", "ERROR: could not format disk image " DISK_IMAGE);
+    return 1;
+  }
+  // one idle controller per thread is enough - a session holds one at a time
+  image_config.image = image;
+  JWD1797Pool* controllers = newJWD1797Pool(&image_config, max_threads);
+  Session* sessions = (Session*)aligned_alloc(64, sizeof(Session) * num_sessions);
+
+  printf("\n%d sessions, %d commands each, up to %d threads\n\n", num_sessions,
+    commands, max_threads);
+  printf("%8s %10s %14s %10s %11s %8s %10s %9s\n", "threads", "host_s",
+    "emu_s/host_s", "speedup", "efficiency", "steals", "bad_bytes", "timeouts");
+
+  double base_rate = 0.0;
+  int threads = 1;
+  while(1) {
+    // same seeds for every thread count - identical emulated work
+    for(int i = 0; i < num_sessions; i++) {
+      memset(&sessions[i], 0, sizeof(Session));
+      sessions[i].id = i;
+      sessions[i].commands = commands;
+      sessions[i].seed = 1000 + i;
+      sessions[i].payload = payload;
+      sessions[i].controllers = controllers;
+    }
+    ThreadPool* pool = newThreadPool(threads);
+    double start = hostSeconds();
+    for(int i = 0; i < num_sessions; i++) {
+      submitThreadPoolTask(pool, runSession, &sessions[i]);
+    }
+    waitThreadPool(pool);
+    double elapsed = hostSeconds() - start;
+    unsigned long steals = getThreadPoolSteals(pool);
+    freeThreadPool(pool);
+
+    double emulated_s = 0.0;
+    unsigned long bad_bytes = 0;
+    unsigned long timeouts = 0;
+    for(int i = 0; i < num_sessions; i++) {
+      emulated_s += sessions[i].emulated_us/1e6;
+      bad_bytes += sessions[i].bad_bytes;
+      timeouts += sessions[i].timeouts;
+    }
+    double rate = emulated_s/elapsed;
+    if(threads == 1) {base_rate = rate;}
+    printf("%8d %10.3f %14.2f %10.2f %10.0f%% %8lu %10lu %9lu\n", threads,
+      elapsed, rate, rate/base_rate, 100.0*(rate/base_rate)/threads, steals,
+      bad_bytes, timeouts);
+    // double the threads, finishing with exactly max_threads
+    if(threads == max_threads) {break;}
+    threads = threads*2 > max_threads ? max_threads : threads*2;
+  }
+
+  free(sessions);
+  freeJWD1797Pool(controllers);
+  releaseJWD1797Image(image);
+  free(payload);
+  return 0;
+}
@@ -0,0 +1,335 @@
+// disk image loaders
+// every supported image file format is turned into the same per-track
+// descriptor table (JWD1797Image tracks) that the formatter in jwd1797.c uses
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jwd1797.h"
+#include "arena.h"
+#include "image_loaders.h"
+
+/* known loaders, in probe order. Container formats with a signature come
+  first; raw sector dumps are recognised by their loader table or their size. */
+const JWD1797ImageLoader jwd1797_image_loaders[] = {
+  {"IMD (ImageDisk)", probeIMDImage, loadIMDImage},
+  {"raw (Z-DOS loader table)", probeZDOSImage, loadZDOSImage},
+  {"raw (size)", probeRawImage, loadRawImage}
+};
+
+/* raw sector dump sizes and their geometry (cylinders, heads, sectors per
+  track, sector length) */
+const struct {
+  long size;
+  unsigned int cylinders, num_heads, sectors_per_track, sector_length;
+} raw_image_geometries[] = {
+  {163840, 40, 1, 8, 512},    // 160K SS/DD
+  {184320, 40, 1, 9, 512},    // 180K SS/DD
+  {327680, 40, 2, 8, 512},    // 320K DS/DD
+  {368640, 40, 2, 9, 512},    // 360K DS/DD
+  {655360, 80, 2, 8, 512},    // 640K DS/QD
+  {737280, 80, 2, 9, 512},    // 720K DS/QD
+  {1228800, 80, 2, 15, 512},  // 1.2M DS/HD
+  {1474560, 80, 2, 18, 512}   // 1.44M DS/HD
+};
+
+// returns the first loader that recognises the payload (NULL if none does)
+const JWD1797ImageLoader* findJWD1797ImageLoader(unsigned char* payload,
+  long size, JWD1797Config* config) {
+  int num_loaders = sizeof(jwd1797_image_loaders)/sizeof(jwd1797_image_loaders[0]);
+  for(int i = 0; i < num_loaders; i++) {
+    if(jwd1797_image_loaders[i].probe(payload, size, config)) {
+      return &jwd1797_image_loaders[i];
+    }
+  }
+  return NULL;
+}
+
+// ID field sector length code (N) for a sector length in bytes
+unsigned char getSectorSizeCode(unsigned int sector_length) {
+  unsigned char n = 0;
+  while((128u << n) < sector_length && n < 7) {n++;}
+  return n;
+}
+
+/* describes a uniform disk - every track has sectors 1..sectors_per_track in
+  order, the sectors of a track follow each other in the sector data and the
+  tracks are stored cylinder by cylinder, head by head. Returns 0 if the
+  geometry can not be represented. */
+int setRawTrackDescriptors(JWD1797Image* img, unsigned int cylinders,
+  unsigned int num_heads, unsigned int sectors_per_track,
+  unsigned int sector_length) {
+  if(cylinders == 0 || num_heads == 0 || num_heads > 2 || sector_length == 0 ||
+    sectors_per_track == 0 || sectors_per_track > JWD1797_MAX_SECTORS_PER_TRACK) {
+    return 0;
+  }
+  img->cylinders = cylinders;
+  img->num_heads = num_heads;
+  img->sectors_per_track = sectors_per_track;
+  img->sector_length = sector_length;
+  img->num_tracks = cylinders * num_heads;
+  img->tracks = (JWD1797TrackDescriptor*)allocJWD1797Arena(img->arena,
+    img->num_tracks * sizeof(JWD1797TrackDescriptor));
+  if(img->tracks == NULL) {return 0;}
+  for(unsigned int cyl = 0; cyl < cylinders; cyl++) {
+    for(unsigned int h = 0; h < num_heads; h++) {
+      JWD1797TrackDescriptor* t = &img->tracks[(cyl * num_heads) + h];
+      t->cylinder = cyl;
+      t->head = h;
+      t->num_sectors = sectors_per_track;
+      t->size_code = getSectorSizeCode(sector_length);
+      t->sector_length = sector_length;
+      t->data_offset = (unsigned long long)((cyl * num_heads) + h)
+        * sectors_per_track * sector_length;
+      for(unsigned int s = 0; s < sectors_per_track; s++) {
+        t->sector_ids[s] = s + 1;
+        t->id_cylinders[s] = cyl;
+        t->id_heads[s] = h;
+      }
+    }
+  }
+  return 1;
+}
+
+/* lays the sectors of a raw image out with the interleave and skew of the
+  config. Logical sector n (0-based) of a track on cylinder c goes to slot
+  (n * interleave + c * skew) mod sectors - or the next free slot after it -
+  and its data moves with it, so the sector data stays in the order the
+  sectors pass under the head. Both heads of a cylinder share the layout.
+  Returns the payload itself when the sectors stay 1..N in order, otherwise a
+  new array in the scratch arena (NULL if it can not be allocated). */
+unsigned char* interleaveRawSectors(JWD1797Image* img, unsigned char* payload,
+  long size, JWD1797Config* config, JWD1797Arena* scratch) {
+  unsigned int interleave = config->interleave > 1 ? config->interleave : 1;
+  if(interleave == 1 && config->skew == 0) {return payload;}
+  unsigned char* sector_data = (unsigned char*)allocJWD1797Arena(scratch, size + 1);
+  if(sector_data == NULL) {return NULL;}
+  memcpy(sector_data, payload, size);
+  for(unsigned int i = 0; i < img->num_tracks; i++) {
+    JWD1797TrackDescriptor* t = &img->tracks[i];
+    unsigned char used[JWD1797_MAX_SECTORS_PER_TRACK] = {0};
+    for(int n = 0; n < t->num_sectors; n++) {
+      unsigned int slot = ((unsigned long)n * interleave +
+        (unsigned long)t->cylinder * config->skew) % t->num_sectors;
+      while(used[slot]) {slot = (slot + 1) % t->num_sectors;}
+      used[slot] = 1;
+      t->sector_ids[slot] = n + 1;
+      // data of sector n + 1 into the slot (past the end of the payload reads 0)
+      long from = t->data_offset + (long)n * t->sector_length;
+      long to = t->data_offset + (long)slot * t->sector_length;
+      for(long ct = 0; ct < t->sector_length && to + ct < size; ct++) {
+        sector_data[to + ct] = from + ct < size ? payload[from + ct] : 0x00;
+      }
+    }
+  }
+  return sector_data;
+}
+
+/* ------------- IMD (ImageDisk) ---------------- */
+
+// IMD files start with "IMD " and an ASCII comment ending in 0x1A
+int probeIMDImage(unsigned char* payload, long size, JWD1797Config* config) {
+  (void)config;
+  return size >= 4 && memcmp(payload, "IMD ", 4) == 0;
+}
+
+/* walks the IMD track records. Without sector_data (first pass) only the
+  geometry is collected and *data_size is set to the sector data size needed.
+  With sector_data the track descriptors (img->tracks, allocated by the
+  caller) and the sector data are filled. Returns 0 on a damaged or
+  unsupported file. */
+int parseIMDTracks(JWD1797Image* img, unsigned char* payload, long size,
+  unsigned char* sector_data, long* data_size) {
+  long pos = 0;
+  long data_pos = 0;
+  // skip the comment
+  while(pos < size && payload[pos] != 0x1A) {pos++;}
+  pos++;
+  while(pos < size) {
+    if(pos + 5 > size) {return 0;}
+    unsigned char mode = payload[pos];
+    unsigned char cyl = payload[pos + 1];
+    unsigned char head_flags = payload[pos + 2];
+    unsigned char num_sectors = payload[pos + 3];
+    unsigned char size_code = payload[pos + 4];
+    unsigned char head = head_flags & 1;
+    int has_cylinder_map = (head_flags >> 7) & 1;
+    int has_head_map = (head_flags >> 6) & 1;
+    pos += 5;
+    /* MFM tracks only (modes 3-5) - FM tracks (modes 0-2) would be formatted
+      as MFM. The ID field size code of the WD1797 only covers 128-1024 byte
+      sectors (size codes 0-3); per-sector size tables (size code 0xFF) are
+      not supported. */
+    if(mode < 3 || mode > 5 || size_code > 3 ||
+      num_sectors > JWD1797_MAX_SECTORS_PER_TRACK) {
+      return 0;
+    }
+    unsigned int sector_length = 128u << size_code;
+    unsigned char* sector_map = payload + pos;
+    pos += num_sectors;
+    unsigned char* cylinder_map = has_cylinder_map ? payload + pos : NULL;
+    pos += has_cylinder_map ? num_sectors : 0;
+    unsigned char* head_map = has_head_map ? payload + pos : NULL;
+    pos += has_head_map ? num_sectors : 0;
+    if(pos > size) {return 0;}
+
+    JWD1797TrackDescriptor* t = NULL;
+    if(sector_data != NULL) {
+      t = &img->tracks[(cyl * img->num_heads) + head];
+      t->cylinder = cyl;
+      t->head = head;
+      t->num_sectors = num_sectors;
+      t->size_code = size_code;
+      t->sector_length = sector_length;
+      t->data_offset = data_pos;
+    }
+    else {
+      // first pass - geometry only
+      if(cyl + 1u > img->cylinders) {img->cylinders = cyl + 1u;}
+      if(head + 1u > img->num_heads) {img->num_heads = head + 1u;}
+      if(num_sectors > img->sectors_per_track) {img->sectors_per_track = num_sectors;}
+      if(img->sector_length == 0 && num_sectors > 0) {img->sector_length = sector_length;}
+    }
+    for(int s = 0; s < num_sectors; s++) {
+      if(pos >= size) {return 0;}
+      unsigned char record = payload[pos++];
+      // 0: no data, odd: full sector follows, even: one fill byte follows
+      if(record > 8) {return 0;}
+      if(record != 0) {
+        long record_length = (record & 1) ? sector_length : 1;
+        if(pos + record_length > size) {return 0;}
+        if(sector_data != NULL) {
+          if(record & 1) {memcpy(sector_data + data_pos, payload + pos, sector_length);}
+          else {memset(sector_data + data_pos, payload[pos], sector_length);}
+        }
+        pos += record_length;
+      }
+      if(t != NULL) {
+        t->sector_ids[s] = sector_map[s];
+        t->id_cylinders[s] = cylinder_map != NULL ? cylinder_map[s] : cyl;
+        t->id_heads[s] = head_map != NULL ? head_map[s] : head;
+        t->sector_flags[s] = 0;
+        if(record == 0) {t->sector_flags[s] |= JWD1797_SECTOR_NO_DATA;}
+        // records 3, 4, 7 and 8 carry deleted data, 5 to 8 a data error
+        if(record == 3 || record == 4 || record == 7 || record == 8) {
+          t->sector_flags[s] |= JWD1797_SECTOR_DELETED;
+        }
+        if(record >= 5) {t->sector_flags[s] |= JWD1797_SECTOR_DATA_ERROR;}
+      }
+      // every sector gets a slot, so sector n of a track is at data_offset + n * length
+      data_pos += sector_length;
+    }
+  }
+  *data_size = data_pos;
+  return 1;
+}
+
+/* loads an IMD image. Compressed sectors are expanded, so the sector data is
+  a new array. Tracks missing from the file are left unformatted. */
+unsigned char* loadIMDImage(JWD1797Image* img, unsigned char* payload,
+  long size, JWD1797Config* config, long* data_size, JWD1797Arena* scratch) {
+  // an IMD file describes its whole geometry itself
+  (void)config;
+  img->cylinders = 0;
+  img->num_heads = 0;
+  img->sectors_per_track = 0;
+  img->sector_length = 0;
+  if(!parseIMDTracks(img, payload, size, NULL, data_size) ||
+    img->cylinders == 0 || img->num_heads == 0) {
+    return NULL;
+  }
+  img->num_tracks = img->cylinders * img->num_heads;
+  img->tracks = (JWD1797TrackDescriptor*)allocJWD1797Arena(img->arena,
+    img->num_tracks * sizeof(JWD1797TrackDescriptor));
+  unsigned char* sector_data = (unsigned char*)allocJWD1797Arena(scratch, *data_size + 1);
+  if(img->tracks == NULL || sector_data == NULL) {
+    img->tracks = NULL;
+    return NULL;
+  }
+  for(unsigned int i = 0; i < img->num_tracks; i++) {
+    img->tracks[i].cylinder = i / img->num_heads;
+    img->tracks[i].head = i % img->num_heads;
+  }
+  // on failure the arenas take back the track table and the sector data
+  if(!parseIMDTracks(img, payload, size, sector_data, data_size)) {
+    img->tracks = NULL;
+    return NULL;
+  }
+  return sector_data;
+}
+
+/* ------------- raw sector dumps ---------------- */
+
+/* Z-DOS disks carry a loader disk parameter table in their first sector
+  (page 10.18 - Z100 Technical Manual – Hardware). The table is trusted when
+  it describes exactly the payload size. */
+int probeZDOSImage(unsigned char* payload, long size, JWD1797Config* config) {
+  (void)config;
+  if(size < 0x16) {return 0;}
+  unsigned int sector_length = payload[0x4] | (payload[0x5]<<8);
+  unsigned int sectors_per_track = payload[0xF];
+  unsigned int total_sectors = payload[0xC] | (payload[0xD]<<8);
+  unsigned int num_heads = (payload[0x15]&1) + 1;
+  if(sector_length != 128 && sector_length != 256 && sector_length != 512 &&
+    sector_length != 1024) {return 0;}
+  if(sectors_per_track == 0 || total_sectors % (sectors_per_track * num_heads)) {
+    return 0;
+  }
+  return (long)total_sectors * sector_length == size;
+}
+
+/* set disk attributes based on the loader disk parameter table (For exmaple,
+  40 tracks/9 sectors per track/512 bytes per sector for 360k z-dos disk).
+  Geometry given in the controller config overrides the loader table. */
+unsigned char* loadZDOSImage(JWD1797Image* img, unsigned char* payload,
+  long size, JWD1797Config* config, long* data_size, JWD1797Arena* scratch) {
+  unsigned int num_heads = (payload[0x15]&1) + 1;  // 0-1
+  unsigned int sectors_per_track = payload[0xF];  // 1-9 (sectors start on 1)
+  unsigned int sector_length = payload[0x4] | (payload[0x5]<<8);
+  unsigned int total_sectors = payload[0xC] | (payload[0xD]<<8);
+  if(config->num_heads) {num_heads = config->num_heads;}
+  if(config->sectors_per_track) {sectors_per_track = config->sectors_per_track;}
+  if(config->sector_length) {sector_length = config->sector_length;}
+  unsigned int cylinders = total_sectors/sectors_per_track/num_heads;  // 0-39
+  if(config->cylinders) {cylinders = config->cylinders;}
+  if(!setRawTrackDescriptors(img, cylinders, num_heads, sectors_per_track,
+    sector_length)) {return NULL;}
+  *data_size = size;
+  return interleaveRawSectors(img, payload, size, config, scratch);
+}
+
+/* any other raw dump is recognised by its size, or accepted as is when the
+  config gives the whole geometry */
+int probeRawImage(unsigned char* payload, long size, JWD1797Config* config) {
+  (void)payload;
+  if(config->cylinders && config->num_heads && config->sectors_per_track &&
+    config->sector_length) {return 1;}
+  int num_sizes = sizeof(raw_image_geometries)/sizeof(raw_image_geometries[0]);
+  for(int i = 0; i < num_sizes; i++) {
+    if(raw_image_geometries[i].size == size) {return 1;}
+  }
+  return 0;
+}
+
+// geometry from the size table - geometry given in the config overrides it
+unsigned char* loadRawImage(JWD1797Image* img, unsigned char* payload,
+  long size, JWD1797Config* config, long* data_size, JWD1797Arena* scratch) {
+  unsigned int cylinders = 0, num_heads = 0, sectors_per_track = 0, sector_length = 0;
+  int num_sizes = sizeof(raw_image_geometries)/sizeof(raw_image_geometries[0]);
+  for(int i = 0; i < num_sizes; i++) {
+    if(raw_image_geometries[i].size == size) {
+      cylinders = raw_image_geometries[i].cylinders;
+      num_heads = raw_image_geometries[i].num_heads;
+      sectors_per_track = raw_image_geometries[i].sectors_per_track;
+      sector_length = raw_image_geometries[i].sector_length;
+    }
+  }
+  if(config->cylinders) {cylinders = config->cylinders;}
+  if(config->num_heads) {num_heads = config->num_heads;}
+  if(config->sectors_per_track) {sectors_per_track = config->sectors_per_track;}
+  if(config->sector_length) {sector_length = config->sector_length;}
+  if(!setRawTrackDescriptors(img, cylinders, num_heads, sectors_per_track,
+    sector_length)) {return NULL;}
+  *data_size = size;
+  return interleaveRawSectors(img, payload, size, config, scratch);
+}
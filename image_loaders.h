@@ -0,0 +1,36 @@
+// disk image loaders (header)
+
+/* a loader recognises one disk image file format and describes the disk in
+  the image's per-track descriptor table (img->tracks). Loaders are tried in
+  the order of the table in image_loaders.c - the first one whose probe
+  accepts the payload loads it. */
+typedef struct {
+  const char* name;
+  // returns 1 if the payload is in this format
+  int (*probe)(unsigned char*, long, JWD1797Config*);
+  /* fills img->tracks (allocated in the image arena) and the nominal
+    geometry. Returns the sector data the track descriptors point into
+    (data_offset) - either the payload itself or a new array in the scratch
+    arena, which lives until the disk is formatted - and its size through
+    data_size. NULL if the payload can not be loaded. */
+  unsigned char* (*load)(JWD1797Image*, unsigned char*, long, JWD1797Config*, long*,
+    struct JWD1797Arena*);
+} JWD1797ImageLoader;
+
+const JWD1797ImageLoader* findJWD1797ImageLoader(unsigned char*, long, JWD1797Config*);
+unsigned char getSectorSizeCode(unsigned int);
+int setRawTrackDescriptors(JWD1797Image*, unsigned int, unsigned int,
+  unsigned int, unsigned int);
+unsigned char* interleaveRawSectors(JWD1797Image*, unsigned char*, long,
+  JWD1797Config*, struct JWD1797Arena*);
+
+int probeIMDImage(unsigned char*, long, JWD1797Config*);
+unsigned char* loadIMDImage(JWD1797Image*, unsigned char*, long, JWD1797Config*, long*,
+  struct JWD1797Arena*);
+int parseIMDTracks(JWD1797Image*, unsigned char*, long, unsigned char*, long*);
+int probeZDOSImage(unsigned char*, long, JWD1797Config*);
+unsigned char* loadZDOSImage(JWD1797Image*, unsigned char*, long, JWD1797Config*, long*,
+  struct JWD1797Arena*);
+int probeRawImage(unsigned char*, long, JWD1797Config*);
+unsigned char* loadRawImage(JWD1797Image*, unsigned char*, long, JWD1797Config*, long*,
+  struct JWD1797Arena*);
@@ -13,10 +13,23 @@
 // A 300 RPM motor speed is also assumed
 // NO write protect functionality
 // the wd1797 has a 1MHz clock in the Z100 for 5.25" floppy
+/* 80 track DD and HD disks (360 RPM / 500 kbit/s 1.2M, 1.44M) get their motor
+	speed, data rate, gaps and clock dependent timings from a disk format
+	profile (see jwd1797_formats[]) */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "jwd1797.h"
+#include "arena.h"
+#include "image_loaders.h"
+#include "mark_scanner.h"
+#include "tracer.h"
+#include "vcd_writer.h"
 // #include "e8259.h"
 #include "utility_functions.h"
 
@@ -26,10 +39,8 @@
 // head load timing (this can be set from 30-100 ms, depending on drive)
 // set to 45 ms (45,000 us)
 #define HEAD_LOAD_TIMING_LIMIT 55.0*1000
-// verify time is 30 milliseconds for a 1MHz clock
-#define VERIFY_HEAD_SETTLING_LIMIT 30.0*1000
-// E (15 ms delay) for TYPE II and III commands (30 ms (30*1000 us) for 1 MHz clock)
-#define E_DELAY_LIMIT 30.0*1000
+/* verify head settling and the E delay of TYPE II and III commands come from
+	the disk format profile (30 ms each with the 1 MHz clock of DD drives) */
 
 /* COUNTS */
 // when non-busy status and HLD high, reset HLD after 15 index pulses
@@ -40,6 +51,9 @@
 #define ID_FIELD_SEARCH_LIMIT 16
 /* In Double Density Disks, if 43 bytes pass before Data AM is found, INTRQ */
 #define DATA_AM_SEARCH_LIMIT 43
+/* bytes the ID field search must see in front of an ID address mark - the last
+	4 SYNC bytes (0x00) and the 3 prefix bytes (0xA1) */
+#define ID_AM_SEARCH_BYTES 7
 
 // DOS disk format (bytes per format section and byte written for each section)
 #define GAP4A_LENGTH 80
@@ -76,12 +90,96 @@
 #define DATA_AM_PREFIX_BYTE 0xA1
 #define DATA_AM_LENGTH 1
 #define DATA_AM_BYTE 0xFB
+#define DELETED_DATA_AM_BYTE 0xF8
 
 #define GAP3_LENGTH 54
 #define GAP3_BYTE 0x4E
 
 #define GAP4B_LENGTH 598
 #define GAP4B_BYTE 0x4E
+// shortest GAP4B of a track that does not fit in a revolution at the data rate
+#define GAP4B_MIN_LENGTH 16
+
+// ID address mark (0xFE) to the first data byte of the sector
+#define ID_AM_TO_DATA_LENGTH (ID_AM_LENGTH + CYLINDER_LENGTH + HEAD_LENGTH \
+	+ SECTOR_LENGTH + SECTOR_SIZE_LENGTH + CRC_LENGTH + GAP2_LENGTH + SYNC_LENGTH \
+	+ DATA_AM_PREFIX_LENGTH + DATA_AM_LENGTH)
+
+/* DISK FORMAT PROFILES (indexed by JWD1797_FORMAT_* - 1). The 40 track profile
+	is the Z-DOS layout the emulator was written for: GAP3 54, GAP4B 598 and the
+	byte time fitted to a 300 RPM revolution. The others follow the data rate of
+	the drive (IBM gap sizes); HD drives need the WD1797 at 2 MHz, which halves
+	the step rates and the 15 ms delays. */
+static const JWD1797FormatProfile jwd1797_formats[] = {
+	{"5.25\" DS/DD 40 track", 300, 250000, 1, GAP3_LENGTH, 1, {6, 12, 20, 30},
+		30.0*1000, 30.0*1000, 43},
+	{"DS/DD 80 track", 300, 250000, 0, 80, 1, {6, 12, 20, 30},
+		30.0*1000, 30.0*1000, 43},
+	{"5.25\" DS/HD 80 track", 360, 500000, 0, 84, 2, {3, 6, 10, 15},
+		15.0*1000, 15.0*1000, 43},
+	{"3.5\" DS/HD 80 track", 300, 500000, 0, 108, 2, {3, 6, 10, 15},
+		15.0*1000, 15.0*1000, 43}
+};
+
+/* controller progress messages are only printed by verbose instances, so that
+	many quiet instances can run side by side without contending for stdout */
+#define JWD_PRINTF(w, ...) do {if((w)->verbose) {printf(__VA_ARGS__);}} while(0)
+
+/* levels of the pins dumped by setJWD1797VCD() except the index pulse (bit
+	0), which is derived from the rotation */
+#define JWD_VCD_LEVELS(w) (((w)->HLD_pin << 1) | ((w)->HLT_pin << 2) | \
+	((w)->direction_pin << 3) | ((w)->sso_pin << 4) | ((w)->tg43_pin << 5) | \
+	((w)->drq << 6) | ((w)->intrq << 7))
+
+/* activity tracing hooks (see setJWD1797Tracer()). A controller without a
+	tracer pays one pointer test per hook; building with -DJWD1797_NO_TRACE
+	compiles the hooks out. With a tracer the state is only examined at byte
+	boundaries and when the status register changed, and the port hook only
+	calls out for writes and for reads that differ from the last one. The pin
+	waveform hook samples the pins after every step and port access. */
+#ifndef JWD1797_NO_TRACE
+#define JWD_TRACE_COMMAND(w) do {if((w)->tracer != NULL) {traceJWD1797Command(w);}} while(0)
+#define JWD_TRACE_STATE(w) do {if((w)->tracer != NULL && ((w)->new_byte_read_signal_ || \
+	(w)->statusRegister != (w)->trace_status)) {traceJWD1797State(w);}} while(0)
+#define JWD_TRACE_PORT(w, write, port, value) do {if((w)->tracer != NULL && ((write) || \
+	((((port) << 8) | ((value) & 0xFF)) != (w)->trace_last_read))) { \
+	traceJWD1797Port(w, write, port, value);}} while(0)
+#define JWD_VCD_PINS(w) do {if((w)->vcd != NULL && \
+	((w)->emulated_time_ns >= (w)->vcd_ip_edge_ns || \
+	(w)->rotation_t0_ns != (w)->vcd_t0_ns || \
+	JWD_VCD_LEVELS(w) != ((w)->vcd_pins & ~1u))) {dumpJWD1797Pins(w);}} while(0)
+#define JWD_VCD_DUMP(w) do {if((w)->vcd != NULL) {dumpJWD1797Pins(w);}} while(0)
+// a port read can only clear DRQ or INTRQ
+#define JWD_VCD_READ(w) do {if((w)->vcd != NULL && (((w)->drq << 6) | \
+	((w)->intrq << 7)) != ((w)->vcd_pins & 0xC0)) {dumpJWD1797Pins(w);}} while(0)
+#else
+#define JWD_TRACE_COMMAND(w) do {} while(0)
+#define JWD_TRACE_STATE(w) do {} while(0)
+#define JWD_TRACE_PORT(w, write, port, value) do {} while(0)
+#define JWD_VCD_PINS(w) do {} while(0)
+#define JWD_VCD_READ(w) do {} while(0)
+#define JWD_VCD_DUMP(w) do {} while(0)
+#endif
+
+/* FORMATTED IMAGE CACHE */
+/* the formatted disk is cached in a sidecar file next to the payload image or
+	in a cache directory (<image>.<key> + suffix - see
+	setJWD1797ImageCachePath()). Bump the version whenever the formatter
+	changes so stale caches are rebuilt. */
+#define IMAGE_CACHE_SUFFIX ".jwdfmt"
+#define IMAGE_CACHE_MAGIC "JWDFMT\0\0"
+#define IMAGE_CACHE_VERSION 5
+/* an image file modified this close to the cache write may have changed again
+	within the same mtime tick - its cache is checked by payload hash */
+#define IMAGE_CACHE_RACY_NS 2000000000LL
+/* an image arena grows in blocks of this size - the formatted disk gets one
+	of its own */
+#define IMAGE_ARENA_BLOCK_SIZE (64 * 1024)
+
+/* spindle timing of an empty drive (no disk mounted yet) - one 300 RPM
+	revolution of 250 kbit/s MFM data */
+#define EMPTY_DRIVE_TRACK_BYTES 6250
+#define EMPTY_DRIVE_BYTE_TIME_NS 32000
 
 /* INTRQ (pin connected to slave PIC IRQ0 in the Z100) is set to high at the
   completion of every command and when a force interrupt condition is met. It is
@@ -89,33 +187,460 @@
   is loaded with a new command */
 // extern e8259_t* e8259_slave;
 
-char* disk_content_array;
-
-JWD1797* newJWD1797() {
-	JWD1797* jwd_controller = (JWD1797*)malloc(sizeof(JWD1797));
+/* creates a self-contained controller instance. All controller state belongs
+	to the instance - there is no global state, so one controller can be run per
+	thread without locks. If the config names a shared image (config->image) the
+	instance takes a reference to it; otherwise it loads and formats its own
+	copy of config->image_path (no image path and no shared image leaves the
+	drive empty). Writes never touch the base image - they go to a per-instance
+	copy-on-write track overlay. Quiet instances (config verbose = 0) never
+	print to stdout. */
+JWD1797* newJWD1797(JWD1797Config* config) {
+	JWD1797Arena* arena = newJWD1797Arena(sizeof(JWD1797), 0);
+	JWD1797* jwd_controller = arena == NULL ? NULL :
+		(JWD1797*)allocJWD1797Arena(arena, sizeof(JWD1797));
+	if(jwd_controller == NULL) {
+		printf("%s\n", "ERROR: could not allocate WD1797 controller");
+		freeJWD1797Arena(arena);
+		return NULL;
+	}
+	jwd_controller->arena = arena;
+	jwd_controller->verbose = config->verbose;
+	jwd_controller->actual_num_track_bytes = EMPTY_DRIVE_TRACK_BYTES;
+	jwd_controller->rotational_byte_read_limit = EMPTY_DRIVE_BYTE_TIME_NS;
+	jwd_controller->format = getJWD1797FormatProfile(JWD1797_FORMAT_DD40);
+	// coarse quantum stepping is off until the host sets a quantum
+	jwd_controller->cycle_quantum_ns = 0;
+	powerOnJWD1797(jwd_controller);
+
+	// share the base image if one is given, otherwise load a private one
+	JWD1797Image* img = config->image;
+	if(img == NULL && config->image_path != NULL) {
+		img = loadJWD1797Image(config);
+		if(img == NULL) {
+			freeJWD1797Arena(arena);
+			return NULL;
+		}
+		int mounted = mountJWD1797Image(jwd_controller, img);
+		// the controller holds the only reference to its private image
+		releaseJWD1797Image(img);
+		if(mounted < 0) {
+			freeJWD1797Arena(arena);
+			return NULL;
+		}
+	}
+	else if(img != NULL && mountJWD1797Image(jwd_controller, img) < 0) {
+		freeJWD1797Arena(arena);
+		return NULL;
+	}
 	return jwd_controller;
 }
 
+/* turns the controller progress messages on (1) or off (0). Quiet instances
+	never touch stdout. */
+void setJWD1797Verbose(JWD1797* jwd_controller, int verbose) {
+	jwd_controller->verbose = verbose;
+}
+
+/* releases the controller and every buffer it owns - its arena goes in one
+	piece. The base image is only freed when the last controller sharing it
+	lets go. */
+void freeJWD1797(JWD1797* jwd_controller) {
+	if(jwd_controller == NULL) {return;}
+	unmountJWD1797Image(jwd_controller);
+	freeJWD1797Arena(jwd_controller->arena);
+}
+
+/* puts controller w in the state of template - a controller of the same
+	pool, bound to the same image - with one copy of the structure. w keeps
+	what it owns: its arena, its overlay tables, its track sink buffer and its
+	data FIFO. Written tracks are dropped first, so the cost follows the dirty
+	state. Host settings (quantum, HLE, FIFO mode, DMA callback, sink, tracer,
+	VCD) are those of the template - a READ TRACK being streamed ends first.
+	Returns 0, or -1 if the template's disk can not be mounted again (see
+	mountJWD1797Image()) - w is left with an empty drive then. */
+int restoreJWD1797(JWD1797* w, const JWD1797* template) {
+	flushJWD1797TrackSink(w, 1);
+	// a disk swapped by the host goes back to the template's disk
+	if(w->image != template->image) {
+		if(template->image == NULL) {unmountJWD1797Image(w);}
+		else if(mountJWD1797Image(w, template->image) < 0) {return -1;}
+	}
+	discardJWD1797Overlay(w);
+	JWD1797Arena* arena = w->arena;
+	unsigned char** overlay_tracks = w->overlay_tracks;
+	int* dirty_tracks = w->dirty_tracks;
+	unsigned char* dirty_sectors = w->dirty_sectors;
+	JWD1797TrackLayout** overlay_layouts = w->overlay_layouts;
+	unsigned char* overlay_reindex = w->overlay_reindex;
+	unsigned char* track_sink_buffer = w->track_sink_buffer;
+	JWD1797DataFIFO* data_fifo = w->data_fifo;
+	memcpy(w, template, sizeof(JWD1797));
+	w->arena = arena;
+	w->overlay_tracks = overlay_tracks;
+	w->dirty_tracks = dirty_tracks;
+	w->dirty_sectors = dirty_sectors;
+	w->overlay_layouts = overlay_layouts;
+	w->overlay_reindex = overlay_reindex;
+	w->track_sink_buffer = track_sink_buffer;
+	w->data_fifo = data_fifo;
+	// the statistics are the template's - so are the FIFO's
+	if(data_fifo != NULL) {data_fifo->lost_bytes = 0;}
+	return 0;
+}
+
+/* creates a pool of controllers sharing the image of the config (config->image,
+	or image_path loaded once for the pool) with size controllers made up
+	front. Up to size returned controllers are kept for reuse. NULL if the
+	image can not be loaded. */
+JWD1797Pool* newJWD1797Pool(JWD1797Config* config, int size) {
+	JWD1797Pool* pool = (JWD1797Pool*)calloc(1, sizeof(JWD1797Pool));
+	// the template holds the pool's reference to the image
+	pool->template = newJWD1797(config);
+	if(pool->template == NULL) {
+		free(pool);
+		return NULL;
+	}
+	pool->image = pool->template->image;
+	pool->capacity = size > 0 ? size : 1;
+	pool->idle = (JWD1797**)malloc(sizeof(JWD1797*) * pool->capacity);
+	JWD1797Config shared = *config;
+	shared.image = pool->image;
+	for(int i = 0; i < size; i++) {
+		JWD1797* w = newJWD1797(&shared);
+		if(w == NULL) {break;}
+		if(restoreJWD1797(w, pool->template) < 0) {
+			freeJWD1797(w);
+			break;
+		}
+		pool->idle[pool->num_idle++] = w;
+		pool->created++;
+	}
+	return pool;
+}
+
+// frees the pool and its idle controllers - controllers handed out must be back
+void freeJWD1797Pool(JWD1797Pool* pool) {
+	if(pool == NULL) {return;}
+	for(int i = 0; i < pool->num_idle; i++) {freeJWD1797(pool->idle[i]);}
+	free(pool->idle);
+	freeJWD1797(pool->template);
+	free(pool);
+}
+
+/* hands out a controller in the template's reset state - an idle one if
+	there is one, a new one otherwise. Safe to call from any thread. */
+JWD1797* acquireJWD1797(JWD1797Pool* pool) {
+	JWD1797* w = NULL;
+	while(__atomic_test_and_set(&pool->lock, __ATOMIC_ACQUIRE)) {}
+	if(pool->num_idle > 0) {
+		w = pool->idle[--pool->num_idle];
+		pool->reused++;
+	}
+	else {pool->created++;}
+	__atomic_clear(&pool->lock, __ATOMIC_RELEASE);
+	if(w != NULL) {return w;}
+	JWD1797Config config = {.verbose = pool->template->verbose, .image = pool->image};
+	w = newJWD1797(&config);
+	if(w != NULL && restoreJWD1797(w, pool->template) < 0) {
+		freeJWD1797(w);
+		w = NULL;
+	}
+	return w;
+}
+
+/* gives a controller from acquireJWD1797() back to the pool. It is restored
+	here (by the returning thread) and kept for the next acquire, or freed if
+	the pool is full. Safe to call from any thread. */
+void returnJWD1797(JWD1797Pool* pool, JWD1797* w) {
+	if(w == NULL) {return;}
+	// a controller that can not be restored is not kept
+	if(restoreJWD1797(w, pool->template) < 0) {
+		freeJWD1797(w);
+		return;
+	}
+	while(__atomic_test_and_set(&pool->lock, __ATOMIC_ACQUIRE)) {}
+	if(pool->num_idle < pool->capacity) {
+		pool->idle[pool->num_idle++] = w;
+		w = NULL;
+	}
+	__atomic_clear(&pool->lock, __ATOMIC_RELEASE);
+	freeJWD1797(w);
+}
+
+/* loads the payload named in the config and formats it into a new base image
+	with a reference count of 1. Returns NULL if the image can not be loaded. */
+JWD1797Image* loadJWD1797Image(JWD1797Config* config) {
+	JWD1797Arena* arena = newJWD1797Arena(IMAGE_ARENA_BLOCK_SIZE,
+		config->huge_pages ? JWD1797_ARENA_HUGE_PAGES : 0);
+	if(arena == NULL) {return NULL;}
+	JWD1797Image* img = (JWD1797Image*)allocJWD1797Arena(arena, sizeof(JWD1797Image));
+	img->arena = arena;
+	img->image_path = copyJWD1797ArenaString(arena, config->image_path);
+	img->verbose = config->verbose;
+	img->ref_count = 1;
+	/* make a formatted disk array from the disk data payload image file.
+	 	will be held in img->formattedDiskArray */
+	assembleFormattedDiskArray(img, config);
+	if(img->formattedDiskArray == NULL) {
+		freeJWD1797Arena(arena);
+		return NULL;
+	}
+	return img;
+}
+
+// takes another reference to a base image (one per controller sharing it)
+void retainJWD1797Image(JWD1797Image* img) {
+	__atomic_add_fetch(&img->ref_count, 1, __ATOMIC_RELAXED);
+}
+
+// drops a reference to a base image - the last reference frees it
+void releaseJWD1797Image(JWD1797Image* img) {
+	if(img == NULL) {return;}
+	if(__atomic_sub_fetch(&img->ref_count, 1, __ATOMIC_ACQ_REL) == 0) {
+		/* formatted disk either comes from the cache mapping or was built in the
+			arena with everything else */
+		if(img->cache_map != NULL) {munmap(img->cache_map, img->cache_map_size);}
+		freeJWD1797Arena(img->arena);
+	}
+}
+
+/* puts a disk in the drive. The controller takes a reference to the base
+	image, copies its geometry (the hot path reads it from there) and starts
+	with an empty track overlay. A disk already in the drive is unmounted first,
+	so hot swapping drops READY and raises it again - firing the NOT READY to
+	READY / READY to NOT READY forced interrupt conditions if they are set.
+	Returns 0, or -1 if the overlay tables can not be allocated - the drive is
+	left empty and the image reference is released. */
+int mountJWD1797Image(JWD1797* w, JWD1797Image* img) {
+	if(w->image != NULL) {unmountJWD1797Image(w);}
+	retainJWD1797Image(img);
+	w->image = img;
+	w->cylinders = img->cylinders;
+	w->num_heads = img->num_heads;
+	w->sectors_per_track = img->sectors_per_track;
+	w->sector_length = img->sector_length;
+	w->disk_img_file_size = img->disk_img_file_size;
+	w->formattedDiskArray = img->formattedDiskArray;
+	w->format = getJWD1797FormatProfile(img->format);
+	/* keep the rotational position continuous across the swap - the new disk
+		starts where the head was, in the current revolution */
+	unsigned long byte_pointer = w->rotational_byte_pointer;
+	if(byte_pointer >= img->actual_num_track_bytes) {
+		byte_pointer = img->actual_num_track_bytes - 1;
+	}
+	w->rotational_byte_origin = (w->revolution_count * img->actual_num_track_bytes)
+		+ byte_pointer;
+	w->rotation_t0_ns = w->emulated_time_ns;
+	w->actual_num_track_bytes = img->actual_num_track_bytes;
+	w->rotational_byte_read_limit = img->rotational_byte_read_limit;
+	// one overlay slot per track (num_heads per cylinder - see getFDiskByte())
+	w->num_overlay_tracks = w->cylinders * w->num_heads;
+	w->overlay_tracks =
+		(unsigned char**)calloc(w->num_overlay_tracks, sizeof(unsigned char*));
+	w->dirty_tracks = (int*)malloc((w->num_overlay_tracks + 1) * sizeof(int));
+	w->num_dirty_tracks = 0;
+	w->dirty_sectors = (unsigned char*)calloc(
+		w->num_overlay_tracks * w->sectors_per_track + 1, 1);
+	w->overlay_layouts = (JWD1797TrackLayout**)calloc(w->num_overlay_tracks,
+		sizeof(JWD1797TrackLayout*));
+	w->overlay_reindex = (unsigned char*)calloc(w->num_overlay_tracks + 1, 1);
+	if(w->overlay_tracks == NULL || w->dirty_tracks == NULL ||
+		w->dirty_sectors == NULL || w->overlay_layouts == NULL ||
+		w->overlay_reindex == NULL) {
+		printf("%s\n", "ERROR: could not allocate the track overlay");
+		unmountJWD1797Image(w);
+		return -1;
+	}
+	// the track under the head may differ from the nominal one
+	selectJWD1797Track(w, getJWD1797TrackIndex(w));
+	setJWD1797ReadyPin(w, 1);
+	return 0;
+}
+
+/* takes the disk out of the drive. Everything written to it (the overlay) is
+	dropped and the controller lets go of the base image. The spindle timing of
+	the last disk is kept. READY drops. */
+void unmountJWD1797Image(JWD1797* w) {
+	if(w->image == NULL) {return;}
+	discardJWD1797Overlay(w);
+	free(w->overlay_tracks);
+	w->overlay_tracks = NULL;
+	free(w->dirty_tracks);
+	w->dirty_tracks = NULL;
+	free(w->dirty_sectors);
+	w->dirty_sectors = NULL;
+	free(w->overlay_layouts);
+	w->overlay_layouts = NULL;
+	free(w->overlay_reindex);
+	w->overlay_reindex = NULL;
+	w->num_overlay_tracks = 0;
+	releaseJWD1797Image(w->image);
+	w->image = NULL;
+	w->formattedDiskArray = NULL;
+	selectJWD1797Track(w, -1);
+	setJWD1797ReadyPin(w, 0);
+}
+
+/* drives the READY input from the drive. A transition fires the matching
+	forced interrupt condition (I0: NOT READY to READY, I1: READY to NOT READY)
+	if one is set. */
+void setJWD1797ReadyPin(JWD1797* w, int ready) {
+	if(ready == w->ready_pin) {return;}
+	w->ready_pin = ready;
+	if((ready && w->interruptNRtoR) || (!ready && w->interruptRtoNR)) {
+		JWD_PRINTF(w, "%s\n", "READY interrupt condition met..");
+		doJWD1797ForcedInterrupt(w);
+	}
+	// status bit 7 (NOT READY) follows the pin right away
+	if(ready && w->not_master_reset) {w->statusRegister &= 0b01111111;}
+	else {w->statusRegister |= 0b10000000;}
+}
+
+/* a forced interrupt condition was met - terminate the running command (if
+	any) and generate an interrupt */
+void doJWD1797ForcedInterrupt(JWD1797* w) {
+	// is there a command currently running?
+	if(!w->command_done) {	// YES
+		// terminate command
+		w->command_done = 1;
+		// reset BUSY status bit ONLY - other status bits are unchanged
+		w->statusRegister &= 0b11111110;
+	}
+	else {	// NO command running
+		/* reset busy status and clear SEEK ERROR and CRC ERROR bits
+			(reflect TYPE I status) */
+		w->statusRegister &= 0b11100110;
+		// change command type to I in order to update TYPE I status bits
+		w->currentCommandType = 1;
+	}
+	// generate interrupt
+	w->intrq = 1;
+	// e8259_set_irq0 (e8259_slave, 1);
+}
+
+/* returns a writable copy of a track. The first write to a track copies it
+	from the base image into the controller's overlay; later reads of that
+	track come from the overlay. Memory grows only with the tracks written. */
+unsigned char* getFDiskTrackForWrite(JWD1797* w, int cyl, int head) {
+	// no such track on the disk in the drive
+	if(w->image == NULL || cyl >= w->cylinders || head >= w->num_heads) {
+		return NULL;
+	}
+	int track_index = (cyl * w->num_heads) + head;
+	if(w->overlay_tracks[track_index] == NULL) {
+		JWD1797TrackDescriptor* t = &w->image->tracks[track_index];
+		unsigned char* track = (unsigned char*)malloc(t->formatted_length);
+		memcpy(track, w->formattedDiskArray + t->formatted_offset, t->formatted_length);
+		w->overlay_tracks[track_index] = track;
+		w->dirty_tracks[w->num_dirty_tracks++] = track_index;
+		// the head reads the copy from now on
+		if(track_index == w->active_track) {w->active_track_data = track;}
+	}
+	// the caller may rewrite the whole track - scan it before its layout is used
+	w->overlay_reindex[track_index] = 1;
+	return w->overlay_tracks[track_index];
+}
+
+/* drops every overlay track - the disk reads back as the base image. Only
+	the tracks written are visited (their layouts, reindex and dirty sector
+	flags only ever get set for overlay tracks), so the cost follows what was
+	written, not the size of the disk. */
+void discardJWD1797Overlay(JWD1797* w) {
+	for(int i = 0; i < w->num_dirty_tracks; i++) {
+		int track_index = w->dirty_tracks[i];
+		free(w->overlay_tracks[track_index]);
+		w->overlay_tracks[track_index] = NULL;
+		free(w->overlay_layouts[track_index]);
+		w->overlay_layouts[track_index] = NULL;
+		w->overlay_reindex[track_index] = 0;
+		memset(w->dirty_sectors + (track_index * w->sectors_per_track), 0,
+			w->sectors_per_track);
+	}
+	w->num_dirty_tracks = 0;
+	// the head reads the base image again
+	if(w->active_track >= 0) {
+		w->active_track_data = w->formattedDiskArray +
+			w->image->tracks[w->active_track].formatted_offset;
+	}
+}
+
+/* layout of track track_index as this controller sees it - the track
+	descriptor and ID address mark offsets of the base image, or the index
+	scanned from the overlay copy if the track was rewritten. A track handed
+	out by getFDiskTrackForWrite() is scanned again here, on first use - a host
+	that keeps writing through an old track pointer calls reindexJWD1797Track()
+	when it is done. */
+JWD1797TrackDescriptor* getJWD1797TrackLayout(JWD1797* w, int track_index,
+	const unsigned int** id_am_offsets) {
+	if(w->overlay_reindex[track_index]) {reindexJWD1797Track(w, track_index);}
+	JWD1797TrackLayout* layout = w->overlay_layouts[track_index];
+	if(layout != NULL) {
+		*id_am_offsets = layout->id_am_offsets;
+		return &layout->descriptor;
+	}
+	*id_am_offsets = w->image->id_am_offsets + (track_index * w->sectors_per_track);
+	return &w->image->tracks[track_index];
+}
+
+/* rebuilds the layout index of an overlay track from its bytes with the
+	address mark scanner. Placement and timing stay those of the base track.
+	Returns the number of sectors found, -1 if the track is not in the
+	overlay or its layout can not be allocated (the base layout is used). */
+int reindexJWD1797Track(JWD1797* w, int track_index) {
+	w->overlay_reindex[track_index] = 0;
+	unsigned char* track = w->overlay_tracks[track_index];
+	if(track == NULL) {return -1;}
+	JWD1797TrackLayout* layout = w->overlay_layouts[track_index];
+	if(layout == NULL) {
+		layout = (JWD1797TrackLayout*)malloc(sizeof(JWD1797TrackLayout));
+		if(layout == NULL) {return -1;}
+		w->overlay_layouts[track_index] = layout;
+	}
+	layout->descriptor = w->image->tracks[track_index];
+	return indexJWD1797Track(track, layout->descriptor.formatted_length,
+		&layout->descriptor, layout->id_am_offsets, w->sectors_per_track);
+}
+
+/* powers the controller up: the emulated time starts over at 0 with the disk
+	a few bytes before the index hole and the head on track 00, time not run yet
+	in the quantum is dropped, then a master reset (see resetJWD1797()). Host settings - the
+	quantum, HLE, FIFO mode, callbacks - are kept. */
+void powerOnJWD1797(JWD1797* jwd_controller) {
+	jwd_controller->rotational_byte_pointer = 2500;	// start at a few bytes before 0 index
+	// rotational position is derived from absolute time starting at t0 = 0
+	jwd_controller->emulated_time_ns = 0;
+	jwd_controller->rotation_t0_ns = 0;
+	jwd_controller->rotational_byte_origin = jwd_controller->rotational_byte_pointer;
+	jwd_controller->revolution_count = 0;
+	jwd_controller->quantum_accumulator_ns = 0;
+	// the head is parked on track 00
+	jwd_controller->current_track = 0;
+	resetJWD1797(jwd_controller);
+}
+
+/* master reset - register and pin state only. The emulated time, the
+	rotation of the disk and the host quantum (with the time pending in it)
+	carry on. */
 void resetJWD1797(JWD1797* jwd_controller) {
 	jwd_controller->dataShiftRegister = 0b00000000;
 	jwd_controller->dataRegister = 0b00000000;
 	jwd_controller->trackRegister = 0b00000000;
-	jwd_controller->sectorRegister = 0b00000000;
-	jwd_controller->commandRegister = 0b00000000;
+	// master reset loads 0x01 into the sector register...
+	jwd_controller->sectorRegister = 0b00000001;
+	// ...and 0x03 (RESTORE, 30 ms step for 1 MHz) into the command register
+	jwd_controller->commandRegister = 0b00000011;
 	jwd_controller->statusRegister = 0b00000000;
 	jwd_controller->CRCRegister = 0b00000000;
 	jwd_controller->controlLatch = 0b00000000;
 	jwd_controller->controlStatus = 0b00000000;
 
 	jwd_controller->disk_img_index_pointer = 0;
-	jwd_controller->rotational_byte_pointer = 2500;	// start at a few bytes before 0 index
 	jwd_controller->rw_start_byte = 0;
 
 	// jwd_controller->ready = 0;	// start drive not ready
 	// jwd_controller->stepDirection = 0;	// start direction step out -> track 00
 
-	jwd_controller->currentCommandName = "";
-	jwd_controller->currentCommandType = 0;
 
 	// TYPE I command bits
 	jwd_controller->stepRate = 0;	// bits 0 and 1 determine the step rate
@@ -135,7 +660,6 @@ void resetJWD1797(JWD1797* jwd_controller) {
 	jwd_controller->interruptImmediate = 0;
 	// command step controls
 	jwd_controller->command_action_done = 0;
-	jwd_controller->command_done = 0;
 	jwd_controller->head_settling_done = 0;
 	jwd_controller->verify_operation_active = 0;
 	jwd_controller->verify_operation_done = 0;
@@ -147,19 +671,16 @@ void resetJWD1797(JWD1797* jwd_controller) {
 	jwd_controller->master_timer = 0.0;
 	jwd_controller->index_pulse_timer = 0.0;
 	jwd_controller->index_encounter_timer = 0.0;
-	jwd_controller->step_timer = 0.0;
+	jwd_controller->step_deadline_ns = 0;
 	jwd_controller->verify_head_settling_timer = 0.0;
 	jwd_controller->e_delay_timer = 0.0;
 	jwd_controller->assemble_data_byte_timer = 0.0;
-	jwd_controller->rotational_byte_read_limit = 0; // NANOSECONDS
-	jwd_controller->rotational_byte_read_timer = 0; // NANOSECONDS
-	jwd_controller->rotational_byte_read_timer_OVR = 0; // NANOSECONDS
 	jwd_controller->HLD_idle_reset_timer = 0.0;
 	jwd_controller->HLT_timer = 0.0;
 	jwd_controller->read_track_bytes_read = 0;
 
 	jwd_controller->index_pulse_pin = 0;
-	jwd_controller->ready_pin = 1;	// make drive ready immediately after reset
+	// ready_pin is driven by the drive (see mountJWD1797Image())
 	jwd_controller->tg43_pin = 0;
 	jwd_controller->HLD_pin = 0;
 	jwd_controller->HLT_pin = 0;
@@ -176,17 +697,16 @@ void resetJWD1797(JWD1797* jwd_controller) {
 	jwd_controller->intrq = 0;
 	jwd_controller->not_master_reset = 1;
 
-	jwd_controller->current_track = 0;
-
-	jwd_controller->cylinders = 0; // (tracks per side)
-	jwd_controller->num_heads = 0;
-	jwd_controller->sectors_per_track = 0;
-	jwd_controller->sector_length = 0;
-
-	jwd_controller->disk_img_file_size = 0;
-
-	jwd_controller->formattedDiskArray = NULL;
-	jwd_controller->actual_num_track_bytes = 0;
+	/* the disk in the drive (and what was written to it) is not touched - see
+		mountJWD1797Image()/unmountJWD1797Image(). A command that was running
+		leaves no statistics. The head stays where it is. */
+	jwd_controller->stats_type = 0;
+	jwd_controller->not_track00_pin = jwd_controller->current_track != 0;
+	if(!jwd_controller->ready_pin) {jwd_controller->statusRegister |= 0b10000000;}
+	jwd_controller->sso_pin = 0;
+	jwd_controller->active_track = -1;
+	jwd_controller->active_track_data = NULL;
+	selectJWD1797Track(jwd_controller, getJWD1797TrackIndex(jwd_controller));
 
 	jwd_controller->new_byte_read_signal_ = 0;
 	jwd_controller->track_start_signal_ = 0;
@@ -201,6 +721,7 @@ void resetJWD1797(JWD1797* jwd_controller) {
 	jwd_controller->data_a1_byte_counter = 0;
 	jwd_controller->data_mark_search_count = 0;
 	jwd_controller->data_mark_found = 0;
+	jwd_controller->next_data_byte = 0;
 	/* collects ID Field data
 	  (0: cylinders, 1: head, 2: sector, 3: sector len, 4: CRC1, 5: CRC2)
 		initialize all to 0x00 */
@@ -213,14 +734,24 @@ void resetJWD1797(JWD1797* jwd_controller) {
 
 	// control latch initializations
 	jwd_controller->wait_enabled = 0;
-
-	// disk_content_array = diskImageToCharArray("z-dos-1.img", jwd_controller);
-	// TEST disk image to array function
-	// printByteArray(disk_content_array, 368640);
-
-	/* make a formatted disk array from the disk data payload image file.
-	 	will be held in jwd_controller->formattedDiskArray */
-	assembleFormattedDiskArray(jwd_controller, "Z_DOS_ver1.bin");
+	// HLE mode and DMA callback are host settings - only the transfer stops
+	jwd_controller->hle_active = 0;
+	jwd_controller->fifo_transfer = 0;
+	// so are the track sink settings - a READ TRACK being streamed ends
+	flushJWD1797TrackSink(jwd_controller, 1);
+	/* when master reset goes back high the RESTORE in the command register is
+		run like one written by the host - BUSY, stepping out at the 0x03 step
+		rate until the head is on track 00, then INTRQ. A head already on track
+		00 has nothing to step, so the RESTORE ends right here. */
+	setupTypeICommand(jwd_controller);
+	setTypeICommand(jwd_controller);
+	if(!jwd_controller->not_track00_pin) {
+		jwd_controller->statusRegister |= 0b00000100;	// TRACK 00
+		commandStep(jwd_controller, 0.0);	// on track 00 - track register 0
+		commandStep(jwd_controller, 0.0);	// no verify - done, INTRQ
+	}
+	// the pins were reset - always dump
+	JWD_VCD_DUMP(jwd_controller);
 }
 
 // read data from wd1797 according to port
@@ -234,6 +765,12 @@ unsigned int readJWD1797(JWD1797* jwd_controller, unsigned int port_addr) {
 		// status reg port
 		case 0xb0:
 			r_val = jwd_controller->statusRegister;
+			// DRQ and lost data of a FIFO transfer at the host's time
+			if(jwd_controller->fifo_transfer && jwd_controller->currentCommandType == 2) {
+				unsigned long long now = prepareJWD1797DataFIFORead(jwd_controller);
+				r_val = (jwd_controller->statusRegister & 0b11111001) |
+					getJWD1797DataFIFOStatus(jwd_controller->data_fifo, now);
+			}
 			// clear interrupt
 			jwd_controller->intrq = 0;
 			// e8259_set_irq0 (e8259_slave, 0);
@@ -253,6 +790,18 @@ unsigned int readJWD1797(JWD1797* jwd_controller, unsigned int port_addr) {
 			break;
 		// data reg port
 		case 0xb3:
+			if(jwd_controller->fifo_transfer) {
+				JWD1797DataFIFO* fifo = jwd_controller->data_fifo;
+				// the data register is kept if the FIFO has not been filled yet
+				unsigned char value = jwd_controller->dataRegister;
+				unsigned long long now = prepareJWD1797DataFIFORead(jwd_controller);
+				// a waiting byte was read - the time since it arrived
+				if(popJWD1797DataFIFO(fifo, now, &value) == 1) {
+					addJWD1797HistogramSample(&jwd_controller->stats.drq_latency[1],
+						now - fifo->ts[(fifo->next - 1) % JWD1797_DATA_FIFO_SIZE]);
+				}
+				jwd_controller->dataRegister = value;
+			}
 			r_val = jwd_controller->dataRegister;
 			/* if there is a byte waiting to be read from the data register
 				(DRQ pin high) because of a READ operation */
@@ -263,11 +812,16 @@ unsigned int readJWD1797(JWD1797* jwd_controller, unsigned int port_addr) {
 				// reset data request line and status bit
 				jwd_controller->drq = 0;
 				jwd_controller->statusRegister &= 0b11111101;
+				// host time of the read (quantum time not run yet included)
+				addJWD1797HistogramSample(
+					&jwd_controller->stats.drq_latency[jwd_controller->currentCommandType - 1],
+					jwd_controller->emulated_time_ns + jwd_controller->quantum_accumulator_ns
+					- jwd_controller->drq_ns);
 			}
 			break;
 		// control latch reg port (write)
 		case 0xb4:
-			printf(" ** WARNING: Reading from WD1797 control latch port 0xB4 (write only)!\n");
+			JWD_PRINTF(jwd_controller, " ** WARNING: Reading from WD1797 control latch port 0xB4 (write only)!\n");
 			r_val = jwd_controller->controlLatch;
 			break;
 		// controller status port (read)
@@ -276,8 +830,10 @@ unsigned int readJWD1797(JWD1797* jwd_controller, unsigned int port_addr) {
 			r_val = jwd_controller->controlStatus;
 			break;
 		default:
-			printf("%X is an invalid port!\n", port_addr);
+			JWD_PRINTF(jwd_controller, "%X is an invalid port!\n", port_addr);
 	}
+	JWD_TRACE_PORT(jwd_controller, 0, port_addr, r_val);
+	JWD_VCD_READ(jwd_controller);
 	return r_val;
 }
 
@@ -286,6 +842,7 @@ void writeJWD1797(JWD1797* jwd_controller, unsigned int port_addr, unsigned int
 	// printf("\nWrite ");
 	// print_bin8_representation(value);
 	// printf("%s%X\n\n", " to wd1797/port: ", port_addr);
+	JWD_TRACE_PORT(jwd_controller, 1, port_addr, value);
 	switch(port_addr) {
 		// command reg port
 		case 0xb0:
@@ -315,6 +872,8 @@ void writeJWD1797(JWD1797* jwd_controller, unsigned int port_addr, unsigned int
 			break;
 		// data reg port
 		case 0xb3:
+			// the host takes the data register over from a FIFO transfer
+			jwd_controller->fifo_transfer = 0;
 			jwd_controller->dataRegister = value;
 			if((jwd_controller->currentCommandName == "WRITE SECTOR" ||
 				jwd_controller->currentCommandName == "WRITE TRACK")
@@ -326,26 +885,678 @@ void writeJWD1797(JWD1797* jwd_controller, unsigned int port_addr, unsigned int
 			break;
 		// control latch port
 		case 0xb4:
-			printf("Writing to WD1797 control port 0xB4 (ONLY wait_enabled option)\n");
+			JWD_PRINTF(jwd_controller, "Writing to WD1797 control port 0xB4 (ONLY wait_enabled option)\n");
 			jwd_controller->controlLatch = value;
 			// set wait enabled option according to bit 6
 			jwd_controller->wait_enabled = (jwd_controller->controlLatch >> 6) & 1;
 			if(jwd_controller->wait_enabled) {
-				printf("%s\n", "** FD-1797 Wait Enabled **");
+				JWD_PRINTF(jwd_controller, "%s\n", "** FD-1797 Wait Enabled **");
 			}
 			break;
 		// controller status port
 		case 0xb5:
-			printf(" ** WARNING: Writing to WD1797 status port 0xB5 (read only)!\n");
+			JWD_PRINTF(jwd_controller, " ** WARNING: Writing to WD1797 status port 0xB5 (read only)!\n");
 			break;
 		default:
-			printf("%X is an invalid port!\n", port_addr);
+			JWD_PRINTF(jwd_controller, "%X is an invalid port!\n", port_addr);
 	}
+	JWD_VCD_PINS(jwd_controller);
 }
 
 /* main program will add the amount of calculated time from the previous
-	instruction to the internal WD1797 timers */
+	instruction to the internal WD1797 timers. A time slice that covers more
+	than one rotational byte boundary (coarse quantum stepping) is processed in a
+	tight internal loop, one step per byte boundary, so no byte is skipped. */
 void doJWD1797Cycle(JWD1797* w, double us) {
+	unsigned long long slice_ns = (unsigned long long)(us*1000.0 + 0.5);
+	/* an HLE READ SECTOR has no byte level work - step straight to each sector
+		deadline, then over the rest of the slice */
+	if(w->hle_active && !w->command_done) {
+		unsigned long long end_ns = w->emulated_time_ns + slice_ns;
+		while(w->hle_active && !w->command_done && w->hle_deadline_ns <= end_ns) {
+			doJWD1797CycleStep(w, w->hle_deadline_ns - w->emulated_time_ns);
+		}
+		doJWD1797CycleStep(w, end_ns - w->emulated_time_ns);
+		return;
+	}
+	/* a TYPE I command stepping the head only has work at its step deadlines -
+		step straight to each of them. A zero length step right after each one
+		sees the new track, so the end of the command action and the post command
+		phase (INTRQ or verify settling) land on the step time itself. The rest of
+		the slice is stepped byte by byte once stepping is done (verify reads ID
+		fields). */
+	if(w->currentCommandType == 1 && !w->command_done && !w->command_action_done) {
+		unsigned long long end_ns = w->emulated_time_ns + slice_ns;
+		while(!w->command_done && !w->command_action_done &&
+			w->step_deadline_ns <= end_ns) {
+			doJWD1797CycleStep(w, w->step_deadline_ns - w->emulated_time_ns);
+			if(!w->command_done && !w->command_action_done) {doJWD1797CycleStep(w, 0);}
+		}
+		if(!w->command_done && w->command_action_done) {doJWD1797CycleStep(w, 0);}
+		if(!w->command_done && !w->command_action_done) {
+			doJWD1797CycleStep(w, end_ns - w->emulated_time_ns);
+			return;
+		}
+		slice_ns = end_ns - w->emulated_time_ns;
+	}
+	/* a multi-record READ SECTOR waiting for the data field of its next sector
+		has nothing to do until the byte before it - step straight there */
+	if(w->next_data_byte > 0 && !w->command_done &&
+		w->next_data_byte > getJWD1797BytesPassed(w, w->emulated_time_ns) + 1) {
+		unsigned long long wait_ns =
+			getJWD1797ByteStartTime(w, w->next_data_byte - 1) - w->emulated_time_ns;
+		if(slice_ns <= wait_ns) {
+			doJWD1797CycleStep(w, slice_ns);
+			return;
+		}
+		doJWD1797CycleStep(w, wait_ns);
+		slice_ns -= wait_ns;
+	}
+	// time to the next rotational byte boundary
+	unsigned long long boundary_ns = w->rotational_byte_read_limit -
+		((w->emulated_time_ns - w->rotation_t0_ns) % w->rotational_byte_read_limit);
+	/* step to each byte boundary while the rest of the slice still crosses
+		another one - a slice that crosses at most one boundary takes one step */
+	while(slice_ns >= boundary_ns + w->rotational_byte_read_limit) {
+		doJWD1797CycleStep(w, boundary_ns);
+		slice_ns -= boundary_ns;
+		boundary_ns = w->rotational_byte_read_limit;
+	}
+	doJWD1797CycleStep(w, slice_ns);
+}
+
+/* host entry point for coarse quantum stepping. Instruction times are
+	accumulated and the controller is only cycled once a full quantum has
+	passed (see setJWD1797Quantum()). With no quantum set, every call cycles. */
+void advanceJWD1797(JWD1797* w, double us) {
+	w->quantum_accumulator_ns += (unsigned long long)(us*1000.0 + 0.5);
+	if(w->quantum_accumulator_ns >= w->cycle_quantum_ns) {
+		doJWD1797Cycle(w, w->quantum_accumulator_ns/1000.0);
+		w->quantum_accumulator_ns = 0;
+	}
+}
+
+/* sets the quantum (microseconds) used by advanceJWD1797(). Larger quanta
+	trade DRQ servicing accuracy for speed - one byte time
+	(rotational_byte_read_limit) keeps every byte observable by the host. */
+void setJWD1797Quantum(JWD1797* w, double us) {
+	w->cycle_quantum_ns = (unsigned long long)(us*1000.0 + 0.5);
+}
+
+/* moves a multi-record READ SECTOR on to the sector now in the sector
+	register without restarting the byte level ID search. The sector is looked
+	up in the track layout; the ID field is taken from the track descriptor and
+	the data field transfer starts when its first byte comes under the head -
+	the same byte the byte level search would reach. Returns 0 (nothing
+	changed) if the sector is not on the track or does not have a normal data
+	field, so the byte level search can time out / fail as before. */
+int continueJWD1797MultiRecord(JWD1797* w) {
+	unsigned long long id_am_byte = 0;
+	int n = findJWD1797NextSector(w,
+		getJWD1797BytesPassed(w, w->emulated_time_ns) + 1, &id_am_byte);
+	if(n < 0) {return 0;}
+	const unsigned int* offsets;
+	JWD1797TrackDescriptor* t = getJWD1797TrackLayout(w, w->active_track, &offsets);
+	if(t->sector_flags[n] != 0) {return 0;}
+	startJWD1797IDSearch(w);
+	recordJWD1797RotationalWait(w, id_am_byte);
+	w->id_field_data[0] = t->id_cylinders[n];
+	w->id_field_data[1] = t->id_heads[n];
+	w->id_field_data[2] = t->sector_ids[n];
+	w->id_field_data[3] = t->size_code;
+	w->id_field_data[4] = CRC_BYTE;
+	w->id_field_data[5] = CRC_BYTE;
+	w->intSectorLength = t->sector_length;
+	w->verify_index_count = 0;
+	w->ID_data_verified = 1;
+	w->data_mark_found = 1;
+	w->all_bytes_inputted = 0;
+	w->next_data_byte = id_am_byte + ID_AM_TO_DATA_LENGTH;
+	return 1;
+}
+
+/* sets the host DMA callback used by high level emulation (HLE). context is
+	handed back to the callback unchanged (eg. guest memory and the transfer
+	address of the host). */
+void setJWD1797DMACallback(JWD1797* w, JWD1797DMACallback dma, void* context) {
+	w->hle_dma = dma;
+	w->hle_dma_context = context;
+}
+
+/* streams the bytes of every READ TRACK to sink (NULL: none) as well as
+	through the data register - in chunks of up to JWD1797_TRACK_SINK_CHUNK
+	bytes, the last one flagged. context is handed back to the sink
+	unchanged. A READ TRACK cut short by a new command or a forced interrupt
+	ends with the bytes read so far. */
+void setJWD1797TrackSink(JWD1797* w, JWD1797TrackSink sink, void* context) {
+	flushJWD1797TrackSink(w, 1);
+	if(sink != NULL && w->track_sink_buffer == NULL) {
+		w->track_sink_buffer =
+			(unsigned char*)allocJWD1797Arena(w->arena, JWD1797_TRACK_SINK_CHUNK);
+		if(w->track_sink_buffer == NULL) {sink = NULL;}
+	}
+	w->track_sink = sink;
+	w->track_sink_context = context;
+}
+
+/* hands the buffered READ TRACK bytes to the sink. last ends the track - the
+	sink is told even if there are no bytes left. */
+void flushJWD1797TrackSink(JWD1797* w, int last) {
+	if(!w->track_sink_active) {return;}
+	if(w->track_sink_used > 0 || last) {
+		w->track_sink(w->track_sink_context, w->current_track, w->sso_pin,
+			w->track_sink_buffer, w->track_sink_used, last);
+	}
+	w->track_sink_used = 0;
+	if(last) {w->track_sink_active = 0;}
+}
+
+/* images the whole disk without emulating it: the formatted bytes of every
+	track (the overlay copy if it was written), cylinder by cylinder and head
+	by head, each handed to sink as one last chunk. No emulated time passes
+	and no DRQ is raised - use it when no guest CPU is attached. A byte level
+	READ TRACK starts wherever the index pulse catches the rotation, this
+	always starts at the first byte of the track. Returns the number of
+	tracks, -1 if there is no disk. */
+int captureJWD1797Disk(JWD1797* w, JWD1797TrackSink sink, void* context) {
+	if(w->image == NULL) {return -1;}
+	for(unsigned int cyl = 0; cyl < w->cylinders; cyl++) {
+		for(unsigned int head = 0; head < w->num_heads; head++) {
+			unsigned int length;
+			const unsigned char* data = getJWD1797TrackData(w, cyl * w->num_heads + head,
+				&length);
+			sink(context, cyl, head, data, length, 1);
+		}
+	}
+	return w->cylinders * w->num_heads;
+}
+
+/* track sink that appends the raw track bytes to the open file context
+	(FILE*) - tracks follow each other in cylinder and head order */
+void writeJWD1797TrackFile(void* context, int cylinder, int head,
+	const unsigned char* data, unsigned int len, int last) {
+	// the file is the track bytes only - where they came from is not recorded
+	(void)cylinder;
+	(void)head;
+	(void)last;
+	fwrite(data, 1, len, (FILE*)context);
+}
+
+/* turns high level emulation of READ SECTOR on (1) or off (0). The controller
+	can not see the host CPU, so the host turns HLE on while its CPU runs a
+	known ROM transfer loop (eg. the boot ROM reading the boot tracks) or
+	whenever it wants fast sector transfers. A READ SECTOR issued while HLE is
+	on (and a DMA callback is set) skips the byte level ID search and DRQ
+	transfer: the sector is found from the known track layout, handed to the
+	DMA callback and the command completes with the same status, INTRQ and
+	emulated time as the byte level READ SECTOR. */
+void setJWD1797HLE(JWD1797* w, int enabled) {
+	w->hle_enabled = enabled;
+}
+
+/* turns FIFO mode on (1) or off (0). A READ SECTOR in FIFO mode puts each
+	sector in the data FIFO in one go, time stamped, and skips the byte by byte
+	work like HLE does - but the host still reads the bytes through the data
+	register and DRQ. Reads are resolved at the host's time (coarse quantum
+	time included), so a large quantum no longer loses bytes the host reads in
+	time. Takes the place of the HLE DMA transfer while on. */
+void setJWD1797DataFIFO(JWD1797* w, int enabled) {
+	if(enabled && w->data_fifo == NULL) {
+		w->data_fifo =
+			(JWD1797DataFIFO*)allocJWD1797Arena(w->arena, sizeof(JWD1797DataFIFO));
+		if(w->data_fifo == NULL) {enabled = 0;}
+	}
+	w->fifo_enabled = enabled;
+}
+
+// empties the FIFO for a new transfer - the data register starts at 0, read
+void resetJWD1797DataFIFO(JWD1797DataFIFO* fifo) {
+	fifo->head = 0;
+	fifo->tail = 0;
+	fifo->next = 0;
+	fifo->read = 1;
+	fifo->lost = 0;
+	fifo->value = 0;
+	fifo->lost_bytes = 0;
+	fifo->end_ns = ~0ULL;
+	fifo->complete_ns = 0;
+}
+
+/* producer - puts len bytes of the track under the head in the FIFO. Byte k
+	is assembled at the start of absolute byte first_byte + k. */
+void pushJWD1797DataFIFO(JWD1797* w, const unsigned char* data, unsigned int len,
+	unsigned long long first_byte) {
+	JWD1797DataFIFO* fifo = w->data_fifo;
+	// drop what the host can no longer read - one sector is in at a time
+	stepJWD1797DataFIFO(fifo, w->emulated_time_ns);
+	unsigned long head = fifo->head;
+	unsigned long tail = fifo->tail;
+	if(head - tail + len > JWD1797_DATA_FIFO_SIZE) {
+		len = JWD1797_DATA_FIFO_SIZE - (head - tail);
+	}
+	unsigned long long ts = getJWD1797ByteStartTime(w, first_byte);
+	for(unsigned int k = 0; k < len; k++) {
+		fifo->data[(head + k) % JWD1797_DATA_FIFO_SIZE] = data[k];
+		fifo->ts[(head + k) % JWD1797_DATA_FIFO_SIZE] = ts;
+		ts += w->rotational_byte_read_limit;
+	}
+	fifo->head = head + len;
+}
+
+/* producer - the transfer ended (command done or terminated) at the current
+	time. Bytes due later never arrive. */
+void endJWD1797DataFIFO(JWD1797* w) {
+	JWD1797DataFIFO* fifo = w->data_fifo;
+	if(fifo->end_ns != ~0ULL) {return;}
+	fifo->end_ns = w->emulated_time_ns;
+	fifo->complete_ns = ~0ULL;
+}
+
+/* consumer - lets every byte assembled up to now_ns arrive in the data
+	register. A byte that arrives while the one before it was not read sets
+	lost data, one that arrives after a read clears it (see commandStep()). */
+void stepJWD1797DataFIFO(JWD1797DataFIFO* fifo, unsigned long long now_ns) {
+	unsigned long head = fifo->head;
+	unsigned long next = fifo->next;
+	if(now_ns > fifo->end_ns) {now_ns = fifo->end_ns;}
+	if(next == head || fifo->ts[next % JWD1797_DATA_FIFO_SIZE] > now_ns) {return;}
+	while(next < head && fifo->ts[next % JWD1797_DATA_FIFO_SIZE] <= now_ns) {
+		fifo->lost = !fifo->read;
+		fifo->lost_bytes += fifo->lost;
+		fifo->read = 0;
+		next++;
+	}
+	fifo->value = fifo->data[(next - 1) % JWD1797_DATA_FIFO_SIZE];
+	fifo->next = next;
+	fifo->tail = next - 1;
+}
+
+/* consumer - reads the data register at now_ns into value. Returns 1 if a
+	byte was waiting (DRQ - cleared by the read), 0 if not and -1 if the
+	producer has not put in everything up to now_ns yet. */
+int popJWD1797DataFIFO(JWD1797DataFIFO* fifo, unsigned long long now_ns,
+	unsigned char* value) {
+	if(now_ns > fifo->complete_ns) {return -1;}
+	stepJWD1797DataFIFO(fifo, now_ns);
+	*value = fifo->value;
+	if(fifo->read) {return 0;}
+	fifo->read = 1;
+	return 1;
+}
+
+// consumer - DRQ (bit 1) and lost data (bit 2) status bits at now_ns
+unsigned int getJWD1797DataFIFOStatus(JWD1797DataFIFO* fifo,
+	unsigned long long now_ns) {
+	stepJWD1797DataFIFO(fifo, now_ns);
+	return (fifo->next > 0 && !fifo->read ? 0b00000010 : 0) |
+		(fifo->lost ? 0b00000100 : 0);
+}
+
+/* host time of a port read in a FIFO transfer - the controller time plus the
+	quantum time not run yet. If the FIFO is not filled up to there the
+	controller is run to it first. */
+unsigned long long prepareJWD1797DataFIFORead(JWD1797* w) {
+	unsigned long long now = w->emulated_time_ns + w->quantum_accumulator_ns;
+	if(now > w->data_fifo->complete_ns) {
+		doJWD1797Cycle(w, w->quantum_accumulator_ns/1000.0);
+		w->quantum_accumulator_ns = 0;
+		now = w->emulated_time_ns;
+	}
+	// a forced interrupt outside a cycle (READY pin) ends the transfer too
+	if(w->command_done) {endJWD1797DataFIFO(w);}
+	return now;
+}
+
+// statistics histogram bucket of value (see JWD1797_HISTOGRAM_BUCKETS)
+int getJWD1797HistogramBucket(unsigned long long value) {
+	int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+	return bucket < JWD1797_HISTOGRAM_BUCKETS ? bucket : JWD1797_HISTOGRAM_BUCKETS - 1;
+}
+
+void addJWD1797HistogramSample(JWD1797Histogram* h, unsigned long long value) {
+	h->buckets[getJWD1797HistogramBucket(value)]++;
+	h->samples++;
+	h->sum += value;
+	if(value > h->max) {h->max = value;}
+}
+
+/* copies the guest I/O statistics of the controller into stats - with the
+	bytes lost so far by a data FIFO transfer, which are only counted into the
+	controller statistics when the next one starts */
+void getJWD1797Stats(JWD1797* w, JWD1797Stats* stats) {
+	*stats = w->stats;
+	if(w->data_fifo != NULL) {stats->lost_data[1] += w->data_fifo->lost_bytes;}
+}
+
+// starts the guest I/O statistics over
+void clearJWD1797Stats(JWD1797* w) {
+	memset(&w->stats, 0, sizeof(JWD1797Stats));
+	if(w->data_fifo != NULL) {w->data_fifo->lost_bytes = 0;}
+}
+
+// a TYPE I, II or III command started - its samples go to its type
+void openJWD1797CommandStats(JWD1797* w) {
+	closeJWD1797CommandStats(w);
+	w->stats_type = w->currentCommandType;
+	w->stats_start_track = w->current_track;
+	w->id_search_byte = ~0ULL;
+	w->stats.commands[w->stats_type - 1]++;
+}
+
+/* the command ended (done or terminated) - the tracks the head moved are its
+	seek distance */
+void closeJWD1797CommandStats(JWD1797* w) {
+	if(w->stats_type == 0) {return;}
+	int distance = w->current_track - w->stats_start_track;
+	addJWD1797HistogramSample(&w->stats.seek_distance[w->stats_type - 1],
+		distance < 0 ? -distance : distance);
+	w->stats_type = 0;
+}
+
+// the ID search starts at the byte under the head - unless it is on already
+void startJWD1797IDSearch(JWD1797* w) {
+	if(w->id_search_byte == ~0ULL) {
+		w->id_search_byte = getJWD1797BytesPassed(w, w->emulated_time_ns);
+	}
+}
+
+/* the ID search found its target ID address mark at absolute byte id_am_byte -
+	the bytes since the search started are its rotational wait */
+void recordJWD1797RotationalWait(JWD1797* w, unsigned long long id_am_byte) {
+	if(w->stats_type != 0 && w->id_search_byte != ~0ULL &&
+		id_am_byte >= w->id_search_byte) {
+		addJWD1797HistogramSample(&w->stats.rotational_wait[w->stats_type - 1],
+			id_am_byte - w->id_search_byte);
+	}
+	w->id_search_byte = ~0ULL;
+}
+
+// kinds of the events the controller records
+static const JWD1797TraceKind trace_command_kind = {"command", {"command", NULL}};
+static const JWD1797TraceKind trace_command_end_kind = {"command", {"status", NULL}};
+static const JWD1797TraceKind trace_phase_kind = {"phase", {NULL, NULL}};
+static const JWD1797TraceKind trace_pin_kind = {"pin", {"value", NULL}};
+static const JWD1797TraceKind trace_port_kind = {"port", {"port", "value"}};
+
+/* records the activity of the controller in tracer (NULL stops tracing) on
+	timeline row id: commands and their phases as begin/end events, IP, HLD,
+	HLT, DRQ and INTRQ as counters and port accesses as instant events, all
+	stamped with the emulated time. Phases and pins are sampled at byte
+	boundaries, status register changes and port accesses - a timer that runs
+	out between two bytes shows at the next byte. */
+void setJWD1797Tracer(JWD1797* w, struct JWD1797Tracer* tracer, int id) {
+	w->tracer = tracer;
+	w->trace_id = id;
+	w->trace_command = NULL;
+	w->trace_phase = NULL;
+	w->trace_last_read = 0;
+	// record every pin once at the start
+	if(tracer != NULL) {
+		unsigned char pins = w->index_pulse_pin | (w->HLD_pin << 1) |
+			(w->HLT_pin << 2) | (w->drq << 3) | (w->intrq << 4);
+		w->trace_pins = ~pins;
+		traceJWD1797State(w);
+	}
+}
+
+/* phase of the running command shown on the timeline (NULL: none) - derived
+	from the command state after each step */
+const char* getJWD1797Phase(JWD1797* w) {
+	if(w->command_done) {return NULL;}
+	if(w->hle_active) {return "HLE transfer";}
+	if(w->currentCommandType == 1) {
+		if(!w->command_action_done) {return "step";}
+		if(!w->verifyFlag) {return NULL;}
+		if(!w->head_settling_done) {return "settle";}
+		if(!w->HLT_pin) {return "HLT wait";}
+		return "IDAM search";
+	}
+	if(w->currentCommandType == 2 || w->currentCommandType == 3) {
+		if(w->delay15ms && !w->e_delay_done) {return "E delay";}
+		if(!w->HLT_pin) {return "HLT wait";}
+		if(w->currentCommandName == "READ TRACK") {return "data transfer";}
+		if(w->currentCommandName == "READ ADDRESS") {
+			return w->id_field_found ? "data transfer" : "IDAM search";
+		}
+		if(!w->ID_data_verified) {return "IDAM search";}
+		if(!w->data_mark_found) {return "DAM search";}
+		return "data transfer";
+	}
+	return NULL;
+}
+
+// a command was written to the command register - open it on the timeline
+void traceJWD1797Command(JWD1797* w) {
+	// forced interrupt - the running command (if any) is ended by the next step
+	if(((w->commandRegister>>4) & 15) == 13) {
+		addJWD1797TraceEvent(w->tracer, w->emulated_time_ns, 'i', "FORCE INTERRUPT",
+			&trace_command_kind, w->trace_id, w->commandRegister, 0);
+		return;
+	}
+	if(w->trace_phase != NULL) {
+		addJWD1797TraceEvent(w->tracer, w->emulated_time_ns, 'E', w->trace_phase,
+			&trace_phase_kind, w->trace_id, 0, 0);
+		w->trace_phase = NULL;
+	}
+	if(w->trace_command != NULL) {
+		addJWD1797TraceEvent(w->tracer, w->emulated_time_ns, 'E', w->trace_command,
+			&trace_command_end_kind, w->trace_id, w->statusRegister, 0);
+	}
+	w->trace_command = w->currentCommandName;
+	addJWD1797TraceEvent(w->tracer, w->emulated_time_ns, 'B', w->trace_command,
+		&trace_command_kind, w->trace_id, w->commandRegister, 0);
+	traceJWD1797State(w);
+}
+
+/* records what changed since the last call - the command phase, the end of
+	the command and the pins */
+void traceJWD1797State(JWD1797* w) {
+	const char* phase = w->trace_command != NULL ? getJWD1797Phase(w) : NULL;
+	if(phase != w->trace_phase) {
+		if(w->trace_phase != NULL) {
+			addJWD1797TraceEvent(w->tracer, w->emulated_time_ns, 'E', w->trace_phase,
+				&trace_phase_kind, w->trace_id, 0, 0);
+		}
+		if(phase != NULL) {
+			addJWD1797TraceEvent(w->tracer, w->emulated_time_ns, 'B', phase,
+				&trace_phase_kind, w->trace_id, 0, 0);
+		}
+		w->trace_phase = phase;
+	}
+	if(w->trace_command != NULL && w->command_done) {
+		addJWD1797TraceEvent(w->tracer, w->emulated_time_ns, 'E', w->trace_command,
+			&trace_command_end_kind, w->trace_id, w->statusRegister, 0);
+		w->trace_command = NULL;
+	}
+	unsigned char pins = w->index_pulse_pin | (w->HLD_pin << 1) |
+		(w->HLT_pin << 2) | (w->drq << 3) | (w->intrq << 4);
+	unsigned char changed = pins ^ w->trace_pins;
+	if(changed) {
+		static const char* pin_names[5] = {"IP", "HLD", "HLT", "DRQ", "INTRQ"};
+		for(int pin = 0; pin < 5; pin++) {
+			if((changed >> pin) & 1) {
+				addJWD1797TraceEvent(w->tracer, w->emulated_time_ns, 'C', pin_names[pin],
+					&trace_pin_kind, w->trace_id, (pins >> pin) & 1, 0);
+			}
+		}
+		w->trace_pins = pins;
+	}
+	w->trace_status = w->statusRegister;
+}
+
+/* a port was read or written by the host. A polling loop reading the same
+	value from the same port again and again is recorded once, at its first
+	read. */
+void traceJWD1797Port(JWD1797* w, int write, unsigned int port,
+	unsigned int value) {
+	unsigned int access = (port << 8) | (value & 0xFF);
+	if(write || access != w->trace_last_read) {
+		addJWD1797TraceEvent(w->tracer, w->emulated_time_ns, 'i',
+			write ? "port write" : "port read", &trace_port_kind, w->trace_id, port,
+			value);
+	}
+	w->trace_last_read = write ? 0 : access;
+	// a read can only have cleared DRQ or INTRQ
+	if(write || ((w->drq << 3) | (w->intrq << 4)) != (w->trace_pins & 0x18)) {
+		traceJWD1797State(w);
+	}
+}
+
+/* dumps the pins IP, HLD, HLT, DIRC, SSO, TG43, DRQ and INTRQ (in that
+	order) of the controller to the VCD writer vcd (NULL stops the dump).
+	vcd must be a new writer - one controller per file. The index pulse is
+	written at the exact times the hole passes the sensor, the other pins at
+	the step or port access that changed them. Returns 0, or -1 if the pins
+	can not be added to vcd. */
+int setJWD1797VCD(JWD1797* w, struct JWD1797VCDWriter* vcd) {
+	static const char* pin_names[8] = {"IP", "HLD", "HLT", "DIRC", "SSO", "TG43",
+		"DRQ", "INTRQ"};
+	w->vcd = NULL;
+	if(vcd == NULL) {return 0;}
+	for(int pin = 0; pin < 8; pin++) {
+		if(addJWD1797VCDSignal(vcd, pin_names[pin]) != pin) {return -1;}
+	}
+	w->vcd = vcd;
+	w->vcd_last_ns = w->emulated_time_ns;
+	w->vcd_t0_ns = w->rotation_t0_ns;
+	w->vcd_ip_edge_ns = getJWD1797NextIndexEdge(w, w->emulated_time_ns);
+	w->vcd_pins = getJWD1797IndexPulse(w, w->emulated_time_ns) | JWD_VCD_LEVELS(w);
+	// the initial levels
+	writeJWD1797VCDValues(vcd, w->emulated_time_ns, w->vcd_pins);
+	return 0;
+}
+
+// writes the pin levels that changed since the last dump
+void dumpJWD1797Pins(JWD1797* w) {
+	unsigned long long now = w->emulated_time_ns;
+	// the rotation was re-timed (new track, reset) - find the next edge again
+	if(w->rotation_t0_ns != w->vcd_t0_ns || now < w->vcd_last_ns) {
+		w->vcd_t0_ns = w->rotation_t0_ns;
+		w->vcd_ip_edge_ns = getJWD1797NextIndexEdge(w, now);
+		w->vcd_pins = (w->vcd_pins & ~1u) | getJWD1797IndexPulse(w, now);
+	}
+	// index pulse edges since the last dump, at their own time stamps
+	while(w->vcd_ip_edge_ns <= now) {
+		w->vcd_pins ^= 1;
+		writeJWD1797VCDValues(w->vcd, w->vcd_ip_edge_ns, w->vcd_pins);
+		w->vcd_ip_edge_ns = getJWD1797NextIndexEdge(w, w->vcd_ip_edge_ns);
+	}
+	w->vcd_last_ns = now;
+	unsigned int pins = (w->vcd_pins & 1) | JWD_VCD_LEVELS(w);
+	if(pins != w->vcd_pins) {
+		writeJWD1797VCDValues(w->vcd, now, pins);
+		w->vcd_pins = pins;
+	}
+}
+
+/* starts an HLE READ SECTOR once the command is set up. The ID field search
+	starts after the E delay and the head load time, like the byte level one. */
+void startJWD1797HLERead(JWD1797* w) {
+	double wait_us = w->delay15ms ? w->format->e_delay_us : 0.0;
+	if(!w->HLT_pin && w->HLT_timer_active &&
+		HEAD_LOAD_TIMING_LIMIT - w->HLT_timer > wait_us) {
+		wait_us = HEAD_LOAD_TIMING_LIMIT - w->HLT_timer;
+	}
+	w->hle_active = 1;
+	scheduleJWD1797HLESector(w,
+		w->emulated_time_ns + (unsigned long long)(wait_us*1000.0 + 0.5));
+	publishJWD1797DataFIFO(w);
+}
+
+/* FIFO mode - nothing else arrives before the HLE deadline, so the FIFO is
+	complete up to it */
+void publishJWD1797DataFIFO(JWD1797* w) {
+	if(w->fifo_transfer) {
+		w->data_fifo->complete_ns = w->hle_deadline_ns;
+	}
+}
+
+/* looks up the sector in the sector register on the track under the head,
+	searching from time from_ns on, and sets the HLE deadline: the time its
+	last data byte is assembled. A sector that is not on the track sets the
+	deadline to the 5th index hole (record not found); one without a data field
+	to the end of the data address mark search. */
+void scheduleJWD1797HLESector(JWD1797* w, unsigned long long from_ns) {
+	int track_index = getJWD1797TrackIndex(w);
+	if(track_index != w->active_track) {selectJWD1797Track(w, track_index);}
+	unsigned long long id_am_byte = 0;
+	int n = findJWD1797NextSector(w, getJWD1797BytesPassed(w, from_ns) + 1,
+		&id_am_byte);
+	unsigned long long timeout_byte = (getJWD1797Revolutions(w, from_ns) + 5)
+		* w->actual_num_track_bytes;
+	if(n < 0 || id_am_byte >= timeout_byte) {
+		w->hle_sector = -1;
+		w->hle_deadline_ns = getJWD1797ByteStartTime(w, timeout_byte);
+		return;
+	}
+	// the wait for the ID field is known as soon as the search starts
+	w->id_search_byte = getJWD1797BytesPassed(w, from_ns);
+	recordJWD1797RotationalWait(w, id_am_byte);
+	const unsigned int* offsets;
+	JWD1797TrackDescriptor* t = getJWD1797TrackLayout(w, w->active_track, &offsets);
+	if(t->sector_flags[n] & JWD1797_SECTOR_NO_DATA) {
+		w->hle_sector = -2;
+		w->hle_deadline_ns = getJWD1797ByteStartTime(w, id_am_byte + CRC_LENGTH
+			+ ID_AM_LENGTH + CYLINDER_LENGTH + HEAD_LENGTH + SECTOR_LENGTH
+			+ SECTOR_SIZE_LENGTH + DATA_AM_SEARCH_LIMIT);
+		return;
+	}
+	w->hle_sector = n;
+	w->hle_deadline_ns = getJWD1797ByteStartTime(w, id_am_byte
+		+ ID_AM_TO_DATA_LENGTH + t->sector_length - 1);
+	// FIFO mode - the whole data field goes in now, time stamped
+	if(w->fifo_transfer) {
+		pushJWD1797DataFIFO(w, w->active_track_data + offsets[n] + ID_AM_TO_DATA_LENGTH,
+			t->sector_length, id_am_byte + ID_AM_TO_DATA_LENGTH);
+	}
+}
+
+/* HLE READ SECTOR step - completes every sector whose deadline has passed.
+	No DRQ is raised; the data goes straight to the host DMA callback. */
+void stepJWD1797HLERead(JWD1797* w) {
+	while(w->hle_active && w->emulated_time_ns >= w->hle_deadline_ns) {
+		int n = w->hle_sector;
+		const unsigned int* offsets = NULL;
+		JWD1797TrackDescriptor* t = w->active_track < 0 ? NULL :
+			getJWD1797TrackLayout(w, w->active_track, &offsets);
+		if(t == NULL || n < 0 || n >= t->num_sectors) {
+			// set record-not found bit
+			w->statusRegister |= 0b00010000;
+			// the index hole limit ended the search
+			if(n == -1) {w->stats.index_timeouts[1]++;}
+		}
+		else {
+			// deleted data address mark - record type in status bit 5
+			if(t->sector_flags[n] & JWD1797_SECTOR_DELETED) {
+				w->statusRegister |= 0b00100000;
+			}
+			// FIFO mode - the data went in when the sector was found
+			if(!w->fifo_transfer) {
+				w->hle_dma(w->hle_dma_context, w->active_track_data + offsets[n]
+					+ ID_AM_TO_DATA_LENGTH, t->sector_length);
+			}
+			// check multiple records flag
+			if(w->multipleRecords) {
+				w->sectorRegister++;
+				// next sector - the search starts right after this one
+				if(w->sectorRegister <= w->sectors_per_track) {
+					scheduleJWD1797HLESector(w, w->hle_deadline_ns);
+					publishJWD1797DataFIFO(w);
+					continue;
+				}
+			}
+		}
+		// command is done
+		w->hle_active = 0;
+		w->command_done = 1;
+		w->statusRegister &= 0b11111110;	// reset (clear) busy status bit
+		w->intrq = 1;
+	}
+}
+
+// one controller step covering ns NANOSECONDS (at most one byte boundary)
+void doJWD1797CycleStep(JWD1797* w, unsigned long long ns) {
+	double us = ns/1000.0;
 	w->master_timer += us;	// @@@ DEBUG clock @@@
 
 	/* update status register bit 7 (NOT READY) based on inverted not_master_reset
@@ -382,85 +1593,25 @@ void doJWD1797Cycle(JWD1797* w, double us) {
 	/* check if there is a forced intr 0xD8 (INTRQ & terminate command immediately)
 		(can be combined with other conditions) */
 	if(w->interruptImmediate) {
-		// is there a command currently running?
-		if(!w->command_done) {	// YES
-			// terminate command
-			w->command_done = 1;
-			// reset BUSY status bit ONLY - other status bits are unchanged
-			w->statusRegister &= 0b11111110;
-			// generate interrupt
-			w->intrq = 1;
-			// e8259_set_irq0 (e8259_slave, 1);
-		}
-		else {	// NO command running
-			/* reset busy status and clear SEEK ERROR and CRC ERROR bits
-				(reflect TYPE I status) */
-			w->statusRegister &= 0b11100110; // reset NOT READY bit
-			// change command type to I in order to update TYPE I status bits
-			w->currentCommandType = 1;
-			// generate interrupt
-			w->intrq = 1;
-			// e8259_set_irq0 (e8259_slave, 1);
-		}
+		doJWD1797ForcedInterrupt(w);
 	}
 
 	// reset new byte signal every WD1797 clock cycle
 	w->new_byte_read_signal_ = 0;
-	// clock the rotational byte timer using NANOSECONDS from mainBoard
-	w->rotational_byte_read_timer += ((int)(us*1000.0));
-	// is it time to advance to the next rotational byte?
-	if(w->rotational_byte_read_timer >= w->rotational_byte_read_limit) {
-		// calculate overage for incoming time from mainBoard.c
-		w->rotational_byte_read_timer_OVR =
-			w->rotational_byte_read_timer - w->rotational_byte_read_limit;
-		// advance to next rotational byte (go to 0 if back to start of track)
-		w->rotational_byte_pointer =
-			(w->rotational_byte_pointer + 1) % w->actual_num_track_bytes;
-		// when the first byte of the track is read, signal the start of the index pulse
-		if(w->rotational_byte_pointer == 0) {
-			w->track_start_signal_ = 1;
-			// printf("%s\n", "Beginning of Track");
-			// command execution idle - clock HLD idle index counter
-			if((w->statusRegister & 1) == 0) {w->HLD_idle_index_count++;}
-			else {w->HLD_idle_index_count = 0;}
-			// clock verify timeout counter
-			if(w->verify_operation_active) {w->verify_index_count++;}
-			else {w->verify_index_count = 0;}
-		}
-		/* make new byte read signal (internal) go high. This signals that a new
-			rotational byte has been encountered */
-		w->new_byte_read_signal_ = 1;
-		// reset timer to include overage
-		w->rotational_byte_read_timer = w->rotational_byte_read_timer_OVR;
-	}
+	// advance absolute emulated time using NANOSECONDS from mainBoard
+	w->emulated_time_ns += ns;
+	/* derive the rotational byte, index holes passed and new byte signal from
+		the absolute time stamp */
+	updateRotationalPosition(w);
 
 	/* is it the start of a new track (rising edge of IP? = track_start_signal_)
 		-- with a IP forced interrupt? */
 	if(w->track_start_signal_ && w->interruptIndexPulse) {
-		printf("%s\n", "IP interrupt condition met..");
-		// is there a command currently running?
-		if(!w->command_done) {	// YES
-			// terminate command
-			w->command_done = 1;
-			// reset BUSY status bit ONLY - other status bits are unchanged
-			w->statusRegister &= 0b11111110;
-			// generate interrupt
-			w->intrq = 1;
-			// e8259_set_irq0 (e8259_slave, 1);
-		}
-		else {	// NO command running
-			/* reset busy status and clear SEEK ERROR and CRC ERROR bits
-				(reflect TYPE I status) */
-			w->statusRegister &= 0b11100110; // reset NOT READY bit
-			// change command type to I in order to update TYPE I status bits
-			w->currentCommandType = 1;
-			// generate interrupt
-			w->intrq = 1;
-			// e8259_set_irq0 (e8259_slave, 1);
-		}
+		JWD_PRINTF(w, "%s\n", "IP interrupt condition met..");
+		doJWD1797ForcedInterrupt(w);
 	}
 
-	handleIndexPulse(w, us);
+	handleIndexPulse(w);
 
 	handleHLTTimer(w, us);
 
@@ -486,31 +1637,56 @@ void doJWD1797Cycle(JWD1797* w, double us) {
 
 	// check if command is still active and do command step if so...
 	if(!w->command_done) {
-		commandStep(w, us);
+		if(w->hle_active) {stepJWD1797HLERead(w);}
+		else {commandStep(w, us);}
 	}
+	// no FIFO byte is assembled after the command ends
+	if(w->fifo_transfer && w->command_done) {endJWD1797DataFIFO(w);}
+	if(w->stats_type != 0 && w->command_done) {closeJWD1797CommandStats(w);}
 	// HLD pin will reset if drive is not busy and 15 index pulses happen
 	handleHLDIdle(w);
 
 	/* update control status */
 	updateControlStatus(w);
+	JWD_TRACE_STATE(w);
+	JWD_VCD_PINS(w);
 }
 
 /* WD1797 accepts 11 different commands - this function will register the
 	command and set all paramenters associated with it */
 void doJWD1797Command(JWD1797* w) {
 	// if the 4 high bits are 0b1101, the command is a force interrupt
-	if(((w->commandRegister>>4) & 15) == 13) {setupForcedIntCommand(w); return;}
+	if(((w->commandRegister>>4) & 15) == 13) {
+		// a READ TRACK that was streaming ends here
+		flushJWD1797TrackSink(w, 1);
+		setupForcedIntCommand(w);
+		w->stats.commands[3]++;
+		JWD_TRACE_COMMAND(w);
+		return;
+	}
 
 	// if not TYPE IV (forced interrupt), get busy status bit from status register (bit 0)
 	int busy = w->statusRegister & 1;
 	// check busy status
-	if(busy) {printBusyMsg(); return;}	// do not run command if busy
+	if(busy) {if(w->verbose) {printBusyMsg();} return;}	// do not run command if busy
+	// a new command ends any HLE transfer, multi-record wait or track stream
+	flushJWD1797TrackSink(w, 1);
+	w->hle_active = 0;
+	w->next_data_byte = 0;
+	/* the data register keeps the last byte of a FIFO transfer - unless the
+		host wrote it since (see writeJWD1797()) */
+	if(w->fifo_transfer) {
+		stepJWD1797DataFIFO(w->data_fifo, w->emulated_time_ns);
+		w->dataRegister = w->data_fifo->value;
+		w->fifo_transfer = 0;
+	}
 
 	/* determine if command in command register is a TYPE I command by checking
 		if the 7 bit is a zero (noly TYPE I commands have a zero (0) in the 7 bit) */
 	if(((w->commandRegister>>7) & 1) == 0) {
 		setupTypeICommand(w);
 		setTypeICommand(w);
+		openJWD1797CommandStats(w);
 	}
 	/* Determine if command in command register is TYPE II
 		 by checking the highest 3 bits. The two TYPE II commands have either 0b100
@@ -518,22 +1694,36 @@ void doJWD1797Command(JWD1797* w) {
 		 **NOTE: TYPE II commands assume that the target sector has been previously
 		 loaded into the sector register */
 	else if(((w->commandRegister>>5) & 7) < 6) {
-		printf("TYPE II Command in WD1797 command register..\n");
+		JWD_PRINTF(w, "TYPE II Command in WD1797 command register..\n");
 		setupTypeIICommand(w);
 		setTypeIICommand(w);
+		openJWD1797CommandStats(w);
+		/* high level emulation - hand the sector to the host DMA callback, or
+			put it in the data FIFO */
+		if(w->fifo_enabled && !w->command_done && w->currentCommandName == "READ SECTOR") {
+			// the bytes the last transfer lost go to the statistics now
+			w->stats.lost_data[1] += w->data_fifo->lost_bytes;
+			resetJWD1797DataFIFO(w->data_fifo);
+			w->fifo_transfer = 1;
+			startJWD1797HLERead(w);
+		}
+		else if(w->hle_enabled && w->hle_dma != NULL && !w->command_done &&
+			w->currentCommandName == "READ SECTOR") {startJWD1797HLERead(w);}
 	}
 	/* Determine if command in command register is TYPE III
 		 by checking the highest 3 bits. TYPE III commands have a higher value
 		 then 5 in their shifted 3 high bits */
 	else if(((w->commandRegister>>5) & 7) > 5) {
-		printf("TYPE III Command in WD1797 command register..\n");
+		JWD_PRINTF(w, "TYPE III Command in WD1797 command register..\n");
 		setupTypeIIICommand(w);
 		setTypeIIICommand(w);
+		openJWD1797CommandStats(w);
 	}
 	// check command register error
 	else {
-		printf("%s\n", "Something went wrong! BAD COMMAND BITS in COMMAND REG!");
+		JWD_PRINTF(w, "%s\n", "Something went wrong! BAD COMMAND BITS in COMMAND REG!");
 	}
+	JWD_TRACE_COMMAND(w);
 }
 
 // execute command step if a command is active (not done)
@@ -551,22 +1741,17 @@ void commandStep(JWD1797* w, double us) {
 				if(!w->not_track00_pin) {	// indicates r/w head is over track 00
 					w->trackRegister = 0;
 					w->command_action_done = 1;	// indicate end of command action
-					printf("%s\n", "RESTORED HEAD TO TRACK 00 - command action DONE");
+					JWD_PRINTF(w, "%s\n", "RESTORED HEAD TO TRACK 00 - command action DONE");
 					return;
 				}
-				// not at track 00 - increment step timer
+				// not at track 00 - step at each step deadline
 				else {
-					w->step_timer += us;
-					/* check step timer - has it completed one step according to the step rate?
-						Step rates are in milliseconds (ms), so step rate must be multipled by 1000
-						to change it to microseconds (us). */
-					if(w->step_timer >= (w->stepRate*1000)) {
+					// has the deadline of the next step come?
+					if(stepJWD1797Due(w)) {
 						w->direction_pin = 0;
 						w->current_track--;
 						// step the disk image index down track bytes
 						// w->disk_img_index_pointer -= (w->sector_length * w->sectors_per_track);
-						// reset step timer
-						w->step_timer = 0.0;
 					}
 				}
 			}	// END RESTORE
@@ -576,33 +1761,27 @@ void commandStep(JWD1797* w, double us) {
 					the data register contains the target track) */
 				if(w->trackRegister == w->dataRegister) {	// SEEK found the target track
 					w->command_action_done = 1;	// indicate end of command action
-					printf("%s\n", "SEEK found target track - command action DONE");
+					JWD_PRINTF(w, "%s\n", "SEEK found target track - command action DONE");
 					return;
 				}
 				else if(w->trackRegister > w->dataRegister) {	// must step out
-					w->step_timer += us;
-					if(w->step_timer >= (w->stepRate*1000)) {
+					if(stepJWD1797Due(w)) {
 						w->direction_pin = 0;
 						w->current_track--;
 						// step the disk image index down track bytes
 						// w->disk_img_index_pointer -= (w->sector_length * w->sectors_per_track);
 						// update track register with current track
 						w->trackRegister = w->current_track;
-						// reset step timer
-						w->step_timer = 0.0;
 					}
 				}
 				else if(w->trackRegister < w->dataRegister) {	// must step in
-					w->step_timer += us;
-					if(w->step_timer >= (w->stepRate*1000)) {
+					if(stepJWD1797Due(w)) {
 						w->direction_pin = 1;
 						w->current_track++;
 						// step the disk image index up track bytes
 						// w->disk_img_index_pointer += (w->sector_length * w->sectors_per_track);
 						// update track register with current track
 						w->trackRegister = w->current_track;
-						// reset step timer
-						w->step_timer = 0.0;
 					}
 				}
 			}	// END SEEK
@@ -614,21 +1793,18 @@ void commandStep(JWD1797* w, double us) {
 					// update track register to 0 regardless of track update flag
 					w->trackRegister = 0;
 					w->command_action_done = 1;	// indicate end of command action
-					printf("\n%s\n\n", "STEP - command action DONE (tried to step to track -1)");
+					JWD_PRINTF(w, "\n%s\n\n", "STEP - command action DONE (tried to step to track -1)");
 					return;
 				}
 				// check if step would put head past the number of tracks on the disk
 				else if((w->current_track == (w->cylinders - 1)) && w->direction_pin == 1) {
 					w->command_action_done = 1;
-					printf("\n%s\n\n", "STEP - command action DONE (tried to step past track limit)");
+					JWD_PRINTF(w, "\n%s\n\n", "STEP - command action DONE (tried to step past track limit)");
 					return;
 				}
 				else {
-					w->step_timer += us;
-					/* check step timer - has it completed one step according to the step rate?
-						Step rates are in milliseconds (ms), so step rate must be multipled by 1000
-						to change it to microseconds (us). */
-					if(w->step_timer >= (w->stepRate*1000)) {
+					// has the deadline of the next step come?
+					if(stepJWD1797Due(w)) {
 						// step track according to direction_pin
 						if(w->direction_pin == 0) {
 							w->current_track--;
@@ -640,10 +1816,8 @@ void commandStep(JWD1797* w, double us) {
 						}
 						// update track register if track update flag is high
 						if(w->trackUpdateFlag) {w->trackRegister = w->current_track;}
-						// reset step timer
-						w->step_timer = 0.0;
 						w->command_action_done = 1;	// indicate end of command action
-						printf("%s\n", "STEP - command action DONE");
+						JWD_PRINTF(w, "%s\n", "STEP - command action DONE");
 						return;
 					}
 				}
@@ -652,23 +1826,18 @@ void commandStep(JWD1797* w, double us) {
 			else if(w->currentCommandName == "STEP-IN") {
 				if((w->current_track == (w->cylinders - 1))) {
 					w->command_action_done = 1;
-					printf("\n%s\n\n", "STEP-IN - command action DONE (tried to step past track limit)");
+					JWD_PRINTF(w, "\n%s\n\n", "STEP-IN - command action DONE (tried to step past track limit)");
 					return;
 				}
-				w->step_timer += us;
-				/* check step timer - has it completed one step according to the step rate?
-					Step rates are in milliseconds (ms), so step rate must be multipled by 1000
-					to change it to microseconds (us). */
-				if(w->step_timer >= (w->stepRate*1000)) {
+				// has the deadline of the next step come?
+				if(stepJWD1797Due(w)) {
 					// step track according to direction_pin
 					w->current_track++;
 					// w->disk_img_index_pointer += (w->sector_length * w->sectors_per_track);
 					// update track register if track update flag is high
 					if(w->trackUpdateFlag) {w->trackRegister = w->current_track;}
-					// reset step timer
-					w->step_timer = 0.0;
 					w->command_action_done = 1;	// indicate end of command action
-					printf("%s\n", "STEP-IN - command action DONE");
+					JWD_PRINTF(w, "%s\n", "STEP-IN - command action DONE");
 					return;
 				}
 			}
@@ -678,24 +1847,19 @@ void commandStep(JWD1797* w, double us) {
 					// update track register to 0 regardless of track update flag
 					w->trackRegister = 0;
 					w->command_action_done = 1;	// indicate end of command action
-					printf("\n%s\n\n", "STEP-OUT - command action DONE (tried to step to track -1)");
+					JWD_PRINTF(w, "\n%s\n\n", "STEP-OUT - command action DONE (tried to step to track -1)");
 					return;
 				}
 				else {
-					w->step_timer += us;
-					/* check step timer - has it completed one step according to the step rate?
-						Step rates are in milliseconds (ms), so step rate must be multipled by 1000
-						to change it to microseconds (us). */
-					if(w->step_timer >= (w->stepRate*1000)) {
+					// has the deadline of the next step come?
+					if(stepJWD1797Due(w)) {
 						// step track according to direction_pin
 						w->current_track--;
 						// w->disk_img_index_pointer -= (w->sector_length * w->sectors_per_track);
 						// update track register if track update flag is high
 						if(w->trackUpdateFlag) {w->trackRegister = w->current_track;}
-						// reset step timer
-						w->step_timer = 0.0;
 						w->command_action_done = 1;	// indicate end of command action
-						printf("%s\n", "STEP-OUT - command action DONE");
+						JWD_PRINTF(w, "%s\n", "STEP-OUT - command action DONE");
 						return;
 					}
 				}
@@ -730,7 +1894,7 @@ void commandStep(JWD1797* w, double us) {
 				// generate interrupt
 				w->intrq = 1;
 				// e8259_set_irq0 (e8259_slave, 1);
-				printf("%s\n", "command type I complete");
+				JWD_PRINTF(w, "%s\n", "command type I complete");
 				return;
 			}
 
@@ -774,9 +1938,19 @@ void commandStep(JWD1797* w, double us) {
 			if(w->data_mark_found && !w->all_bytes_inputted) {
 				// is there a new byte in the DR
 				if(w->new_byte_read_signal_) {
+					// multi-record read - wait for the data field of the next sector
+					if(w->next_data_byte > 0) {
+						if(getJWD1797BytesPassed(w, w->emulated_time_ns) < w->next_data_byte) {
+							return;
+						}
+						w->next_data_byte = 0;
+					}
 					/* did computer read the last data byte in the DR? If DRQ is still high,
 						it did not; set lost data bit in status */
-					if(w->drq == 1) {w->statusRegister |= 0b00000100;}
+					if(w->drq == 1) {
+						w->statusRegister |= 0b00000100;
+						w->stats.lost_data[1]++;
+					}
 					// last byte was read (DRQ = 0) reset lost data bit
 					else {w->statusRegister &= 0b11111011;}
 					// read current byte into data register
@@ -784,6 +1958,9 @@ void commandStep(JWD1797* w, double us) {
 					// printf("%X ", w->dataRegister);
 					// set drq and status drq status bit
 					w->drq = 1;
+					// the time the byte was assembled - the start of the byte
+					w->drq_ns = getJWD1797ByteStartTime(w,
+						getJWD1797BytesPassed(w, w->emulated_time_ns));
 					w->statusRegister |= 0b00000010;
 					// decrement data field byte counter
 					w->intSectorLength--;
@@ -811,7 +1988,11 @@ void commandStep(JWD1797* w, double us) {
 					// e8259_set_irq0 (e8259_slave, 1);
 					return;
 				}
-				// if sector number not out of bounds, find next sector
+				/* if sector number not out of bounds, go straight to the next sector
+					using the known track layout - its ID field and data address mark
+					pass under the head without a byte by byte search */
+				else if(continueJWD1797MultiRecord(w)) {return;}
+				// not on the track (or no normal data field) - search for it
 				else {
 					w->verify_index_count = 0;
 					w->ID_data_verified = 0;
@@ -827,7 +2008,7 @@ void commandStep(JWD1797* w, double us) {
 					w->all_bytes_inputted = 0;
 					return;
 				}
-				printf("%s\n", "ERROR: SOMETHING WENT WRONG WITH READING MULTIPLE SECTORS");
+				JWD_PRINTF(w, "%s\n", "ERROR: SOMETHING WENT WRONG WITH READING MULTIPLE SECTORS");
 				return;
 			}
 			// command is done
@@ -842,7 +2023,7 @@ void commandStep(JWD1797* w, double us) {
 
 		// WRITE SECTOR (*** NOT IMPLEMENTED - command completes without executing ***)
 		else if(w->currentCommandName == "WRITE SECTOR") {
-			printf("%s\n", "@@ ** WD-1797 WRITE SECTOR NOT IMPLEMENTED! ** @@");
+			JWD_PRINTF(w, "%s\n", "@@ ** WD-1797 WRITE SECTOR NOT IMPLEMENTED! ** @@");
 			// command is done
 			w->command_done = 1;
 			w->statusRegister &= 0b11111110;	// reset (clear) busy status bit
@@ -862,7 +2043,7 @@ void commandStep(JWD1797* w, double us) {
 			// clock the e delay timer
 			w->e_delay_timer += us;
 			// check if E delay timer has reached limit
-			if(w->e_delay_timer >= E_DELAY_LIMIT) {
+			if(w->e_delay_timer >= w->format->e_delay_us) {
 				w->e_delay_done = 1;
 				w->e_delay_timer = 0.0;
 			}
@@ -877,10 +2058,13 @@ void commandStep(JWD1797* w, double us) {
 				index timeout count is incremented in doJWD1797Cycle() */
 			if(!w->id_field_found) {
 				w->verify_operation_active = 1;	// verify operation = IDAM detection
+				startJWD1797IDSearch(w);
 				// new byte available?
 				if(w->new_byte_read_signal_) {
 					// continue search for IDAM...
-					IDAddressMarkSearch(w);
+					if(IDAddressMarkSearch(w)) {
+						recordJWD1797RotationalWait(w, w->id_am_byte);
+					}
 				}
 				// check if index pass timed out..
 				verifyIndexTimeout(w, 6);
@@ -894,6 +2078,8 @@ void commandStep(JWD1797* w, double us) {
 					w->dataRegister = getFDiskByte(w);
 					w->id_field_data[w->IDAM_byte_count] = w->dataRegister;
 					w->drq = 1;
+					w->drq_ns = getJWD1797ByteStartTime(w,
+						getJWD1797BytesPassed(w, w->emulated_time_ns));
 					w->statusRegister |= 0b00000010;
 					w->IDAM_byte_count++;
 					return;
@@ -932,6 +2118,7 @@ void commandStep(JWD1797* w, double us) {
 				/* is there an index pulse? Wait until after GAP 4a has passed (80 x 0x4E)
 					before starting to look for another index pulse */
 				if((w->read_track_bytes_read > 80) && (w->index_pulse_pin)) {
+					flushJWD1797TrackSink(w, 1);
 					// command is done
 					w->command_done = 1;
 					w->statusRegister &= 0b11111110;	// reset (clear) busy status bit
@@ -944,22 +2131,35 @@ void commandStep(JWD1797* w, double us) {
 				}
 				/* did computer read the last data byte in the DR? If DRQ is still high,
 					it did not; set lost data bit in status */
-				if(w->drq == 1) {w->statusRegister |= 0b00000100;}
+				if(w->drq == 1) {
+					w->statusRegister |= 0b00000100;
+					w->stats.lost_data[2]++;
+				}
 				// last byte was read (DRQ = 0) reset lost data bit
 				else {w->statusRegister &= 0b11111011;}
 				// read current byte into data register
 				w->dataRegister = getFDiskByte(w);
 				// read track takes up a new byte
 				w->read_track_bytes_read++;
+				// stream it to the track sink
+				if(w->track_sink != NULL) {
+					w->track_sink_active = 1;
+					w->track_sink_buffer[w->track_sink_used++] = w->dataRegister;
+					if(w->track_sink_used == JWD1797_TRACK_SINK_CHUNK) {
+						flushJWD1797TrackSink(w, 0);
+					}
+				}
 				// set drq and status drq status bit
 				w->drq = 1;
+				w->drq_ns = getJWD1797ByteStartTime(w,
+					getJWD1797BytesPassed(w, w->emulated_time_ns));
 				w->statusRegister |= 0b00000010;
 				return;
 			}
 		}
 
 		else if(w->currentCommandName == "WRITE TRACK") {
-			printf("%s\n", "@@ ** WD-1797 WRITE TRACK NOT IMPLEMENTED! ** @@");
+			JWD_PRINTF(w, "%s\n", "@@ ** WD-1797 WRITE TRACK NOT IMPLEMENTED! ** @@");
 			// command is done
 			w->command_done = 1;
 			w->statusRegister &= 0b11111110;	// reset (clear) busy status bit
@@ -980,13 +2180,22 @@ void commandStep(JWD1797* w, double us) {
 	+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 */
 
+/* 1 if the next head step of a TYPE I command is due, which schedules the
+	one after it. Step deadlines are computed from the step rate when the
+	command starts (see setupTypeICommand()), so steps land exactly stepRate
+	ms apart whatever the host instruction times are. */
+int stepJWD1797Due(JWD1797* w) {
+	if(w->emulated_time_ns < w->step_deadline_ns) {return 0;}
+	w->step_deadline_ns += (unsigned long long)w->stepRate*1000000;
+	return 1;
+}
+
 void setupTypeICommand(JWD1797* w) {
 	// printf("TYPE I Command in WD1797 command register..\n");
 	w->currentCommandType = 1;
 	w->command_action_done = 0;
 	w->command_done = 0;
 	w->head_settling_done = 0;
-	w->step_timer = 0.0;
 	w->verify_operation_active = 0;
 	w->verify_index_count = 0;
 	w->zero_byte_counter = 0;
@@ -997,12 +2206,13 @@ void setupTypeICommand(JWD1797* w) {
 	w->id_field_data_collected = 0;
 	// set appropriate status bits for type I command to start
 	typeIStatusReset(w);
-	// establish step rate options (in ms) for 1MHz clock (only used with TYPE I cmds)
-	int rates[] = {6, 12, 20, 30};
 	// get rate bits
 	int rateBits = w->commandRegister & 3;
-	// set flags according to command bits
-	w->stepRate = rates[rateBits];
+	/* set flags according to command bits - step rate options (in ms) at the
+		clock of the disk format (only used with TYPE I cmds) */
+	w->stepRate = w->format->step_rates[rateBits];
+	// the first step is one step rate after the command starts
+	w->step_deadline_ns = w->emulated_time_ns + (unsigned long long)w->stepRate*1000000;
 	w->verifyFlag = (w->commandRegister>>2) & 1;
 	w->headLoadFlag = (w->commandRegister>>3) & 1;
 	// HLD set according to V and h flags of type I command
@@ -1063,7 +2273,7 @@ void setupTypeIICommand(JWD1797* w) {
 
 	// sample READY input from DRIVE
 	if(!w->ready_pin) {
-		printf("\n%s\n\n", "DRIVE NOT READY! Command cancelled");
+		JWD_PRINTF(w, "\n%s\n\n", "DRIVE NOT READY! Command cancelled");
 		w->command_done = 1;
 		w->statusRegister &= 0b11111110;	// reset (clear) busy status bit
 		// ** generate interrupt **
@@ -1108,7 +2318,7 @@ void setupTypeIIICommand(JWD1797* w) {
 
 	// sample READY input from DRIVE
 	if(!w->ready_pin) {
-		printf("\n%s\n\n", "DRIVE NOT READY! Command cancelled");
+		JWD_PRINTF(w, "\n%s\n\n", "DRIVE NOT READY! Command cancelled");
 		w->command_done = 1;
 		w->statusRegister &= 0b11111110;	// reset (clear) busy status bit
 		// ** generate interrupt **
@@ -1141,7 +2351,7 @@ void setupForcedIntCommand(JWD1797* w) {
 	// w->interruptIndexPulse = 0;
 	// w->interruptImmediate = 0;
 	// %%%%%%% DEBUG ABOVE ^^^^
-	printf("TYPE IV Command in WD1797 command register (Force Interrupt)..\n");
+	JWD_PRINTF(w, "TYPE IV Command in WD1797 command register (Force Interrupt)..\n");
 	// w->currentCommandType = 4;
 	// w->currentCommandName = "FORCED INTR";
 	/* get the interrupt condition bits (I0-I3) -
@@ -1149,23 +2359,23 @@ void setupForcedIntCommand(JWD1797* w) {
 	unsigned char int_condition_bits = w->commandRegister & 0b00001111;
 	// set interrupt condition(s)
 	if(int_condition_bits & 1) {
-		printf("%s\n", "INTRQ on NOT READY to READY transition");
+		JWD_PRINTF(w, "%s\n", "INTRQ on NOT READY to READY transition");
 		w->interruptNRtoR = 1;
 	}
 	if((int_condition_bits>>1) & 1) {
-		printf("%s\n", "INTRQ on READY to NOT READY transition");
+		JWD_PRINTF(w, "%s\n", "INTRQ on READY to NOT READY transition");
 		w->interruptRtoNR = 1;
 	}
 	if((int_condition_bits>>2) & 1) {
-		printf("%s\n", "INTRQ on INDEX PULSE");
+		JWD_PRINTF(w, "%s\n", "INTRQ on INDEX PULSE");
 		w->interruptIndexPulse = 1;
 	}
 	if((int_condition_bits>>3) & 1) {
-		printf("%s\n", "INTRQ and IMMEDIATE INTERRUPT");
+		JWD_PRINTF(w, "%s\n", "INTRQ and IMMEDIATE INTERRUPT");
 		w->interruptImmediate = 1;
 	}
 	if(int_condition_bits == 0) {
-		printf("%s\n", "NO INTRQ and TERMINATE COMMAND IMMEDIATELY");
+		JWD_PRINTF(w, "%s\n", "NO INTRQ and TERMINATE COMMAND IMMEDIATELY");
 		w->terminate_command = 1;
 	}
 }
@@ -1177,17 +2387,17 @@ void setTypeICommand(JWD1797* w) {
 	if(highBits < 2) { // RESTORE or SEEK command
 		if((highBits&1) == 0) {	// RESTORE command
 			w->currentCommandName = "RESTORE";
-			printf("%s command in WD1797 command register\n", w->currentCommandName);
+			JWD_PRINTF(w, "%s command in WD1797 command register\n", w->currentCommandName);
 		}
 		else if((highBits&1) == 1) {	// SEEK command
 			w->currentCommandName = "SEEK";
-			printf("%s command in WD1797 command register\n", w->currentCommandName);
+			JWD_PRINTF(w, "%s command in WD1797 command register\n", w->currentCommandName);
 			// update Track Register with current track
 			w->trackRegister = w->current_track;
 		}
 		// check error
 		else {
-			printf("%s\n", "Something went wrong! Cannot determine RESTORE or SEEK!");
+			JWD_PRINTF(w, "%s\n", "Something went wrong! Cannot determine RESTORE or SEEK!");
 		}
 	}
 	else { // STEP, STEP-IN or STEP-OUT commands
@@ -1197,21 +2407,21 @@ void setTypeICommand(JWD1797* w) {
 		int cmdID = (w->commandRegister>>5) & 7;
 		if(cmdID == 1) {	// STEP
 			w->currentCommandName = "STEP";
-			printf("%s command in WD1797 command register\n", w->currentCommandName);
+			JWD_PRINTF(w, "%s command in WD1797 command register\n", w->currentCommandName);
 		}
 		else if(cmdID == 2) {	//STEP-IN
 			w->currentCommandName = "STEP-IN";
 			w->direction_pin = 1;
-			printf("%s command in WD1797 command register\n", w->currentCommandName);
+			JWD_PRINTF(w, "%s command in WD1797 command register\n", w->currentCommandName);
 		}
 		else if(cmdID == 3)  {	// STEP-OUT
 			w->currentCommandName = "STEP-OUT";
 			w->direction_pin = 0;
-			printf("%s command in WD1797 command register\n", w->currentCommandName);
+			JWD_PRINTF(w, "%s command in WD1797 command register\n", w->currentCommandName);
 		}
 		// check error
 		else {
-			printf("%s\n", "Something went wrong! Cannot determine which TYPE I STEP command!");
+			JWD_PRINTF(w, "%s\n", "Something went wrong! Cannot determine which TYPE I STEP command!");
 		}
 	}
 }
@@ -1222,17 +2432,17 @@ void setTypeIICommand(JWD1797* w) {
 	// check if READ SECTOR (high 3 bits == 0b100)
 	if(cmdID == 4) {
 		w->currentCommandName = "READ SECTOR";
-		printf("%s command in WD1797 command register\n", w->currentCommandName);
+		JWD_PRINTF(w, "%s command in WD1797 command register\n", w->currentCommandName);
 	}
 	else if(cmdID == 5) {
 		w->currentCommandName = "WRITE SECTOR";
-		printf("%s command in WD1797 command register\n", w->currentCommandName);
+		JWD_PRINTF(w, "%s command in WD1797 command register\n", w->currentCommandName);
 		// set Data Address Mark flag
 		w->dataAddressMark = w->commandRegister & 1;
 	}
 	// check error
 	else {
-		printf("%s\n", "Something went wrong! Cannot determine which TYPE II command!");
+		JWD_PRINTF(w, "%s\n", "Something went wrong! Cannot determine which TYPE II command!");
 	}
 }
 
@@ -1242,24 +2452,24 @@ void setTypeIIICommand(JWD1797* w) {
 	// READ ADDRESS
 	if(cmdID == 12) {
 		w->currentCommandName = "READ ADDRESS";
-		printf("%s command in WD1797 command register\n", w->currentCommandName);
+		JWD_PRINTF(w, "%s command in WD1797 command register\n", w->currentCommandName);
 		w->IDAM_byte_count = 0;	// count to collect IDAM bytes
 	}
 	// READ TRACK
 	else if(cmdID == 14) {
 		w->currentCommandName = "READ TRACK";
-		printf("%s command in WD1797 command register\n", w->currentCommandName);
+		JWD_PRINTF(w, "%s command in WD1797 command register\n", w->currentCommandName);
 		w->start_track_read_ = 0;
 		w->read_track_bytes_read = 0;
 	}
 	// WRITE TRACK
 	else if(cmdID == 15) {
 		w->currentCommandName = "WRITE TRACK";
-		printf("%s command in WD1797 command register\n", w->currentCommandName);
+		JWD_PRINTF(w, "%s command in WD1797 command register\n", w->currentCommandName);
 	}
 	// check error
 	else {
-		printf("%s\n", "Something went wrong! Cannot determine which TYPE III command!");
+		JWD_PRINTF(w, "%s\n", "Something went wrong! Cannot determine which TYPE III command!");
 	}
 }
 
@@ -1280,8 +2490,8 @@ void printBusyMsg() {
 
 void updateTG43Signal(JWD1797* w) {
 	// update TG43 signal
-	if(w->current_track > 43) {w->tg43_pin = 1;}
-	else if(w->current_track <= 43) {w->tg43_pin = 0;}
+	if(w->current_track > w->format->tg43_track) {w->tg43_pin = 1;}
+	else {w->tg43_pin = 0;}
 }
 
 /* helper function to compute CRC */
@@ -1356,29 +2566,131 @@ void printCommandFlags(JWD1797* w) {
 	}
 }
 
-void handleIndexPulse(JWD1797* w, double time) {
-	// printf("%f\n", w->index_pulse_timer);
-	// printf("%d\n", w->track_start_signal_);
-	// beginning of track encountered and IP timer has not been set
-	if(w->track_start_signal_ == 1) {
-		w->track_start_signal_ = 0;
-		w->index_pulse_pin = 1;
-		w->index_pulse_timer = INDEX_HOLE_PULSE_US;
-	}
-	// only decrement index pulse timer if index pulse is high (1)
+void handleIndexPulse(JWD1797* w) {
+	// start of track edge has been seen by the IP interrupt check - consume it
+	w->track_start_signal_ = 0;
+	/* the index hole is under the sensor for INDEX_HOLE_PULSE_US after the first
+		byte of the track starts - derive the pin from the rotational phase */
+	w->index_pulse_pin = getJWD1797IndexPulse(w, w->emulated_time_ns);
 	if(w->index_pulse_pin) {
-		w->index_pulse_timer -= time;
+		// time left on the index pulse (microseconds)
+		w->index_pulse_timer = INDEX_HOLE_PULSE_US -
+			(getJWD1797RotationalPhase(w, w->emulated_time_ns) / 1000.0);
 		// set IP status if TYPE I command is active
 		if(w->currentCommandType == 1) {w->statusRegister |= 0b00000010;}
 	}
-	if(w->index_pulse_timer <= 0.0) {
-		w->index_pulse_pin = 0;
+	else {
+		w->index_pulse_timer = 0.0;
 		// clear IP status if TYPE I command is active
 		if(w->currentCommandType == 1) {w->statusRegister &= 0b11111101;}
-		// reset index pulse timer
 	}
 }
 
+/* number of whole rotational bytes that have passed under the head at time
+	t_ns, counted from the start of the track that was under the head at t0 */
+unsigned long long getJWD1797BytesPassed(JWD1797* w, unsigned long long t_ns) {
+	return w->rotational_byte_origin +
+		(t_ns - w->rotation_t0_ns) / w->rotational_byte_read_limit;
+}
+
+// rotational byte under the READ/WRITE head at time t_ns - O(1)
+unsigned long getJWD1797RotationalByte(JWD1797* w, unsigned long long t_ns) {
+	return getJWD1797BytesPassed(w, t_ns) % w->actual_num_track_bytes;
+}
+
+// number of index holes that have passed the sensor between t0 and t_ns
+unsigned long long getJWD1797Revolutions(JWD1797* w, unsigned long long t_ns) {
+	return getJWD1797BytesPassed(w, t_ns) / w->actual_num_track_bytes;
+}
+
+// nanoseconds since the start of the current revolution at time t_ns
+unsigned long long getJWD1797RotationalPhase(JWD1797* w, unsigned long long t_ns) {
+	return (getJWD1797RotationalByte(w, t_ns) * w->rotational_byte_read_limit)
+		+ ((t_ns - w->rotation_t0_ns) % w->rotational_byte_read_limit);
+}
+
+// returns 1 if the index hole is under the sensor at time t_ns, 0 otherwise
+int getJWD1797IndexPulse(JWD1797* w, unsigned long long t_ns) {
+	return getJWD1797RotationalPhase(w, t_ns) <
+		(unsigned long long)(INDEX_HOLE_PULSE_US*1000);
+}
+
+/* first time after t_ns (NANOSECONDS) at which the index pulse pin changes -
+	the end of the pulse or the start of the next one */
+unsigned long long getJWD1797NextIndexEdge(JWD1797* w, unsigned long long t_ns) {
+	unsigned long long phase_ns = getJWD1797RotationalPhase(w, t_ns);
+	unsigned long long pulse_ns = (unsigned long long)(INDEX_HOLE_PULSE_US*1000);
+	if(phase_ns < pulse_ns) {return t_ns + (pulse_ns - phase_ns);}
+	return t_ns + ((unsigned long long)w->actual_num_track_bytes *
+		w->rotational_byte_read_limit - phase_ns);
+}
+
+// emulated time (NANOSECONDS) at which absolute byte (bytes passed) starts
+unsigned long long getJWD1797ByteStartTime(JWD1797* w, unsigned long long byte) {
+	return w->rotation_t0_ns +
+		(byte - w->rotational_byte_origin) * w->rotational_byte_read_limit;
+}
+
+/* finds the next ID field on the track under the head that a byte level ID
+	search starting at absolute byte first_byte would accept - its ID matches
+	the track register, the sector register and the side (U flag). Returns n
+	(the n-th sector on the track) and the absolute byte of its ID address mark
+	through id_am_byte, or -1 if there is no such sector on the track. */
+int findJWD1797NextSector(JWD1797* w, unsigned long long first_byte,
+	unsigned long long* id_am_byte) {
+	if(w->active_track < 0) {return -1;}
+	const unsigned int* offsets;
+	JWD1797TrackDescriptor* t = getJWD1797TrackLayout(w, w->active_track, &offsets);
+	unsigned long long track_bytes = w->actual_num_track_bytes;
+	unsigned long long revolution_start = first_byte - (first_byte % track_bytes);
+	int found = -1;
+	for(int n = 0; n < t->num_sectors; n++) {
+		if(t->id_cylinders[n] != w->trackRegister ||
+			t->sector_ids[n] != w->sectorRegister || t->id_heads[n] != w->updateSSO) {
+			continue;
+		}
+		// the search must see the SYNC and prefix bytes in front of the mark
+		unsigned long long am = revolution_start + offsets[n];
+		if(am < first_byte + ID_AM_SEARCH_BYTES) {am += track_bytes;}
+		if(found < 0 || am < *id_am_byte) {
+			found = n;
+			*id_am_byte = am;
+		}
+	}
+	return found;
+}
+
+/* brings the rotational byte pointer up to date with w->emulated_time_ns.
+	Any amount of time may have passed since the last call; index holes that
+	passed in between still clock the HLD idle and verify index counters. */
+void updateRotationalPosition(JWD1797* w) {
+	unsigned long long bytes_passed =
+		getJWD1797BytesPassed(w, w->emulated_time_ns);
+	unsigned long long revolutions = bytes_passed / w->actual_num_track_bytes;
+	unsigned long byte_pointer = bytes_passed % w->actual_num_track_bytes;
+	// a new rotational byte has come under the head
+	if(byte_pointer != w->rotational_byte_pointer ||
+		revolutions != w->revolution_count) {
+		w->new_byte_read_signal_ = 1;
+	}
+	// one or more index holes passed - signal the start of the track
+	if(revolutions > w->revolution_count) {
+		unsigned long long index_holes = revolutions - w->revolution_count;
+		w->track_start_signal_ = 1;
+		// command execution idle - clock HLD idle index counter
+		if((w->statusRegister & 1) == 0) {w->HLD_idle_index_count += index_holes;}
+		else {w->HLD_idle_index_count = 0;}
+		// clock verify timeout counter
+		if(w->verify_operation_active) {w->verify_index_count += index_holes;}
+		else {w->verify_index_count = 0;}
+	}
+	w->revolution_count = revolutions;
+	w->rotational_byte_pointer = byte_pointer;
+	// head moved to another track (step or side select)?
+	int track_index = getJWD1797TrackIndex(w);
+	if(track_index != w->active_track) {selectJWD1797Track(w, track_index);}
+}
+
 void handleHLDIdle(JWD1797* w) {
 	// check to see if HLD must be reset because of idle
 	if(w->HLD_idle_index_count >= HLD_IDLE_INDEX_COUNT_LIMIT) {
@@ -1410,33 +2722,49 @@ void updateControlStatus(JWD1797* w) {
 	w->controlStatus = (w->intrq & 1) | ((0x01 & 1) << 1) | ((w->drq & 1) << 7);
 }
 
-// http://www.cplusplus.com/reference/cstdio/fread/
+/* http://www.cplusplus.com/reference/cstdio/fread/
+	the caller frees the array */
 unsigned char* diskImageToCharArray(char* fileName, JWD1797* w) {
+	return readDiskImageFile(fileName, &w->disk_img_file_size, w->verbose, NULL);
+}
+
+/* reads a whole disk image payload file into a new array in arena (NULL: a
+	malloc()ed array the caller frees). The file size in bytes is returned
+	through file_size. Returns NULL on failure. */
+unsigned char* readDiskImageFile(char* fileName, long* file_size, int verbose,
+	JWD1797Arena* arena) {
 
 	FILE* disk_img;
-	unsigned long diskFileSize;
 	size_t check_result;
 	unsigned char* diskFileArray;
   // open current file (disk in drive)
   disk_img = fopen(fileName, "rb");
 	if(disk_img == NULL) {
 		printf("%s\n", "Error opening file with 'fopen'...");
+		*file_size = 0;
+		return NULL;
 	}
 
 	// obtain disk image file size in bytes
 	fseek(disk_img, 0, SEEK_END);
-	w->disk_img_file_size = ftell(disk_img);
+	*file_size = ftell(disk_img);
 	rewind(disk_img);
 
 	// allocate memory to handle array for entire disk image
-	diskFileArray = (unsigned char*) malloc(sizeof(char) * w->disk_img_file_size);
+	diskFileArray = arena != NULL ?
+		(unsigned char*)allocJWD1797Arena(arena, *file_size) :
+		(unsigned char*)malloc(*file_size);
+	if(diskFileArray == NULL) {
+		fclose(disk_img);
+		return NULL;
+	}
 	/* copy disk image file into array buffer
 		("check_result" variable makes sure all expected bytes are copied) */
-	check_result = fread(diskFileArray, 1, w->disk_img_file_size, disk_img);
-	if(check_result != w->disk_img_file_size) {
+	check_result = fread(diskFileArray, 1, *file_size, disk_img);
+	if(check_result != *file_size) {
 		printf("%s\n", "ERROR Converting disk image");
 	}
-	else {
+	else if(verbose) {
 		printf("\n%s\n", "disk image file converted to char array successfully!");
 	}
 	fclose(disk_img);
@@ -1444,214 +2772,725 @@ unsigned char* diskImageToCharArray(char* fileName, JWD1797* w) {
 	return diskFileArray;
 }
 
-/* establishes a char array (w->formattedDiskArray) that contains the (IBM)
+/* establishes a char array (img->formattedDiskArray) that contains the (IBM)
 	format bytes and the disk .img data bytes. The returned array will approximate
-	the actual bytes on a 5.25" DS/DD (double side/double density) floppy disk */
-void assembleFormattedDiskArray(JWD1797* w, char* fileName) {
+	the actual bytes on a 5.25" DS/DD (double side/double density) floppy disk.
+	The image file format is recognised by the image loaders (image_loaders.c),
+	which describe every track in img->tracks - the tracks are formatted from
+	those descriptors. */
+void assembleFormattedDiskArray(JWD1797Image* img, JWD1797Config* config) {
+	/* the image file is unchanged since its cache was written (same size,
+		mtime and inode)? Map the cached formatted disk without reading it */
+	setJWD1797ImageCachePath(img, config);
+	struct stat source;
+	if(stat(img->image_path, &source) == 0) {
+		img->disk_img_file_size = source.st_size;
+		img->source_mtime_ns = source.st_mtim.tv_sec * 1000000000LL +
+			source.st_mtim.tv_nsec;
+		img->source_inode = source.st_ino;
+		if(mapJWD1797ImageCache(img, 0)) {return;}
+	}
+	/* the payload and the loader's sector data are only needed until the disk
+		is formatted - they go in a scratch arena */
+	JWD1797Arena* scratch = newJWD1797Arena(0, 0);
+	if(scratch == NULL) {return;}
 	// first, get the payload byte data from the disk image file as an array
-	unsigned char* sectorPayloadDataBytes = diskImageToCharArray(fileName, w);
-	/* set disk attributes based on disk image file (For exmaple,
-		40 tracks/9 sectors per track/512 bytes per sector for 360k z-dos disk)
-		These are dynamically set according to the loader disk paramenter table.
-		(page 10.18 - Z100 Technical Manual – Hardware) */
-	w->num_heads = (sectorPayloadDataBytes[0x15]&1) + 1;	// 0-1
-	printf("%s%d\n", "number of sides (heads): ", w->num_heads);
-	w->sectors_per_track = sectorPayloadDataBytes[0xF];	// 1-9 (sectors start on 1)
-	printf("%s%d\n", "sectors per track: ", w->sectors_per_track);
-	w->sector_length = sectorPayloadDataBytes[0x4] | (sectorPayloadDataBytes[0x5]<<8);
-	printf("%s%d\n", "sector length (bytes): ", w->sector_length);
-	int total_sectors = sectorPayloadDataBytes[0xC] | (sectorPayloadDataBytes[0xD]<<8);
-	printf("%s%d\n", "total number of sectors on disk: ", total_sectors);
-	w->cylinders = total_sectors/w->sectors_per_track/w->num_heads;	// 0-39
-	printf("%s%d\n", "cylinders (tracks per side): ", w->cylinders);
+	unsigned char* sectorPayloadDataBytes = readDiskImageFile(img->image_path,
+		&img->disk_img_file_size, img->verbose, scratch);
+	if(sectorPayloadDataBytes == NULL) {
+		freeJWD1797Arena(scratch);
+		return;
+	}
+	/* the same payload (and geometry overrides) was formatted before? Map the
+		cached formatted disk instead of building it again */
+	img->payload_hash = hashDiskImagePayload(sectorPayloadDataBytes,
+		img->disk_img_file_size, config);
+	if(mapJWD1797ImageCache(img, 1)) {
+		freeJWD1797Arena(scratch);
+		return;
+	}
+	// find a loader for the image file format and describe its tracks
+	const JWD1797ImageLoader* loader = findJWD1797ImageLoader(sectorPayloadDataBytes,
+		img->disk_img_file_size, config);
+	long sector_data_size = 0;
+	unsigned char* sector_data = NULL;
+	if(loader != NULL) {
+		sector_data = loader->load(img, sectorPayloadDataBytes,
+			img->disk_img_file_size, config, &sector_data_size, scratch);
+	}
+	if(sector_data == NULL) {
+		printf("%s%s\n", "ERROR: unknown or damaged disk image format: ", img->image_path);
+		freeJWD1797Arena(scratch);
+		return;
+	}
+	JWD_PRINTF(img, "%s%s\n", "disk image format: ", loader->name);
+	JWD_PRINTF(img, "%s%d\n", "number of sides (heads): ", img->num_heads);
+	JWD_PRINTF(img, "%s%d\n", "sectors per track: ", img->sectors_per_track);
+	JWD_PRINTF(img, "%s%d\n", "sector length (bytes): ", img->sector_length);
+	JWD_PRINTF(img, "%s%d\n", "cylinders (tracks per side): ", img->cylinders);
+	// the disk format gives the gaps and the rotational timing of the tracks
+	img->format = config->format;
+	if(img->format < JWD1797_FORMAT_DD40 || img->format > JWD1797_FORMAT_HD144) {
+		img->format = detectJWD1797Format(img);
+	}
+	const JWD1797FormatProfile* profile = getJWD1797FormatProfile(img->format);
+	JWD_PRINTF(img, "%s%s%s%u%s\n", "disk format: ", profile->name, " (",
+		profile->clock_mhz, " MHz clock)");
 
 	/* determine how many actual bytes (including format bytes) each track is
-		This will be used for rotational byte pointing while the disk is spinning */
-	w->actual_num_track_bytes = GAP4A_LENGTH + SYNC_LENGTH
-		+ INDEX_AM_PREFIX_LENGTH + INDEX_AM_LENGTH + GAP1_LENGTH
-		+ (w->sectors_per_track * (SYNC_LENGTH + ID_AM_PREFIX_LENGTH
-		+ ID_AM_LENGTH + CYLINDER_LENGTH + HEAD_LENGTH + SECTOR_LENGTH
-		+ SECTOR_SIZE_LENGTH + CRC_LENGTH + GAP2_LENGTH + SYNC_LENGTH
-		+ DATA_AM_PREFIX_LENGTH + DATA_AM_LENGTH + w->sector_length
-		+ CRC_LENGTH + GAP3_LENGTH)) + GAP4B_LENGTH;
-	printf("%s%d\n", "Formatted bytes per track: ", w->actual_num_track_bytes);
+		and where it starts in the formatted disk. Every track gets its own
+		length and byte time - this will be used for rotational byte pointing
+		while the disk is spinning. */
+	img->formatted_disk_size = 0;
+	for(int t = 0; t < img->num_tracks; t++) {
+		JWD1797TrackDescriptor* track = &img->tracks[t];
+		track->formatted_offset = img->formatted_disk_size;
+		track->formatted_length = getFormattedTrackLength(profile,
+			track->num_sectors, track->sector_length);
+		track->byte_time_ns = getTrackByteTime(profile, track->formatted_length);
+		img->formatted_disk_size += track->formatted_length;
+	}
+	// nominal track length and byte time (track 0)
+	img->actual_num_track_bytes = img->tracks[0].formatted_length;
+	img->rotational_byte_read_limit = img->tracks[0].byte_time_ns;
+	JWD_PRINTF(img, "%s%d\n", "Formatted bytes per track: ", img->actual_num_track_bytes);
+	JWD_PRINTF(img, "%s%d\n", "rotational byte read limit (ns): ", img->rotational_byte_read_limit);
+
+	// formatted disk belongs to the image (released by releaseJWD1797Image())
+	img->formattedDiskArray =
+		(unsigned char*)allocJWD1797Arena(img->arena, img->formatted_disk_size);
+	/* index of the ID address mark (0xFE) of every sector, as a byte offset
+		within its track */
+	img->id_am_offsets = (unsigned int*)allocJWD1797Arena(img->arena,
+		(img->num_tracks * img->sectors_per_track + 1) * sizeof(unsigned int));
+	if(img->formattedDiskArray == NULL || img->id_am_offsets == NULL) {
+		img->formattedDiskArray = NULL;
+		freeJWD1797Arena(scratch);
+		return;
+	}
 
-	/* calculate byte rotation time in ns (for a 300 rpm disk, one rotation takes
-		200,000,000 nanoseconds) */
-	unsigned long raw_rotational_byte_read_limit =
-		(unsigned long)(200000000/w->actual_num_track_bytes);
-	/* the raw rotational byte read limit is moded by 200 because the smallest
-		incoming time slice from the main Z-100 processor loop is 0.2 microseconds.
-		This is because one cycle of the 5Mhz clock speed takes 0.2 microseconds. */
-	w->rotational_byte_read_limit = raw_rotational_byte_read_limit -
-		(raw_rotational_byte_read_limit%200);
-	printf("%s%d\n", "rotational byte read limit (ns): ", w->rotational_byte_read_limit);
+	/* ** start making formatted disk array ** */
+	// for each track (cylinder by cylinder, head by head)
+	for(int t = 0; t < img->num_tracks; t++) {
+		formatJWD1797Track(img, &img->tracks[t],
+			img->formattedDiskArray + img->tracks[t].formatted_offset,
+			img->id_am_offsets + (t * img->sectors_per_track), sector_data,
+			sector_data_size);
+	}
 
-	// now, get the total amount of bytes for the entire formatted disk
-	unsigned long formatted_disk_size = (w->cylinders * w->num_heads) * w->actual_num_track_bytes;
+	// the payload has been copied into the formatted disk
+	freeJWD1797Arena(scratch);
 
-	unsigned char fDiskArray[formatted_disk_size];
-	w->formattedDiskArray = fDiskArray;
+	// next start with this payload can map the formatted disk directly
+	writeJWD1797ImageCache(img);
 
-	unsigned long formattedDiskIndexPointer = 0;
-	unsigned long sectorPayloadArrayIndexPointer = 0;
+	/* * * DEBUG * * */
+ 	// printByteArray(img->formattedDiskArray, 1500);
+}
 
-	/* ** start making formatted disk array ** */
+/* disk format profile of JWD1797_FORMAT_* format - the 40 track profile for
+	an unknown one */
+const JWD1797FormatProfile* getJWD1797FormatProfile(unsigned int format) {
+	if(format < JWD1797_FORMAT_DD40 || format > JWD1797_FORMAT_HD144) {
+		format = JWD1797_FORMAT_DD40;
+	}
+	return &jwd1797_formats[format - 1];
+}
+
+/* picks the disk format from the geometry the image loader found. Disks of up
+	to 42 cylinders keep the 40 track profile; longer disks get the profile
+	whose revolution holds their largest track. */
+unsigned int detectJWD1797Format(JWD1797Image* img) {
+	if(img->cylinders <= 42) {return JWD1797_FORMAT_DD40;}
+	unsigned int track_data = 0;
+	for(int t = 0; t < img->num_tracks; t++) {
+		unsigned int data = img->tracks[t].num_sectors * img->tracks[t].sector_length;
+		if(data > track_data) {track_data = data;}
+	}
+	if(track_data <= 10 * 512) {return JWD1797_FORMAT_DD80;}
+	return track_data <= 15 * 512 ? JWD1797_FORMAT_HD : JWD1797_FORMAT_HD144;
+}
 
-	// for each cylinder
-	for(int cyl = 0; cyl < w->cylinders; cyl++) {
+/* calculate byte rotation time in ns for a track of track_bytes formatted
+	bytes (one rotation takes 60,000,000,000 / rpm nanoseconds - 200,000,000
+	for a 300 rpm disk) */
+unsigned int getTrackByteTime(const JWD1797FormatProfile* profile,
+	unsigned int track_bytes) {
+	unsigned long raw_rotational_byte_read_limit =
+		(unsigned long)((60000000000ULL/profile->rpm)/track_bytes);
+	/* the raw rotational byte read limit is moded by 200 because the smallest
+		incoming time slice from the main Z-100 processor loop is 0.2 microseconds.
+		This is because one cycle of the 5Mhz clock speed takes 0.2 microseconds. */
+	return raw_rotational_byte_read_limit - (raw_rotational_byte_read_limit%200);
+}
 
-		// for each head
-		for(int h = 0; h < w->num_heads; h++) {
+/* formatted (IBM) length of a track with num_sectors sectors of sector_length.
+	GAP4B makes it one revolution at the data rate of the format (a fixed GAP4B
+	for fitted tracks); a track that does not fit gets the shortest GAP4B and
+	a shorter byte time. */
+unsigned int getFormattedTrackLength(const JWD1797FormatProfile* profile,
+	unsigned int num_sectors, unsigned int sector_length) {
+	unsigned int length = GAP4A_LENGTH + SYNC_LENGTH
+		+ INDEX_AM_PREFIX_LENGTH + INDEX_AM_LENGTH + GAP1_LENGTH
+		+ (num_sectors * (SYNC_LENGTH + ID_AM_PREFIX_LENGTH
+		+ ID_AM_LENGTH + CYLINDER_LENGTH + HEAD_LENGTH + SECTOR_LENGTH
+		+ SECTOR_SIZE_LENGTH + CRC_LENGTH + GAP2_LENGTH + SYNC_LENGTH
+		+ DATA_AM_PREFIX_LENGTH + DATA_AM_LENGTH + sector_length
+		+ CRC_LENGTH + profile->gap3_length));
+	if(profile->fit_track) {return length + GAP4B_LENGTH;}
+	unsigned int revolution_bytes = (unsigned int)((60ULL * profile->data_rate)
+		/ (8ULL * profile->rpm));
+	if(length + GAP4B_MIN_LENGTH > revolution_bytes) {return length + GAP4B_MIN_LENGTH;}
+	return revolution_bytes;
+}
 
-			// write GAP4A
-			for(int ct = 0; ct < GAP4A_LENGTH; ct++) {
-				// write GAP4A_BYTE
-				w->formattedDiskArray[formattedDiskIndexPointer] = GAP4A_BYTE;
+/* writes the format bytes and sector data of one track (as described by its
+	track descriptor) to track. The ID address mark offsets are recorded in
+	id_am_offsets. GAP4B fills the track up to its formatted length.
+	Sector data past the end of the loader sector data reads as 0x00. */
+void formatJWD1797Track(JWD1797Image* img, JWD1797TrackDescriptor* t,
+	unsigned char* track, unsigned int* id_am_offsets, unsigned char* sector_data,
+	long sector_data_size) {
+	unsigned long formattedDiskIndexPointer = 0;
+	unsigned long sectorPayloadArrayIndexPointer = t->data_offset;
+	int gap3_length = getJWD1797FormatProfile(img->format)->gap3_length;
+
+	// write GAP4A
+	for(int ct = 0; ct < GAP4A_LENGTH; ct++) {
+		// write GAP4A_BYTE
+		track[formattedDiskIndexPointer] = GAP4A_BYTE;
+		formattedDiskIndexPointer++;
+	}
+	// write SYNC
+	for(int ct = 0; ct < SYNC_LENGTH; ct++) {
+		track[formattedDiskIndexPointer] = SYNC_BYTE;
+		formattedDiskIndexPointer++;
+	}
+	// write IAM prefix
+	for(int ct = 0; ct < INDEX_AM_PREFIX_LENGTH; ct++) {
+		track[formattedDiskIndexPointer] = INDEX_AM_PREFIX_BYTE;
+		formattedDiskIndexPointer++;
+	}
+	// write IAM
+	track[formattedDiskIndexPointer] = INDEX_AM_BYTE;
+	formattedDiskIndexPointer++;
+	// write GAP1
+	for(int ct = 0; ct < GAP1_LENGTH; ct++) {
+		// write GAP1_BYTE
+		track[formattedDiskIndexPointer] = GAP1_BYTE;
+		formattedDiskIndexPointer++;
+	}
+
+	// for each sector (in the order they pass under the head)
+	for(int s = 0; s < t->num_sectors; s++) {
+		// write SYNC
+		for(int ct = 0; ct < SYNC_LENGTH; ct++) {
+			track[formattedDiskIndexPointer] = SYNC_BYTE;
+			formattedDiskIndexPointer++;
+		}
+		// write IDAM prefix
+		for(int ct = 0; ct < ID_AM_PREFIX_LENGTH; ct++) {
+			// write IDAM prefix byte
+			track[formattedDiskIndexPointer] = ID_AM_PREFIX_BYTE;
+			formattedDiskIndexPointer++;
+		}
+		// write IDAM byte (and record where it is in the track)
+		id_am_offsets[s] = formattedDiskIndexPointer;
+		track[formattedDiskIndexPointer] = ID_AM_BYTE;
+		formattedDiskIndexPointer++;
+		// write cylinder byte (track)
+		track[formattedDiskIndexPointer] = t->id_cylinders[s];
+		formattedDiskIndexPointer++;
+		// write head byte (side)
+		track[formattedDiskIndexPointer] = t->id_heads[s];
+		formattedDiskIndexPointer++;
+		// write sector byte
+		track[formattedDiskIndexPointer] = t->sector_ids[s];
+		formattedDiskIndexPointer++;
+		// write sector length byte
+		track[formattedDiskIndexPointer] = t->size_code;
+		formattedDiskIndexPointer++;
+		// write 2 placeholder CRC bytes (0x01 X 2)
+		for(int ct = 0; ct < CRC_LENGTH; ct++) {
+			track[formattedDiskIndexPointer] = CRC_BYTE;
+			formattedDiskIndexPointer++;
+		}
+		// write GAP2
+		for(int ct = 0; ct < GAP2_LENGTH; ct++) {
+			// write GAP2_BYTE
+			track[formattedDiskIndexPointer] = GAP2_BYTE;
+			formattedDiskIndexPointer++;
+		}
+		/* sector with an ID field only - the data field area stays gap so the
+			following sectors keep their place */
+		if(t->sector_flags[s] & JWD1797_SECTOR_NO_DATA) {
+			int data_field_length = SYNC_LENGTH + DATA_AM_PREFIX_LENGTH
+				+ DATA_AM_LENGTH + t->sector_length + CRC_LENGTH;
+			for(int ct = 0; ct < data_field_length; ct++) {
+				track[formattedDiskIndexPointer] = GAP3_BYTE;
 				formattedDiskIndexPointer++;
 			}
+			sectorPayloadArrayIndexPointer += t->sector_length;
+		}
+		else {
 			// write SYNC
 			for(int ct = 0; ct < SYNC_LENGTH; ct++) {
-				// write GAP4A_BYTE
-				w->formattedDiskArray[formattedDiskIndexPointer] = SYNC_BYTE;
+				track[formattedDiskIndexPointer] = SYNC_BYTE;
 				formattedDiskIndexPointer++;
 			}
-			// write IAM prefix
-			for(int ct = 0; ct < INDEX_AM_PREFIX_LENGTH; ct++) {
-				// write GAP4A_BYTE
-				w->formattedDiskArray[formattedDiskIndexPointer] = INDEX_AM_PREFIX_BYTE;
+			// write DATA AM prefix
+			for(int ct = 0; ct < DATA_AM_PREFIX_LENGTH; ct++) {
+				// write DATA AM prefix byte
+				track[formattedDiskIndexPointer] = DATA_AM_PREFIX_BYTE;
 				formattedDiskIndexPointer++;
 			}
-			// write IAM
-			w->formattedDiskArray[formattedDiskIndexPointer] = INDEX_AM_BYTE;
+			// write DATA AM byte (deleted data mark 0xF8 for deleted sectors)
+			track[formattedDiskIndexPointer] =
+				(t->sector_flags[s] & JWD1797_SECTOR_DELETED) ? DELETED_DATA_AM_BYTE : DATA_AM_BYTE;
 			formattedDiskIndexPointer++;
-			// write GAP1
-			for(int ct = 0; ct < GAP1_LENGTH; ct++) {
-				// write GAP1_BYTE
-				w->formattedDiskArray[formattedDiskIndexPointer] = GAP1_BYTE;
+			// write the data payload
+			for(int ct = 0; ct < t->sector_length; ct++) {
+				track[formattedDiskIndexPointer] =
+					sectorPayloadArrayIndexPointer < sector_data_size ?
+					sector_data[sectorPayloadArrayIndexPointer] : 0x00;
 				formattedDiskIndexPointer++;
+				sectorPayloadArrayIndexPointer++;
 			}
-
-			// for each sector
-			for(int s = 1; s < w->sectors_per_track + 1; s++) {
-				// write SYNC
-				for(int ct = 0; ct < SYNC_LENGTH; ct++) {
-					// write SYNC
-					w->formattedDiskArray[formattedDiskIndexPointer] = SYNC_BYTE;
-					formattedDiskIndexPointer++;
-				}
-				// write IDAM prefix
-				for(int ct = 0; ct < ID_AM_PREFIX_LENGTH; ct++) {
-					// write IDAM prefix byte
-					w->formattedDiskArray[formattedDiskIndexPointer] = ID_AM_PREFIX_BYTE;
-					formattedDiskIndexPointer++;
-				}
-				// write IDAM byte
-				w->formattedDiskArray[formattedDiskIndexPointer] = ID_AM_BYTE;
+			// write 2 placeholder CRC bytes (0x01 X 2)
+			for(int ct = 0; ct < CRC_LENGTH; ct++) {
+				track[formattedDiskIndexPointer] = CRC_BYTE;
 				formattedDiskIndexPointer++;
-				// write cylinder byte (track)
-				w->formattedDiskArray[formattedDiskIndexPointer] = cyl;
-				formattedDiskIndexPointer++;
-				// write head byte (side)
-				w->formattedDiskArray[formattedDiskIndexPointer] = h;
-				formattedDiskIndexPointer++;
-				// write sector byte
-				w->formattedDiskArray[formattedDiskIndexPointer] = s;
-				formattedDiskIndexPointer++;
-				// write sector length byte
-				int s_length_byte = 0x00;
-				switch (w->sector_length) {
-					case 128:
-						s_length_byte = 0x00;
-						break;
-					case 256:
-						s_length_byte = 0x01;
-						break;
-					case 512:
-						s_length_byte = 0x02;
-						break;
-					case 1024:
-						s_length_byte = 0x03;
-						break;
-					default:
-						printf("%s\n", "ERROR: Non-standard sector length!");
-				}
-				w->formattedDiskArray[formattedDiskIndexPointer] = s_length_byte;
-				formattedDiskIndexPointer++;
-				// write 2 placeholder CRC bytes (0x01 X 2)
-				for(int ct = 0; ct < CRC_LENGTH; ct++) {
-					w->formattedDiskArray[formattedDiskIndexPointer] = CRC_BYTE;
-					formattedDiskIndexPointer++;
-				}
-				// write GAP2
-				for(int ct = 0; ct < GAP2_LENGTH; ct++) {
-					// write GAP2_BYTE
-					w->formattedDiskArray[formattedDiskIndexPointer] = GAP2_BYTE;
-					formattedDiskIndexPointer++;
-				}
-				// write SYNC
-				for(int ct = 0; ct < SYNC_LENGTH; ct++) {
-					// write GAP4A_BYTE
-					w->formattedDiskArray[formattedDiskIndexPointer] = SYNC_BYTE;
-					formattedDiskIndexPointer++;
-				}
-				// write DATA AM prefix
-				for(int ct = 0; ct < DATA_AM_PREFIX_LENGTH; ct++) {
-					// write DATA AM prefix byte
-					w->formattedDiskArray[formattedDiskIndexPointer] = DATA_AM_PREFIX_BYTE;
-					formattedDiskIndexPointer++;
-				}
-				// write DATA AM byte
-				w->formattedDiskArray[formattedDiskIndexPointer] = DATA_AM_BYTE;
-				formattedDiskIndexPointer++;
-				// write the data payload
-				for(int ct = 0; ct < w->sector_length; ct++) {
-					w->formattedDiskArray[formattedDiskIndexPointer] =
-						sectorPayloadDataBytes[sectorPayloadArrayIndexPointer];
-					formattedDiskIndexPointer++;
-					sectorPayloadArrayIndexPointer++;
-				}
-				// write 2 placeholder CRC bytes (0x01 X 2)
-				for(int ct = 0; ct < CRC_LENGTH; ct++) {
-					w->formattedDiskArray[formattedDiskIndexPointer] = CRC_BYTE;
-					formattedDiskIndexPointer++;
-				}
-				// write GAP3
-				for(int ct = 0; ct < GAP3_LENGTH; ct++) {
-					// write GAP3_BYTE
-					w->formattedDiskArray[formattedDiskIndexPointer] = GAP3_BYTE;
-					formattedDiskIndexPointer++;
-				}
+			}
+		}
+		// write GAP3
+		for(int ct = 0; ct < gap3_length; ct++) {
+			// write GAP3_BYTE
+			track[formattedDiskIndexPointer] = GAP3_BYTE;
+			formattedDiskIndexPointer++;
+		}
 
-			}	// END SECTOR LOOP
+	}	// END SECTOR LOOP
 
-			// write GAP 4B
-			for(int ct = 0; ct < GAP4B_LENGTH; ct++) {
-				// write GAP4B_BYTE
-				w->formattedDiskArray[formattedDiskIndexPointer] = GAP4B_BYTE;
-				formattedDiskIndexPointer++;
-			}
+	// write GAP 4B (to the end of the track)
+	while(formattedDiskIndexPointer < t->formatted_length) {
+		// write GAP4B_BYTE
+		track[formattedDiskIndexPointer] = GAP4B_BYTE;
+		formattedDiskIndexPointer++;
+	}
+}
+
+/* builds the layout index of a formatted track from its bytes. The address
+	mark scanner finds every mark in one pass; each ID field becomes a sector
+	of track descriptor t (in the order they pass under the head, at most
+	max_sectors) and its ID address mark offset goes to id_am_offsets. The data
+	field must follow its ID field where the formatter puts it
+	(ID_AM_TO_DATA_LENGTH after the ID mark) - otherwise the sector is marked as
+	having no data field. Marks inside a data field are payload and are
+	skipped. Returns the number of sectors found. */
+int indexJWD1797Track(const unsigned char* track, unsigned int length,
+	JWD1797TrackDescriptor* t, unsigned int* id_am_offsets,
+	unsigned int max_sectors) {
+	unsigned int marks[4 * JWD1797_MAX_SECTORS_PER_TRACK];
+	unsigned int num_marks = scanAddressMarks(track, length, 0, marks,
+		4 * JWD1797_MAX_SECTORS_PER_TRACK);
+	if(max_sectors > JWD1797_MAX_SECTORS_PER_TRACK) {
+		max_sectors = JWD1797_MAX_SECTORS_PER_TRACK;
+	}
+	unsigned int n = 0;
+	unsigned int data_end = 0;
+	for(unsigned int m = 0; m < num_marks && n < max_sectors; m++) {
+		unsigned int o = marks[m];
+		// data AM without an ID field, payload bytes or a cut off ID field
+		if(track[o] != ID_AM_BYTE || o < data_end ||
+			o + ID_AM_TO_DATA_LENGTH >= length) {continue;}
+		id_am_offsets[n] = o;
+		t->id_cylinders[n] = track[o + 1];
+		t->id_heads[n] = track[o + 2];
+		t->sector_ids[n] = track[o + 3];
+		if(n == 0) {
+			t->size_code = track[o + 4];
+			t->sector_length = 128 << (track[o + 4] & 3);
+		}
+		t->sector_flags[n] = JWD1797_SECTOR_NO_DATA;
+		unsigned int data_am = o + ID_AM_TO_DATA_LENGTH - DATA_AM_LENGTH;
+		if(m + 1 < num_marks && marks[m + 1] == data_am &&
+			data_am + DATA_AM_LENGTH + t->sector_length <= length) {
+			t->sector_flags[n] = track[data_am] == DELETED_DATA_AM_BYTE ? JWD1797_SECTOR_DELETED : 0;
+			data_end = data_am + DATA_AM_LENGTH + t->sector_length;
+			m++;
+		}
+		n++;
+	}
+	t->num_sectors = n;
+	return n;
+}
 
-		}	// END HEAD LOOP
+/* checks a formatted track the way the controller parses it. Every ID field
+	the layout index finds is checked against the ID verification of the TYPE
+	II commands: a known length code (getJWD1797SectorLength()) and CRC bytes
+	isJWD1797CRCValid() accepts, then a data field where
+	dataAddressMarkSearch() finds it, with valid CRC bytes after the data.
+	The IDs must match the track descriptor expected (the one the image loader
+	made) in order, no sector number may repeat, every sector of the
+	descriptor must be found and only its ID field only sectors may lack a
+	data field. The counts go to r; returns the number of
+	errors. */
+int verifyJWD1797Track(const unsigned char* track, unsigned int length,
+	const JWD1797TrackDescriptor* expected, JWD1797TrackReport* r) {
+	JWD1797TrackDescriptor t;
+	unsigned int id_am_offsets[JWD1797_MAX_SECTORS_PER_TRACK];
+	unsigned char seen[256];
+	memset(r, 0, sizeof(JWD1797TrackReport));
+	memset(seen, 0, sizeof(seen));
+	r->sectors = indexJWD1797Track(track, length, &t, id_am_offsets,
+		JWD1797_MAX_SECTORS_PER_TRACK);
+	for(unsigned int n = 0; n < r->sectors; n++) {
+		const unsigned char* id = track + id_am_offsets[n] + ID_AM_LENGTH;
+		// cylinder, head, sector, length code, CRC1, CRC2
+		if(n >= expected->num_sectors || id[0] != expected->id_cylinders[n] ||
+			id[1] != expected->id_heads[n] || id[2] != expected->sector_ids[n] ||
+			id[3] != expected->size_code) {r->bad_id++;}
+		if(id[0] != expected->cylinder || id[1] != expected->head) {r->foreign++;}
+		if(seen[id[2]]++) {r->duplicates++;}
+		if(!isJWD1797CRCValid(id + 4)) {r->bad_id_crc++;}
+		int sector_length = getJWD1797SectorLength(id[3]);
+		if(sector_length == 0) {
+			r->bad_length++;
+			continue;
+		}
+		if(t.sector_flags[n] & JWD1797_SECTOR_NO_DATA) {
+			// an ID field only sector of the source image is recorded that way
+			if(n >= expected->num_sectors ||
+				!(expected->sector_flags[n] & JWD1797_SECTOR_NO_DATA)) {r->no_data++;}
+			continue;
+		}
+		if(t.sector_flags[n] & JWD1797_SECTOR_DELETED) {r->deleted++;}
+		unsigned int crc = id_am_offsets[n] + ID_AM_TO_DATA_LENGTH + sector_length;
+		if(crc + CRC_LENGTH > length || !isJWD1797CRCValid(track + crc)) {
+			r->bad_data_crc++;
+		}
+	}
+	for(unsigned int n = 0; n < expected->num_sectors; n++) {
+		if(!seen[expected->sector_ids[n]]) {r->missing++;}
+	}
+	r->errors = r->missing + r->bad_id + r->bad_length + r->bad_id_crc +
+		r->bad_data_crc + r->no_data + r->duplicates;
+	return r->errors;
+}
 
-	} // END CYLINDER LOOP
+/* 64-bit FNV-1a hash of the cache format version and the options that change
+	the formatted disk (geometry overrides, interleave, skew, format) */
+unsigned long long hashJWD1797CacheKey(JWD1797Config* config) {
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	unsigned int key[8] = {IMAGE_CACHE_VERSION, config->cylinders,
+		config->num_heads, config->sectors_per_track, config->sector_length,
+		config->interleave > 1 ? config->interleave : 1, config->skew,
+		config->format};
+	unsigned char* key_bytes = (unsigned char*)key;
+	for(unsigned long i = 0; i < sizeof(key); i++) {
+		hash = (hash ^ key_bytes[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
 
-	/* * * DEBUG * * */
- 	// printByteArray(w->formattedDiskArray, 1500);
+/* 64-bit FNV-1a hash of the disk image payload. The cache key is hashed in
+	first (see hashJWD1797CacheKey()) - each option changes the formatted disk. */
+unsigned long long hashDiskImagePayload(unsigned char* payload, long size,
+	JWD1797Config* config) {
+	unsigned long long hash = hashJWD1797CacheKey(config);
+	for(long i = 0; i < size; i++) {
+		hash = (hash ^ payload[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/* sets the cache file of an image - <dir>/<image file name>.<key>.jwdfmt,
+	dir being config->cache_dir or the directory of the image, key the low
+	32 bits of the cache key hash. Images loaded with other options get caches
+	of their own. NULL if config->no_cache is set. */
+void setJWD1797ImageCachePath(JWD1797Image* img, JWD1797Config* config) {
+	img->cache_path = NULL;
+	if(config->no_cache) {return;}
+	const char* name = img->image_path;
+	int dir_length = 0;
+	if(config->cache_dir != NULL) {
+		const char* slash = strrchr(img->image_path, '/');
+		if(slash != NULL) {name = slash + 1;}
+		dir_length = strlen(config->cache_dir) + 1;
+	}
+	img->cache_path = (char*)allocJWD1797Arena(img->arena,
+		dir_length + strlen(name) + 10 + strlen(IMAGE_CACHE_SUFFIX) + 1);
+	if(img->cache_path == NULL) {return;}
+	if(config->cache_dir != NULL) {
+		sprintf(img->cache_path, "%s/", config->cache_dir);
+	}
+	sprintf(img->cache_path + dir_length, "%s.%08x%s", name,
+		(unsigned int)hashJWD1797CacheKey(config), IMAGE_CACHE_SUFFIX);
+}
+
+// cache file name of an image (caller frees) - NULL if it has no cache
+char* getJWD1797ImageCachePath(JWD1797Image* img) {
+	if(img->cache_path == NULL) {return NULL;}
+	char* path = (char*)malloc(strlen(img->cache_path) + 1);
+	strcpy(path, img->cache_path);
+	return path;
+}
+
+/* maps the sidecar cache of an image read-only. The formatted disk and the
+	address mark index point straight into the mapping, so pages are only read
+	from the file when the disk is accessed. With check_payload 0 the cache
+	must have been built from an image file of the same size, mtime and inode
+	(img->disk_img_file_size, source_mtime_ns, source_inode) - a file modified
+	within IMAGE_CACHE_RACY_NS of the cache write is not trusted that way. With
+	check_payload 1 it must match img->payload_hash, and is written again with
+	the new file stamp if that is out of date. Returns 1 if a cache was mapped,
+	0 otherwise (missing, stale or damaged). */
+int mapJWD1797ImageCache(JWD1797Image* img, int check_payload) {
+	if(img->cache_path == NULL) {return 0;}
+	int fd = open(img->cache_path, O_RDONLY);
+	if(fd < 0) {return 0;}
+	struct stat st;
+	if(fstat(fd, &st) != 0 ||
+		st.st_size < (off_t)sizeof(JWD1797ImageCacheHeader)) {
+		close(fd);
+		return 0;
+	}
+	long long cache_mtime_ns = st.st_mtim.tv_sec * 1000000000LL +
+		st.st_mtim.tv_nsec;
+	unsigned long long cache_size = st.st_size;
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {return 0;}
+
+	JWD1797ImageCacheHeader* header = (JWD1797ImageCacheHeader*)map;
+	unsigned long long index_size = sizeof(unsigned int) *
+		header->num_tracks * header->sectors_per_track;
+	unsigned long long track_table_size = sizeof(JWD1797TrackDescriptor) *
+		(unsigned long long)header->num_tracks;
+	int stamped = header->source_mtime_ns == img->source_mtime_ns &&
+		header->source_inode == img->source_inode &&
+		header->source_mtime_ns + IMAGE_CACHE_RACY_NS <= cache_mtime_ns;
+	if(memcmp(header->magic, IMAGE_CACHE_MAGIC, 8) != 0 ||
+		header->version != IMAGE_CACHE_VERSION ||
+		(check_payload ? header->payload_hash != img->payload_hash : !stamped) ||
+		header->disk_img_file_size != img->disk_img_file_size ||
+		header->id_am_index_offset + index_size > cache_size ||
+		header->track_table_offset + track_table_size > cache_size ||
+		header->formatted_disk_offset + header->formatted_disk_size > cache_size) {
+		munmap(map, st.st_size);
+		return 0;
+	}
+	img->payload_hash = header->payload_hash;
+	img->cylinders = header->cylinders;
+	img->num_heads = header->num_heads;
+	img->sectors_per_track = header->sectors_per_track;
+	img->sector_length = header->sector_length;
+	img->format = header->format;
+	img->actual_num_track_bytes = header->actual_num_track_bytes;
+	img->rotational_byte_read_limit = header->rotational_byte_read_limit;
+	img->formattedDiskArray = (unsigned char*)map + header->formatted_disk_offset;
+	img->formatted_disk_size = header->formatted_disk_size;
+	img->id_am_offsets = (unsigned int*)((unsigned char*)map + header->id_am_index_offset);
+	img->num_tracks = header->num_tracks;
+	img->tracks = (JWD1797TrackDescriptor*)((unsigned char*)map + header->track_table_offset);
+	img->cache_map = map;
+	img->cache_map_size = st.st_size;
+	JWD_PRINTF(img, "%s%s\n", "formatted disk mapped from cache: ", img->image_path);
+	// the next start maps it without reading the image file
+	if(check_payload && !stamped) {writeJWD1797ImageCache(img);}
+	return 1;
+}
+
+/* writes the formatted disk, the address mark index and the geometry to the
+	sidecar cache. The file is written under a temporary name of its own
+	(mkstemp()) and renamed into place, so other processes and threads loading
+	the same image never map a half-written cache. A cache that can not be
+	written (read-only directory...) is simply skipped. */
+void writeJWD1797ImageCache(JWD1797Image* img) {
+	if(img->cache_path == NULL) {return;}
+	JWD1797ImageCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IMAGE_CACHE_MAGIC, 8);
+	header.version = IMAGE_CACHE_VERSION;
+	header.payload_hash = img->payload_hash;
+	header.disk_img_file_size = img->disk_img_file_size;
+	header.source_mtime_ns = img->source_mtime_ns;
+	header.source_inode = img->source_inode;
+	header.cylinders = img->cylinders;
+	header.num_heads = img->num_heads;
+	header.sectors_per_track = img->sectors_per_track;
+	header.sector_length = img->sector_length;
+	header.format = img->format;
+	header.actual_num_track_bytes = img->actual_num_track_bytes;
+	header.rotational_byte_read_limit = img->rotational_byte_read_limit;
+	header.num_tracks = img->num_tracks;
+	header.formatted_disk_offset = sizeof(header);
+	header.formatted_disk_size = img->formatted_disk_size;
+	// keep the index 8-byte aligned inside the mapping
+	header.id_am_index_offset =
+		(header.formatted_disk_offset + header.formatted_disk_size + 7) & ~7ULL;
+	unsigned long long index_size = sizeof(unsigned int) *
+		img->num_tracks * img->sectors_per_track;
+	unsigned long long padding = header.id_am_index_offset -
+		(header.formatted_disk_offset + header.formatted_disk_size);
+	// the track table follows the index, also 8-byte aligned
+	header.track_table_offset = (header.id_am_index_offset + index_size + 7) & ~7ULL;
+	unsigned long long index_padding = header.track_table_offset -
+		(header.id_am_index_offset + index_size);
+	unsigned long long track_table_size =
+		sizeof(JWD1797TrackDescriptor) * (unsigned long long)img->num_tracks;
+	unsigned char zeros[8] = {0};
+
+	char* path = img->cache_path;
+	char* tmp_path = (char*)malloc(strlen(path) + 32);
+	sprintf(tmp_path, "%s.XXXXXX", path);
+	int fd = mkstemp(tmp_path);
+	FILE* f = NULL;
+	if(fd >= 0) {
+		// mkstemp() creates the file for its owner only
+		fchmod(fd, 0644);
+		f = fdopen(fd, "wb");
+		if(f == NULL) {close(fd);}
+	}
+	int ok = f != NULL;
+	if(ok) {
+		ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+			fwrite(img->formattedDiskArray, 1, header.formatted_disk_size, f) ==
+			header.formatted_disk_size &&
+			fwrite(zeros, 1, padding, f) == padding &&
+			fwrite(img->id_am_offsets, 1, index_size, f) == index_size &&
+			fwrite(zeros, 1, index_padding, f) == index_padding &&
+			fwrite(img->tracks, 1, track_table_size, f) == track_table_size;
+		ok = (fclose(f) == 0) && ok;
+	}
+	if(ok) {ok = rename(tmp_path, path) == 0;}
+	if(!ok) {
+		if(fd >= 0) {remove(tmp_path);}
+		JWD_PRINTF(img, "%s%s\n", "could not write formatted disk cache: ", path);
+	}
+	free(tmp_path);
 }
 
 /* returns the actual byte on the formatted disk (formatted disk array)
 	based on the rotational byte position, actual track (w->current_track),
 	and side select/head (w->sso_pin) */
 unsigned char getFDiskByte(JWD1797* w) {
-	// advance 2 tracks worth of formatted bytes for each cylinder (track)
-	long r_byte_pt = w->current_track * (w->actual_num_track_bytes * 2);
-	// what head (side)? Head == 1? Add 1 formatted track's worth of bytes
-	r_byte_pt += w->actual_num_track_bytes * w->sso_pin;
-	// now add where the head is located in the rotation
-	r_byte_pt += w->rotational_byte_pointer;
+	int track_index = getJWD1797TrackIndex(w);
+	if(track_index != w->active_track) {selectJWD1797Track(w, track_index);}
+	// no track under the head - nothing to read
+	if(w->active_track_data == NULL) {return 0x00;}
+	return w->active_track_data[w->rotational_byte_pointer];
+}
+
+/* returns n - the n-th sector on the track at cyl/head (physical position)
+	whose ID field carries sector number sector. -1 if there is no such track
+	or sector. */
+int findJWD1797Sector(JWD1797* w, int cyl, int head, int sector) {
+	if(w->image == NULL || cyl < 0 || cyl >= w->cylinders || head < 0 ||
+		head >= w->num_heads) {return -1;}
+	const unsigned int* offsets;
+	JWD1797TrackDescriptor* t =
+		getJWD1797TrackLayout(w, (cyl * w->num_heads) + head, &offsets);
+	for(int n = 0; n < t->num_sectors; n++) {
+		if(t->sector_ids[n] == sector) {return n;}
+	}
+	return -1;
+}
+
+/* returns a pointer straight to the data of a sector in the formatted disk
+	(or in the controller's overlay if the track was written) - no emulated
+	timing and no copy. The sector length is returned through len. cyl/head
+	are the physical position, sector the ID field sector number. NULL if the
+	sector does not exist or has no data field. The pointer stays valid until
+	the track is written (copied to the overlay) or the disk is unmounted. */
+const unsigned char* getJWD1797SectorPtr(JWD1797* w, int cyl, int head,
+	int sector, unsigned int* len) {
+	int n = findJWD1797Sector(w, cyl, head, sector);
+	if(n < 0) {return NULL;}
+	int track_index = (cyl * w->num_heads) + head;
+	const unsigned int* offsets;
+	JWD1797TrackDescriptor* t = getJWD1797TrackLayout(w, track_index, &offsets);
+	if(t->sector_flags[n] & JWD1797_SECTOR_NO_DATA) {return NULL;}
+	const unsigned char* track = w->overlay_tracks[track_index] != NULL ?
+		w->overlay_tracks[track_index] : w->formattedDiskArray + t->formatted_offset;
+	if(len != NULL) {*len = t->sector_length;}
+	return track + offsets[n] + ID_AM_TO_DATA_LENGTH;
+}
+
+/* writable version of getJWD1797SectorPtr(). The track is copied to the
+	controller's overlay first (the shared base image is never written) and
+	the sector is marked dirty. */
+unsigned char* getJWD1797SectorPtrForWrite(JWD1797* w, int cyl, int head,
+	int sector, unsigned int* len) {
+	int n = findJWD1797Sector(w, cyl, head, sector);
+	if(n < 0) {return NULL;}
+	int track_index = (cyl * w->num_heads) + head;
+	const unsigned int* offsets;
+	JWD1797TrackDescriptor* t = getJWD1797TrackLayout(w, track_index, &offsets);
+	if(t->sector_flags[n] & JWD1797_SECTOR_NO_DATA) {return NULL;}
+	unsigned int offset = offsets[n];
+	unsigned char* track = getFDiskTrackForWrite(w, cyl, head);
+	// only the data field is written - the layout of the track stays valid
+	w->overlay_reindex[track_index] = 0;
+	w->dirty_sectors[(track_index * w->sectors_per_track) + n] = 1;
+	if(len != NULL) {*len = t->sector_length;}
+	return track + offset + ID_AM_TO_DATA_LENGTH;
+}
+
+// returns 1 if the sector was written since the disk was mounted, 0 otherwise
+int isJWD1797SectorDirty(JWD1797* w, int cyl, int head, int sector) {
+	int n = findJWD1797Sector(w, cyl, head, sector);
+	if(n < 0) {return 0;}
+	return w->dirty_sectors[(((cyl * w->num_heads) + head) * w->sectors_per_track) + n];
+}
+
+/* track under the head - cylinder * num_heads + head. -1 for an empty drive,
+	a head past the last cylinder or side 1 of a single sided disk. */
+int getJWD1797TrackIndex(JWD1797* w) {
+	if(w->image == NULL || w->current_track >= w->cylinders ||
+		w->sso_pin >= w->num_heads) {return -1;}
+	return (w->current_track * w->num_heads) + w->sso_pin;
+}
+
+/* formatted bytes of track track_index - the overlay copy if it was written
+	- and their number through length (if not NULL) */
+const unsigned char* getJWD1797TrackData(JWD1797* w, int track_index,
+	unsigned int* length) {
+	if(length != NULL) {*length = w->image->tracks[track_index].formatted_length;}
+	if(w->overlay_tracks[track_index] != NULL) {return w->overlay_tracks[track_index];}
+	return w->formattedDiskArray + w->image->tracks[track_index].formatted_offset;
+}
 
-	return w->formattedDiskArray[r_byte_pt];
+/* makes track_index the track under the head - O(1). Its formatted bytes
+	(the overlay copy if it was written) become the active track data. If the
+	track is longer or shorter than the previous one (or has another byte
+	time), the rotational position is rebased so the disk keeps its angle:
+	the head lands on the same fraction of the revolution on the new track.
+	A track index of -1 has no data and keeps the current timing. */
+void selectJWD1797Track(JWD1797* w, int track_index) {
+	w->active_track = track_index;
+	if(track_index < 0) {
+		w->active_track_data = NULL;
+		return;
+	}
+	JWD1797TrackDescriptor* t = &w->image->tracks[track_index];
+	w->active_track_data = (unsigned char*)getJWD1797TrackData(w, track_index, NULL);
+	if(t->formatted_length != w->actual_num_track_bytes ||
+		t->byte_time_ns != w->rotational_byte_read_limit) {
+		unsigned long long now = w->emulated_time_ns;
+		unsigned long long phase_ns = getJWD1797RotationalPhase(w, now);
+		unsigned long long revolutions = getJWD1797Revolutions(w, now);
+		unsigned long long byte_pointer = phase_ns / t->byte_time_ns;
+		if(byte_pointer >= t->formatted_length) {byte_pointer = t->formatted_length - 1;}
+		// keep the part of a byte time that has already passed
+		unsigned long long into_byte_ns = phase_ns % t->byte_time_ns;
+		if(into_byte_ns > now) {into_byte_ns = now;}
+		w->actual_num_track_bytes = t->formatted_length;
+		w->rotational_byte_read_limit = t->byte_time_ns;
+		w->rotational_byte_origin = (revolutions * t->formatted_length) + byte_pointer;
+		w->rotation_t0_ns = now - into_byte_ns;
+		w->rotational_byte_pointer = byte_pointer;
+	}
 }
 
 void handleVerifyHeadSettleDelay(JWD1797* w, double us) {
@@ -1659,7 +3498,7 @@ void handleVerifyHeadSettleDelay(JWD1797* w, double us) {
 	if(!w->head_settling_done) {
 		w->verify_head_settling_timer += us;
 		// check if verify head settling is timed out
-		if(w->verify_head_settling_timer >= VERIFY_HEAD_SETTLING_LIMIT) {
+		if(w->verify_head_settling_timer >= w->format->verify_settling_us) {
 			// reset timer
 			w->verify_head_settling_timer = 0.0;
 			w->head_settling_done = 1;
@@ -1673,7 +3512,8 @@ void handleVerifyHeadSettleDelay(JWD1797* w, double us) {
 int verifyIndexTimeout(JWD1797* w, int x) {
 	// check if X index holes have passed
 	if(w->verify_index_count >= x) {
-		printf("%s\n", "VERIFY INDEX TIMED OUT!");
+		JWD_PRINTF(w, "%s\n", "VERIFY INDEX TIMED OUT!");
+		if(w->stats_type != 0) {w->stats.index_timeouts[w->stats_type - 1]++;}
 		w->verify_operation_active = 0;
 		// command is done
 		w->command_done = 1;
@@ -1724,6 +3564,7 @@ int IDAddressMarkSearch(JWD1797* w) {
 	// look for 0xFE - if so, IDAM has been found
 	if(w->id_field_found == 0 && incoming_byte == 0xFE) {
 		w->id_field_found = 1;
+		w->id_am_byte = getJWD1797BytesPassed(w, w->emulated_time_ns);
 		return 1;
 	}
 	// 4 x 0x00, 3 x 0xA1, but no 0xFE - start search from the beginning..
@@ -1753,7 +3594,7 @@ int collectIDFieldData(JWD1797* w) {
 	0 otherwise. */
 int verifyTrackID(JWD1797* w) {
 	if(w->trackRegister == w->id_field_data[0]) {
-		printf("\n%s\n\n", "TRACK VERIFIED!!");
+		JWD_PRINTF(w, "\n%s\n\n", "TRACK VERIFIED!!");
 		return 1;
 	}
 	// track ID field != track register - keep searching
@@ -1773,7 +3614,7 @@ int verifyTrackID(JWD1797* w) {
 	0 otherwise. */
 int verifySectorID(JWD1797* w) {
 	if(w->sectorRegister == w->id_field_data[2]) {
-		printf("\n%s\n\n", "SECTOR VERIFIED!!");
+		JWD_PRINTF(w, "\n%s\n\n", "SECTOR VERIFIED!!");
 		return 1;
 	}
 	else {
@@ -1792,7 +3633,7 @@ int verifySectorID(JWD1797* w) {
 	0 otherwise. */
 int verifyHeadID(JWD1797* w) {
 	if(w->updateSSO == w->id_field_data[1]) {
-		printf("\n%s\n\n", "HEAD/SIDE VERIFIED!!");
+		JWD_PRINTF(w, "\n%s\n\n", "HEAD/SIDE VERIFIED!!");
 		return 1;
 	}
 	else {
@@ -1813,8 +3654,8 @@ int verifyHeadID(JWD1797* w) {
 	CRC bytes, are 0x01. */
 int verifyCRC(JWD1797* w) {
 	// do the two CRC bytes equal the TEMP values of 0x01? (TEMP!!)
-	if(w->id_field_data[4] == 0x01 && w->id_field_data[5] == 0x01) {
-		printf("\n%s\n\n", "CRC VERIFIED!!");
+	if(isJWD1797CRCValid(w->id_field_data + 4)) {
+		JWD_PRINTF(w, "\n%s\n\n", "CRC VERIFIED!!");
 		// reset CRC error status
 		w->statusRegister &= 0b11110111;
 		w->verify_operation_active = 0;
@@ -1843,8 +3684,8 @@ int verifyCRC(JWD1797* w) {
 
 int verifyCRCTypeII(JWD1797* w) {
 	// do the two CRC bytes equal the TEMP values of 0x01? (TEMP!!)
-	if(w->id_field_data[4] == 0x01 && w->id_field_data[5] == 0x01) {
-		printf("\n%s\n\n", "CRC VERIFIED!!");
+	if(isJWD1797CRCValid(w->id_field_data + 4)) {
+		JWD_PRINTF(w, "\n%s\n\n", "CRC VERIFIED!!");
 		// reset CRC error status
 		w->statusRegister &= 0b11110111;
 		w->verify_operation_active = 0;
@@ -1863,6 +3704,12 @@ int verifyCRCTypeII(JWD1797* w) {
 	}
 }
 
+/* the CRC check shared by the verify operations and verifyJWD1797Track() -
+	1 if the two CRC bytes at crc are the placeholder the formatter writes */
+int isJWD1797CRCValid(const unsigned char* crc) {
+	return crc[0] == CRC_BYTE && crc[1] == CRC_BYTE;
+}
+
 /* verify delay timer, wait for HLT, index hole timout check,
 	search for ID field, track ID/track register compare, CRC check */
 void typeIVerifySequence(JWD1797* w, double us) {
@@ -1877,6 +3724,7 @@ void typeIVerifySequence(JWD1797* w, double us) {
 			w->verify_operation_active = 1;
 			// check if 5 index holes have passed
 			if(verifyIndexTimeout(w, 5)) {return;}
+			startJWD1797IDSearch(w);
 			// new byte available to read
 			if(w->new_byte_read_signal_) {
 				// search for ID Address field if not already found
@@ -1892,7 +3740,10 @@ void typeIVerifySequence(JWD1797* w, double us) {
 				/* check track register against track ID data -
 					if 1 is returned - track verified, continue to CRC checks
 					0 returned - track not verified - start search over */
-				if(verifyTrackID(w)) {verifyCRC(w);}
+				if(verifyTrackID(w)) {
+					recordJWD1797RotationalWait(w, w->id_am_byte);
+					verifyCRC(w);
+				}
 				/* check CRC bytes (CRC circuitry NOT implemented yet)
 					CRC bytes are temporerily set to 0x01 in the formatted disk array */
 			}
@@ -1908,7 +3759,7 @@ int handleEDelay(JWD1797* w, double us) {
 		// clock the e delay timer
 		w->e_delay_timer += us;
 		// check if E delay timer has reached limit
-		if(w->e_delay_timer >= E_DELAY_LIMIT) {
+		if(w->e_delay_timer >= w->format->e_delay_us) {
 			w->e_delay_done = 1;
 			w->e_delay_timer = 0.0;
 			return 1;	// delay clock expired
@@ -1929,6 +3780,7 @@ int typeIICmdIDVerify(JWD1797* w) {
 	/* check if 5 index holes have passed -
 		if 1 is returned, process timed out, 0 -> continue with verification */
 	if(verifyIndexTimeout(w, 5)) {return 0;}
+	startJWD1797IDSearch(w);
 	// new byte available to read
 	if(w->new_byte_read_signal_) {
 		// search for ID mark
@@ -1942,7 +3794,7 @@ int typeIICmdIDVerify(JWD1797* w) {
 		}
 	}
 	if(w->id_field_data_collected) {
-		printByteArray(w->id_field_data, 6);
+		if(w->verbose) {printByteArray(w->id_field_data, 6);}
 		int track_verified = verifyTrackID(w);
 		if(!track_verified) {return 0;}
 		int sector_verified = verifySectorID(w);
@@ -1955,6 +3807,7 @@ int typeIICmdIDVerify(JWD1797* w) {
 		if(!verifyCRCTypeII(w)) {return 0;}
 		// ID data is valid..
 		w->ID_data_verified = 1;
+		recordJWD1797RotationalWait(w, w->id_am_byte);
 		return 1;
 	}
 }
@@ -1962,7 +3815,17 @@ int typeIICmdIDVerify(JWD1797* w) {
 /* this function reads the sector length field of the IDAM data and extracts
 	the actual integer sector length */
 int getSectorLengthFromID(JWD1797* w) {
-	switch (w->id_field_data[3]) {
+	int length = getJWD1797SectorLength(w->id_field_data[3]);
+	if(length == 0) {
+		JWD_PRINTF(w, "%s\n", "ERROR: Non-standard sector length!");
+	}
+	return length;
+}
+
+/* sector length of an ID field length code - 0 for a code the controller does
+	not know */
+int getJWD1797SectorLength(unsigned char code) {
+	switch (code) {
 		case 0x00:
 			return 128;
 			break;
@@ -1976,7 +3839,7 @@ int getSectorLengthFromID(JWD1797* w) {
 			return 1024;
 			break;
 		default:
-			printf("%s\n", "ERROR: Non-standard sector length!");
+			return 0;
 	}
 }
 
@@ -2006,11 +3869,17 @@ int dataAddressMarkSearch(JWD1797* w) {
 		return 0;
 	}
 	// look for 0xFB - if so, IDAM has been found
-	if(w->data_mark_found == 0 && incoming_byte == 0xFB) {
+	if(w->data_mark_found == 0 && incoming_byte == DATA_AM_BYTE) {
+		w->data_mark_found = 1;
+		return 1;
+	}
+	// deleted data mark 0xF8 - record type in status bit 5 (same as HLE)
+	if(w->data_mark_found == 0 && incoming_byte == DELETED_DATA_AM_BYTE) {
 		w->data_mark_found = 1;
+		w->statusRegister |= 0b00100000;
 		return 1;
 	}
-	// the 3 0xA1 bytes were not followed by 0xFB - DATA AM not found
+	// the 3 0xA1 bytes were not followed by 0xFB or 0xF8 - DATA AM not found
 	else {
 		w->data_a1_byte_counter = 0;
 		w->data_mark_search_count++;
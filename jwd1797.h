@@ -5,8 +5,270 @@
 
 // jwd1797.h
 
+#define JWD1797_MAX_SECTORS_PER_TRACK 64
+// track descriptor sector flags
+#define JWD1797_SECTOR_NO_DATA 0x01     // ID field only - no data field recorded
+#define JWD1797_SECTOR_DELETED 0x02     // deleted data address mark (0xF8)
+#define JWD1797_SECTOR_DATA_ERROR 0x04  // data read back with a CRC error
+
+/* one physical track of a disk, as described by the image loader. Sectors are
+  listed in the order they pass under the head. ID fields may carry other
+  cylinder/head numbers than the physical position (copy protection,
+  IMD cylinder/head maps). */
+typedef struct {
+
+unsigned char cylinder;   // physical position
+unsigned char head;
+unsigned char num_sectors;
+unsigned char size_code;  // N of the ID field - 128 << N bytes per sector
+unsigned int sector_length;
+unsigned long long data_offset; // first sector's data in the loader sector data
+// formatted track - where it starts in the formatted disk and how long it is
+unsigned long long formatted_offset;
+unsigned int formatted_length;
+unsigned int byte_time_ns;  // NANOSECONDS per rotational byte on this track
+unsigned char sector_ids[JWD1797_MAX_SECTORS_PER_TRACK];  // R
+unsigned char id_cylinders[JWD1797_MAX_SECTORS_PER_TRACK];  // C
+unsigned char id_heads[JWD1797_MAX_SECTORS_PER_TRACK];  // H
+unsigned char sector_flags[JWD1797_MAX_SECTORS_PER_TRACK];
+
+} JWD1797TrackDescriptor;
+
+/* layout index of a track rewritten in a controller's overlay - built by
+  scanning the track bytes for address marks (see indexJWD1797Track()) */
+typedef struct {
+
+JWD1797TrackDescriptor descriptor;
+unsigned int id_am_offsets[JWD1797_MAX_SECTORS_PER_TRACK];
+
+} JWD1797TrackLayout;
+
+/* result of checking a formatted track the way the controller parses it (see
+  verifyJWD1797Track()) - sector counts by problem */
+typedef struct {
+
+unsigned int sectors;       // ID fields found
+unsigned int missing;       // sectors of the track descriptor not found
+unsigned int bad_id;        // ID field differs from the track descriptor
+unsigned int bad_length;    // sector length code the controller does not know
+unsigned int bad_id_crc;    // ID field CRC the controller rejects
+unsigned int bad_data_crc;  // data field CRC the controller rejects
+unsigned int no_data;       // data field lost - READ SECTOR ends in RECORD NOT FOUND
+unsigned int duplicates;    // sector number already found on the track
+// not errors - the guest has to expect them
+unsigned int deleted;       // deleted data address mark (0xF8)
+unsigned int foreign;       // ID cylinder/head differ from the physical position
+unsigned int errors;        // sum of the error counts above
+
+} JWD1797TrackReport;
+
+// disk formats (JWD1797Config format, JWD1797Image format)
+#define JWD1797_FORMAT_AUTO 0   // picked from the image geometry
+#define JWD1797_FORMAT_DD40 1   // 5.25" DS/DD 40 track, 300 RPM (160K - 360K)
+#define JWD1797_FORMAT_DD80 2   // DS/DD 80 track, 300 RPM (640K, 720K)
+#define JWD1797_FORMAT_HD 3     // 5.25" DS/HD 80 track, 360 RPM (1.2M)
+#define JWD1797_FORMAT_HD144 4  // 3.5" DS/HD 80 track, 300 RPM (1.44M)
+
+/* rotational timing, gap sizes and drive timings of a disk format (see
+  getJWD1797FormatProfile()). A track is one revolution of data at data_rate
+  with GAP4B filling it up. fit_track is the original Z-100 layout: GAP4B has
+  a fixed length and the byte time is fitted so the track makes a revolution. */
+typedef struct {
+
+const char* name;
+unsigned int rpm;
+unsigned int data_rate;       // MFM bits per second
+int fit_track;
+unsigned int gap3_length;     // GAP3 after every data field
+unsigned int clock_mhz;       // WD1797 clock the drive needs
+int step_rates[4];            // ms, by step rate bits r1 r0 at that clock
+double verify_settling_us;    // TYPE I verify head settling
+double e_delay_us;            // E (15 ms at 2 MHz) of TYPE II and III commands
+int tg43_track;               // TG43 is high above this track
+
+} JWD1797FormatProfile;
+
+/* formatted base disk image. One image can be shared (read-only) by any
+  number of controllers - it is reference counted and freed when the last
+  controller releases it. The image, its track table, formatted disk and
+  address mark index live in its arena. */
 typedef struct {
 
+struct JWD1797Arena* arena;
+char* image_path;
+int verbose;
+int ref_count;
+
+unsigned int cylinders; // (tracks per side)
+unsigned int num_heads;
+unsigned int sectors_per_track; // most sectors on any track
+unsigned int sector_length; // nominal (first track with sectors)
+long disk_img_file_size;
+unsigned int format;  // JWD1797_FORMAT_* the tracks were formatted for
+
+/* one descriptor per track [cylinder * num_heads + head], filled by the
+  image loader (see image_loaders.c) */
+JWD1797TrackDescriptor* tracks;
+unsigned int num_tracks;
+
+/* tracks are stored one after the other (tracks[].formatted_offset) and may
+  all have different lengths */
+unsigned char* formattedDiskArray;
+unsigned long formatted_disk_size;
+// nominal track (track 0) - see tracks[] for each track
+int actual_num_track_bytes;
+unsigned int rotational_byte_read_limit;  // NANOSECONDS per rotational byte
+/* byte offset of each sector's ID address mark within its track
+  [(cylinder * num_heads + head) * sectors_per_track + n] - n is the n-th
+  sector on the track (tracks[].sector_ids[n]) */
+unsigned int* id_am_offsets;
+
+/* formatted disk cache (sidecar file) - when cache_map is not NULL the
+  formatted disk and the address mark index point into this mapping. The
+  cache is keyed on the image file's size, mtime and inode, the payload hash
+  is only checked when they do not match (see mapJWD1797ImageCache()). */
+unsigned long long payload_hash;
+long long source_mtime_ns;
+unsigned long long source_inode;
+char* cache_path;  // NULL - no cache (see setJWD1797ImageCachePath())
+void* cache_map;
+unsigned long cache_map_size;
+
+} JWD1797Image;
+
+/* header of the formatted disk cache file. It is followed by the formatted
+  disk, the ID address mark index and the track descriptor table at the given
+  file offsets. */
+typedef struct {
+
+char magic[8];
+unsigned int version;
+unsigned int actual_num_track_bytes;
+unsigned long long payload_hash;
+long long disk_img_file_size;
+long long source_mtime_ns;
+unsigned long long source_inode;
+unsigned int cylinders;
+unsigned int num_heads;
+unsigned int sectors_per_track;
+unsigned int sector_length;
+unsigned int rotational_byte_read_limit;
+unsigned int num_tracks;
+unsigned long long formatted_disk_offset;
+unsigned long long formatted_disk_size;
+unsigned long long id_am_index_offset;
+unsigned long long track_table_offset;
+unsigned int format;
+
+} JWD1797ImageCacheHeader;
+
+/* controller creation parameters - fill them with designated initializers,
+  fields left out are 0. Geometry values of 0 are taken from the loader disk
+  parameter table of the image. If image is not NULL the controller shares
+  that base image instead of loading image_path. */
+typedef struct {
+
+const char* image_path;
+unsigned int cylinders;
+unsigned int num_heads;
+unsigned int sectors_per_track;
+unsigned int sector_length;
+int verbose;  // print controller progress messages to stdout
+JWD1797Image* image;
+// back a loaded image's arena with huge pages where the host has them
+int huge_pages;
+/* physical order of the sectors of a raw image - logical sector n + 1 is laid
+  interleave slots after sector n (0 or 1 is 1..N in order) and every track of
+  cylinder c starts c * skew slots later (see interleaveRawSectors()) */
+unsigned int interleave;
+unsigned int skew;
+// JWD1797_FORMAT_* of the disk (0 - picked from the image geometry)
+unsigned int format;
+/* formatted disk cache - written to cache_dir (NULL - next to the image), or
+  neither read nor written with no_cache set */
+const char* cache_dir;
+int no_cache;
+
+} JWD1797Config;
+
+/* host DMA callback for high level emulation - receives the host context, the
+  sector data and its length (see setJWD1797DMACallback()) */
+typedef void (*JWD1797DMACallback)(void*, const unsigned char*, unsigned int);
+
+/* READ TRACK sink - receives the host context, the cylinder and head, a chunk
+  of the track bytes, its length and whether it is the last chunk of the
+  track (see setJWD1797TrackSink()) */
+typedef void (*JWD1797TrackSink)(void*, int, int, const unsigned char*, unsigned int, int);
+// largest chunk a byte level READ TRACK hands to the sink
+#define JWD1797_TRACK_SINK_CHUNK 4096
+
+// bytes the data FIFO holds - a power of two, more than two of the largest sectors
+#define JWD1797_DATA_FIFO_SIZE 4096
+
+/* DRQ byte FIFO of a READ SECTOR in FIFO mode (see setJWD1797DataFIFO()). The
+  controller puts each sector in ahead, every byte stamped with the emulated
+  time it is assembled; a port read takes the byte in the data register at
+  the time of the read. A byte that was not read before the next one was
+  assembled is lost, exactly as in the byte level model - lost data follows
+  from the time stamps, not from when the controller was cycled. The FIFO is
+  filled and read on the thread that runs the controller - the threaded front
+  end hands the CPU side the values it resolves (see controller_thread.c). */
+typedef struct {
+
+unsigned long long ts[JWD1797_DATA_FIFO_SIZE];   // time (ns) each byte is assembled
+unsigned char data[JWD1797_DATA_FIFO_SIZE];
+// producer
+unsigned long head;    // next free slot
+unsigned long long complete_ns;  // every byte assembled up to this time is in
+unsigned long long end_ns;       // the transfer ended - no bytes after this time
+// consumer
+unsigned long tail;    // oldest byte kept (data register)
+unsigned long next;    // next byte to be assembled
+int read;              // the byte in the data register was read
+int lost;              // lost data status bit
+unsigned char value;   // data register
+unsigned long lost_bytes;  // bytes that arrived over an unread one
+
+} JWD1797DataFIFO;
+
+/* buckets of a statistics histogram - bucket 0 counts the value 0, bucket n
+  the values 2^(n-1) .. 2^n - 1 and the last bucket everything larger (see
+  getJWD1797HistogramBucket()) */
+#define JWD1797_HISTOGRAM_BUCKETS 32
+
+typedef struct {
+
+unsigned long buckets[JWD1797_HISTOGRAM_BUCKETS];
+unsigned long samples;
+unsigned long long sum;
+unsigned long long max;
+
+} JWD1797Histogram;
+
+/* guest I/O statistics of a controller, by command type - index [type - 1]
+  for TYPE I .. TYPE IV (see getJWD1797Stats()). Always kept; a sample is a
+  few instructions, taken where the controller already handles the event. */
+typedef struct {
+
+unsigned long commands[4];
+/* bytes from the start of an ID search (head loaded and settled, or the end
+  of the sector before in a multi-record read) to the target ID address mark */
+JWD1797Histogram rotational_wait[4];
+JWD1797Histogram seek_distance[4];  // tracks the head moved in a command
+/* NANOSECONDS from a byte reaching the data register (DRQ) to the host
+  reading it */
+JWD1797Histogram drq_latency[4];
+unsigned long index_timeouts[4];  // ID searches given up after the index hole limit
+unsigned long lost_data[4];       // bytes the host did not read in time
+
+} JWD1797Stats;
+
+typedef struct {
+
+/* memory the controller owns for its whole life - the controller itself is
+  the first allocation (see newJWD1797()) */
+struct JWD1797Arena* arena;
+
 unsigned char dataShiftRegister;
 /* during the SEEK command, the dataRegister holds the address of the desired
   track position - otherwise it holds the assembled byte read from or writen
@@ -27,7 +289,19 @@ unsigned char controlStatus;
 
 // keep track of current byte being pointed to by the READ/WRITE head
 unsigned long disk_img_index_pointer;
+/* derived from emulated_time_ns every cycle - see updateRotationalPosition() */
 unsigned long rotational_byte_pointer;
+/* absolute emulated time in NANOSECONDS. The rotational position, index pulse
+  and revolution count are all computed from this time stamp as
+  (origin + (t - t0) / byte_time) mod track_bytes */
+unsigned long long emulated_time_ns;
+unsigned long long rotation_t0_ns;  // time stamp of the rotational origin
+unsigned long rotational_byte_origin; // rotational byte under the head at t0
+unsigned long long revolution_count;  // index holes passed since t0
+/* coarse quantum stepping - host time is accumulated by advanceJWD1797() and
+  the controller is cycled once per quantum (0 = cycle on every call) */
+unsigned long long cycle_quantum_ns;
+unsigned long long quantum_accumulator_ns;
 unsigned long rw_start_byte;
 
 // ready input from disk drive interface (0 = not ready, 1 = ready)
@@ -68,17 +342,17 @@ int start_byte_set;
 
 int terminate_command;
 
+/* absolute emulated time (NANOSECONDS) of the next head step of a TYPE I
+  command (see stepJWD1797Due()) */
+unsigned long long step_deadline_ns;
 // ALL timers in microseconds
 double master_timer;  // for TESTING
 double index_pulse_timer;
 double index_encounter_timer;
-double step_timer;
 double verify_head_settling_timer;
 double e_delay_timer;
 double assemble_data_byte_timer;
-unsigned int rotational_byte_read_limit;
-unsigned int rotational_byte_read_timer;
-unsigned int rotational_byte_read_timer_OVR;
+unsigned int rotational_byte_read_limit; // NANOSECONDS per rotational byte
 double HLD_idle_reset_timer;
 double HLT_timer;
 // *
@@ -125,8 +399,36 @@ unsigned int sector_length;
 
 long disk_img_file_size;
 
+// shared base image mounted in the drive (NULL - drive empty, not ready)
+JWD1797Image* image;
+// timings of the disk format in the drive (the 40 track profile when empty)
+const JWD1797FormatProfile* format;
+/* per-controller copy-on-write overlay - one slot per track, NULL until the
+  track is first written (see getFDiskTrackForWrite()) */
+unsigned char** overlay_tracks;
+int num_overlay_tracks;
+/* tracks copied to the overlay, in the order they were first written - a
+  discard only visits these (see discardJWD1797Overlay()) */
+int* dirty_tracks;
+int num_dirty_tracks;
+/* sectors written through getJWD1797SectorPtrForWrite() - one flag per
+  sector [track * sectors_per_track + n] */
+unsigned char* dirty_sectors;
+/* layout index of overlay tracks (NULL: the base image layout applies) and
+  tracks handed out by getFDiskTrackForWrite() that must be scanned again
+  before their layout is used */
+JWD1797TrackLayout** overlay_layouts;
+unsigned char* overlay_reindex;
+// print progress messages to stdout (1) or stay quiet (0)
+int verbose;
+
 unsigned char* formattedDiskArray;
+// length of the track under the head (rotational bytes per revolution)
 int actual_num_track_bytes;
+/* track under the head (cylinder * num_heads + head, -1: no track) and its
+  formatted bytes (overlay copy if written) - see selectJWD1797Track() */
+int active_track;
+unsigned char* active_track_data;
 
 // emulator internal
 int new_byte_read_signal_;
@@ -143,6 +445,9 @@ int id_field_data_collected;
 int data_a1_byte_counter;
 int data_mark_search_count;
 int data_mark_found;
+/* multi-record READ SECTOR - absolute byte (bytes passed) of the first data
+  byte of the next sector, found from the track layout (0: no wait) */
+unsigned long long next_data_byte;
 /* collects ID Field data
   (0: cylinders, 1: head, 2: sector, 3: sector len, 4: CRC1, 5: CRC2) */
 unsigned char id_field_data[6];
@@ -159,13 +464,129 @@ int start_track_read_;
 // control latch
 int wait_enabled;
 
+/* high level emulation (HLE) of READ SECTOR - the sector data is handed to
+  the host DMA callback at the emulated time the last data byte is assembled,
+  without DRQ (see setJWD1797HLE()) */
+JWD1797DMACallback hle_dma;
+void* hle_dma_context;
+int hle_enabled;
+int hle_active;  // HLE READ SECTOR in progress
+/* n-th sector on the track due at the deadline (-1: record not found, -2: the
+  sector has no data field) */
+int hle_sector;
+unsigned long long hle_deadline_ns;
+
+/* READ SECTOR through the data FIFO (see setJWD1797DataFIFO()) - the FIFO is
+  allocated the first time the mode is turned on */
+JWD1797DataFIFO* data_fifo;
+int fifo_enabled;
+int fifo_transfer;  // the data register and DRQ come from the FIFO
+
+/* guest I/O statistics (see getJWD1797Stats()) and what is measured across
+  the command running */
+JWD1797Stats stats;
+int stats_type;           // type of the command the samples go to (0: none)
+int stats_start_track;    // head position when it started
+unsigned long long id_search_byte;  // absolute byte the ID search started at (~0: none)
+unsigned long long id_am_byte;      // absolute byte of the last ID address mark found
+unsigned long long drq_ns;          // emulated time DRQ was last raised
+
+/* READ TRACK sink (NULL: none) and the bytes it has not been handed yet -
+  see setJWD1797TrackSink() */
+JWD1797TrackSink track_sink;
+void* track_sink_context;
+unsigned char* track_sink_buffer;
+unsigned int track_sink_used;
+int track_sink_active;  // a READ TRACK is streaming to the sink
+
+/* activity tracer (NULL: not tracing) - see setJWD1797Tracer(). The command
+  and phase open on the timeline and the last traced pin states are kept, so
+  only changes are recorded. */
+struct JWD1797Tracer* tracer;
+int trace_id;
+const char* trace_command;
+const char* trace_phase;
+unsigned char trace_pins;
+unsigned int trace_last_read;  // port << 8 | value of the last traced port read
+unsigned char trace_status;    // status register at the last state trace
+
+/* pin waveform dump (NULL: off) - see setJWD1797VCD(). Pin n of the dump
+  is bit n of vcd_pins. */
+struct JWD1797VCDWriter* vcd;
+unsigned int vcd_pins;               // pin levels last written
+unsigned long long vcd_last_ns;      // emulated time of the last dump
+unsigned long long vcd_ip_edge_ns;   // next index pulse edge
+unsigned long long vcd_t0_ns;        // rotation_t0_ns the edge was found with
+
 } JWD1797;
 
-JWD1797* newJWD1797();
+/* pool of controllers bound to one shared base image, handed out in the
+  reset state of a template controller (see acquireJWD1797()). A returned
+  controller drops the tracks it wrote and is restored from the template
+  snapshot - no field by field reset, no image load or format. */
+typedef struct {
+
+JWD1797Image* image;
+JWD1797* template;
+JWD1797** idle;         // controllers ready to be handed out
+int num_idle;
+int capacity;           // idle controllers kept - more returned ones are freed
+unsigned char lock;     // spin lock of the idle list
+unsigned long created;  // controllers made by the pool
+unsigned long reused;   // acquires served from the idle list
+
+} JWD1797Pool;
+
+JWD1797* newJWD1797(JWD1797Config*);
+void freeJWD1797(JWD1797*);
+void setJWD1797Verbose(JWD1797*, int);
+int restoreJWD1797(JWD1797*, const JWD1797*);
+JWD1797Pool* newJWD1797Pool(JWD1797Config*, int);
+void freeJWD1797Pool(JWD1797Pool*);
+JWD1797* acquireJWD1797(JWD1797Pool*);
+void returnJWD1797(JWD1797Pool*, JWD1797*);
+void powerOnJWD1797(JWD1797*);
 void resetJWD1797(JWD1797*);
 void writeJWD1797(JWD1797*, unsigned int, unsigned int);
 unsigned int readJWD1797(JWD1797*, unsigned int);
 void doJWD1797Cycle(JWD1797*, double);
+void doJWD1797CycleStep(JWD1797*, unsigned long long);
+void advanceJWD1797(JWD1797*, double);
+void setJWD1797Quantum(JWD1797*, double);
+int continueJWD1797MultiRecord(JWD1797*);
+void setJWD1797Tracer(JWD1797*, struct JWD1797Tracer*, int);
+const char* getJWD1797Phase(JWD1797*);
+void traceJWD1797Command(JWD1797*);
+void traceJWD1797State(JWD1797*);
+void traceJWD1797Port(JWD1797*, int, unsigned int, unsigned int);
+int setJWD1797VCD(JWD1797*, struct JWD1797VCDWriter*);
+void dumpJWD1797Pins(JWD1797*);
+void setJWD1797DMACallback(JWD1797*, JWD1797DMACallback, void*);
+void setJWD1797HLE(JWD1797*, int);
+void setJWD1797DataFIFO(JWD1797*, int);
+void resetJWD1797DataFIFO(JWD1797DataFIFO*);
+void pushJWD1797DataFIFO(JWD1797*, const unsigned char*, unsigned int, unsigned long long);
+void endJWD1797DataFIFO(JWD1797*);
+void stepJWD1797DataFIFO(JWD1797DataFIFO*, unsigned long long);
+int popJWD1797DataFIFO(JWD1797DataFIFO*, unsigned long long, unsigned char*);
+unsigned int getJWD1797DataFIFOStatus(JWD1797DataFIFO*, unsigned long long);
+unsigned long long prepareJWD1797DataFIFORead(JWD1797*);
+int getJWD1797HistogramBucket(unsigned long long);
+void addJWD1797HistogramSample(JWD1797Histogram*, unsigned long long);
+void getJWD1797Stats(JWD1797*, JWD1797Stats*);
+void clearJWD1797Stats(JWD1797*);
+void openJWD1797CommandStats(JWD1797*);
+void closeJWD1797CommandStats(JWD1797*);
+void startJWD1797IDSearch(JWD1797*);
+void recordJWD1797RotationalWait(JWD1797*, unsigned long long);
+void setJWD1797TrackSink(JWD1797*, JWD1797TrackSink, void*);
+void flushJWD1797TrackSink(JWD1797*, int);
+int captureJWD1797Disk(JWD1797*, JWD1797TrackSink, void*);
+void writeJWD1797TrackFile(void*, int, int, const unsigned char*, unsigned int, int);
+void startJWD1797HLERead(JWD1797*);
+void scheduleJWD1797HLESector(JWD1797*, unsigned long long);
+void publishJWD1797DataFIFO(JWD1797*);
+void stepJWD1797HLERead(JWD1797*);
 void doJWD1797Command(JWD1797*);
 
 void commandStep(JWD1797*, double);
@@ -181,12 +602,57 @@ void setupTypeIIICommand(JWD1797*);
 void setTypeIIICommand(JWD1797*);
 void printBusyMsg();
 void updateTG43Signal(JWD1797*);
-void handleIndexPulse(JWD1797*, double);
+void handleIndexPulse(JWD1797*);
+void updateRotationalPosition(JWD1797*);
+unsigned long long getJWD1797BytesPassed(JWD1797*, unsigned long long);
+unsigned long getJWD1797RotationalByte(JWD1797*, unsigned long long);
+unsigned long long getJWD1797Revolutions(JWD1797*, unsigned long long);
+unsigned long long getJWD1797RotationalPhase(JWD1797*, unsigned long long);
+int getJWD1797IndexPulse(JWD1797*, unsigned long long);
+unsigned long long getJWD1797NextIndexEdge(JWD1797*, unsigned long long);
+unsigned long long getJWD1797ByteStartTime(JWD1797*, unsigned long long);
+int findJWD1797NextSector(JWD1797*, unsigned long long, unsigned long long*);
 void handleHLDIdle(JWD1797*);
 void handleHLTTimer(JWD1797*, double);
 unsigned char* diskImageToCharArray(char*, JWD1797*);
-void assembleFormattedDiskArray(JWD1797*, char*);
+unsigned char* readDiskImageFile(char*, long*, int, struct JWD1797Arena*);
+void assembleFormattedDiskArray(JWD1797Image*, JWD1797Config*);
+const JWD1797FormatProfile* getJWD1797FormatProfile(unsigned int);
+unsigned int detectJWD1797Format(JWD1797Image*);
+unsigned int getFormattedTrackLength(const JWD1797FormatProfile*, unsigned int,
+  unsigned int);
+void formatJWD1797Track(JWD1797Image*, JWD1797TrackDescriptor*, unsigned char*,
+  unsigned int*, unsigned char*, long);
+JWD1797Image* loadJWD1797Image(JWD1797Config*);
+void retainJWD1797Image(JWD1797Image*);
+void releaseJWD1797Image(JWD1797Image*);
+unsigned long long hashJWD1797CacheKey(JWD1797Config*);
+unsigned long long hashDiskImagePayload(unsigned char*, long, JWD1797Config*);
+void setJWD1797ImageCachePath(JWD1797Image*, JWD1797Config*);
+char* getJWD1797ImageCachePath(JWD1797Image*);
+int mapJWD1797ImageCache(JWD1797Image*, int);
+void writeJWD1797ImageCache(JWD1797Image*);
+int mountJWD1797Image(JWD1797*, JWD1797Image*);
+void unmountJWD1797Image(JWD1797*);
+void setJWD1797ReadyPin(JWD1797*, int);
+void doJWD1797ForcedInterrupt(JWD1797*);
+unsigned char* getFDiskTrackForWrite(JWD1797*, int, int);
+void discardJWD1797Overlay(JWD1797*);
+JWD1797TrackDescriptor* getJWD1797TrackLayout(JWD1797*, int, const unsigned int**);
+int indexJWD1797Track(const unsigned char*, unsigned int, JWD1797TrackDescriptor*,
+  unsigned int*, unsigned int);
+int reindexJWD1797Track(JWD1797*, int);
+int verifyJWD1797Track(const unsigned char*, unsigned int,
+  const JWD1797TrackDescriptor*, JWD1797TrackReport*);
 unsigned char getFDiskByte(JWD1797*);
+int getJWD1797TrackIndex(JWD1797*);
+int findJWD1797Sector(JWD1797*, int, int, int);
+const unsigned char* getJWD1797SectorPtr(JWD1797*, int, int, int, unsigned int*);
+unsigned char* getJWD1797SectorPtrForWrite(JWD1797*, int, int, int, unsigned int*);
+int isJWD1797SectorDirty(JWD1797*, int, int, int);
+void selectJWD1797Track(JWD1797*, int);
+const unsigned char* getJWD1797TrackData(JWD1797*, int, unsigned int*);
+unsigned int getTrackByteTime(const JWD1797FormatProfile*, unsigned int);
 void handleVerifyHeadSettleDelay(JWD1797*, double);
 int verifyIndexTimeout(JWD1797*, int);
 int IDAddressMarkSearch(JWD1797*);
@@ -195,6 +661,9 @@ int collectIDFieldData(JWD1797*);
 void typeIVerifySequence(JWD1797*, double);
 int typeIICmdIDVerify(JWD1797*);
 int getSectorLengthFromID(JWD1797*);
+int stepJWD1797Due(JWD1797*);
+int getJWD1797SectorLength(unsigned char);
+int isJWD1797CRCValid(const unsigned char*);
 int handleEDelay(JWD1797*, double);
 int dataAddressMarkSearch(JWD1797*);
 int verifyCRC(JWD1797*);
@@ -0,0 +1,146 @@
+// address mark scanner
+// finds every address mark candidate of a formatted track in one pass - used
+// to build the layout index of tracks the formatter did not lay out itself
+
+#include "mark_scanner.h"
+
+/* the vector scanners need x86 intrinsics - other hosts (and compilers
+  without target attributes) use the scalar scanner for all three */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && defined(__SSE2__)
+#define MARK_SCANNER_X86 1
+#include <immintrin.h>
+#else
+#define MARK_SCANNER_X86 0
+#endif
+
+#define MARK_PREFIX_BYTE 0xA1
+#define ID_MARK_BYTE 0xFE
+// data address marks are 0xF8 - 0xFB (0xF8: deleted data)
+#define DATA_MARK_MASK 0xFC
+#define DATA_MARK_BYTE 0xF8
+
+// returns 1 if b is an ID or data address mark byte
+int isAddressMarkByte(unsigned char b) {
+  return b == ID_MARK_BYTE || (b & DATA_MARK_MASK) == DATA_MARK_BYTE;
+}
+
+// one byte at a time - also finishes the tail of the vector scanners
+unsigned int scanAddressMarksScalar(const unsigned char* track,
+  unsigned int length, unsigned int start, unsigned int* marks,
+  unsigned int max_marks) {
+  unsigned int found = 0;
+  for(unsigned int i = start; i + 3 < length && found < max_marks; i++) {
+    if(track[i] == MARK_PREFIX_BYTE && track[i + 1] == MARK_PREFIX_BYTE &&
+      track[i + 2] == MARK_PREFIX_BYTE && isAddressMarkByte(track[i + 3])) {
+      marks[found++] = i + 3;
+    }
+  }
+  return found;
+}
+
+#if MARK_SCANNER_X86
+
+/* 16 candidate positions per iteration. Four overlapping loads line up the
+  three prefix bytes and the mark byte of every position, so a mark that
+  straddles two blocks is found without carrying state between them. A block
+  without a prefix byte is rejected after the first load. */
+unsigned int scanAddressMarksSSE2(const unsigned char* track,
+  unsigned int length, unsigned int start, unsigned int* marks,
+  unsigned int max_marks) {
+  const __m128i prefix = _mm_set1_epi8((char)MARK_PREFIX_BYTE);
+  const __m128i id_mark = _mm_set1_epi8((char)ID_MARK_BYTE);
+  const __m128i data_mask = _mm_set1_epi8((char)DATA_MARK_MASK);
+  const __m128i data_mark = _mm_set1_epi8((char)DATA_MARK_BYTE);
+  unsigned int found = 0;
+  unsigned int i = start;
+  for(; i + 3 + 16 <= length && found < max_marks; i += 16) {
+    __m128i p0 = _mm_loadu_si128((const __m128i*)(track + i));
+    // most blocks (gaps, payload) hold no prefix byte at all
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(p0, prefix)) == 0) {continue;}
+    __m128i p1 = _mm_loadu_si128((const __m128i*)(track + i + 1));
+    __m128i p2 = _mm_loadu_si128((const __m128i*)(track + i + 2));
+    __m128i m = _mm_loadu_si128((const __m128i*)(track + i + 3));
+    __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(p0, prefix),
+      _mm_and_si128(_mm_cmpeq_epi8(p1, prefix), _mm_cmpeq_epi8(p2, prefix)));
+    hit = _mm_and_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(m, id_mark),
+      _mm_cmpeq_epi8(_mm_and_si128(m, data_mask), data_mark)));
+    unsigned int bits = (unsigned int)_mm_movemask_epi8(hit);
+    while(bits) {
+      marks[found++] = i + __builtin_ctz(bits) + 3;
+      if(found == max_marks) {return found;}
+      bits &= bits - 1;
+    }
+  }
+  return found + scanAddressMarksScalar(track, length, i, marks + found,
+    max_marks - found);
+}
+
+// 32 candidate positions per iteration - same method as the SSE2 scanner
+__attribute__((target("avx2")))
+unsigned int scanAddressMarksAVX2(const unsigned char* track,
+  unsigned int length, unsigned int start, unsigned int* marks,
+  unsigned int max_marks) {
+  const __m256i prefix = _mm256_set1_epi8((char)MARK_PREFIX_BYTE);
+  const __m256i id_mark = _mm256_set1_epi8((char)ID_MARK_BYTE);
+  const __m256i data_mask = _mm256_set1_epi8((char)DATA_MARK_MASK);
+  const __m256i data_mark = _mm256_set1_epi8((char)DATA_MARK_BYTE);
+  unsigned int found = 0;
+  unsigned int i = start;
+  for(; i + 3 + 32 <= length && found < max_marks; i += 32) {
+    __m256i p0 = _mm256_loadu_si256((const __m256i*)(track + i));
+    if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(p0, prefix)) == 0) {continue;}
+    __m256i p1 = _mm256_loadu_si256((const __m256i*)(track + i + 1));
+    __m256i p2 = _mm256_loadu_si256((const __m256i*)(track + i + 2));
+    __m256i m = _mm256_loadu_si256((const __m256i*)(track + i + 3));
+    __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(p0, prefix),
+      _mm256_and_si256(_mm256_cmpeq_epi8(p1, prefix), _mm256_cmpeq_epi8(p2, prefix)));
+    hit = _mm256_and_si256(hit, _mm256_or_si256(_mm256_cmpeq_epi8(m, id_mark),
+      _mm256_cmpeq_epi8(_mm256_and_si256(m, data_mask), data_mark)));
+    unsigned int bits = (unsigned int)_mm256_movemask_epi8(hit);
+    while(bits) {
+      marks[found++] = i + __builtin_ctz(bits) + 3;
+      if(found == max_marks) {return found;}
+      bits &= bits - 1;
+    }
+  }
+  return found + scanAddressMarksScalar(track, length, i, marks + found,
+    max_marks - found);
+}
+
+#else
+
+unsigned int scanAddressMarksSSE2(const unsigned char* track,
+  unsigned int length, unsigned int start, unsigned int* marks,
+  unsigned int max_marks) {
+  return scanAddressMarksScalar(track, length, start, marks, max_marks);
+}
+
+unsigned int scanAddressMarksAVX2(const unsigned char* track,
+  unsigned int length, unsigned int start, unsigned int* marks,
+  unsigned int max_marks) {
+  return scanAddressMarksScalar(track, length, start, marks, max_marks);
+}
+
+#endif
+
+// widest scanner the host CPU supports
+unsigned int scanAddressMarks(const unsigned char* track, unsigned int length,
+  unsigned int start, unsigned int* marks, unsigned int max_marks) {
+#if MARK_SCANNER_X86
+  if(__builtin_cpu_supports("avx2")) {
+    return scanAddressMarksAVX2(track, length, start, marks, max_marks);
+  }
+  return scanAddressMarksSSE2(track, length, start, marks, max_marks);
+#else
+  return scanAddressMarksScalar(track, length, start, marks, max_marks);
+#endif
+}
+
+// name of the scanner scanAddressMarks() uses on this host
+const char* getAddressMarkScannerName() {
+#if MARK_SCANNER_X86
+  return __builtin_cpu_supports("avx2") ? "AVX2" : "SSE2";
+#else
+  return "scalar";
+#endif
+}
@@ -0,0 +1,19 @@
+// address mark scanner (header)
+
+/* finds the address marks of a formatted track - three 0xA1 prefix bytes
+  followed by an ID address mark (0xFE) or a data address mark (0xF8 - 0xFB).
+  The offset of each mark byte (the byte after the prefix), from start on, is
+  stored in marks in track order - at most max_marks of them. Returns the
+  number of marks stored. scanAddressMarks() picks the widest implementation
+  the host CPU supports (AVX2, SSE2, scalar); all of them find the same
+  marks. */
+unsigned int scanAddressMarks(const unsigned char*, unsigned int, unsigned int,
+  unsigned int*, unsigned int);
+unsigned int scanAddressMarksScalar(const unsigned char*, unsigned int,
+  unsigned int, unsigned int*, unsigned int);
+unsigned int scanAddressMarksSSE2(const unsigned char*, unsigned int,
+  unsigned int, unsigned int*, unsigned int);
+unsigned int scanAddressMarksAVX2(const unsigned char*, unsigned int,
+  unsigned int, unsigned int*, unsigned int);
+int isAddressMarkByte(unsigned char);
+const char* getAddressMarkScannerName();
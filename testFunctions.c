@@ -2,15 +2,35 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <utime.h>
 #include "jwd1797.h"
+#include "arena.h"
 #include "utility_functions.h"
+#include "mark_scanner.h"
+#include "tracer.h"
+#include "vcd_writer.h"
+#include "controller_thread.h"
 
 void restoreTestPrintHelper(JWD1797*);
 void readSectorPrintHelper(JWD1797*);
 void typeIVerifyPrintHelper(JWD1797*);
 void seekTestPrintHelper(JWD1797*);
 void readTrackTestPrintHelper(JWD1797*);
+void hleTestDMA(void*, const unsigned char*, unsigned int);
+
+/* ID address mark to first data byte: C, H, R, N, CRC (2), GAP2 (22),
+  SYNC (12), data AM prefix (3) and data AM (1) */
+#define ID_TO_DATA_OFFSET 45
+
+// guest memory of the HLE READ SECTOR test (see hleTestDMA())
+typedef struct {
+  JWD1797* w;
+  unsigned char* memory;
+  unsigned int received;
+  unsigned long long last_ns; // emulated time of the last transfer
+} HLETestMemory;
 
 /* ------------- TEST FUNCTIONS ---------------- */
 
@@ -20,7 +40,7 @@ void masterClockTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n\n%s\n\n", "-------------- MASTER CLOCK TEST --------------");
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   for(int i = 0; i < 10; i++) {
     usleep(250000);
     // simulate random instruction time by picking from instruction_times list
@@ -71,6 +91,1838 @@ void getFByteTest(JWD1797* jwd1797, double instr_times[]) {
   }
 }
 
+/* this test confirms that the rotational byte pointer, revolution count and
+  index pulse are derived from absolute time. The controller is left un-cycled
+  for a long stretch and then given the whole time slice in a single cycle. The
+  result must match the byte/revolution computed from the time stamp alone. */
+void rotationalPositionTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- ROTATIONAL POSITION TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  powerOnJWD1797(jwd1797);
+
+  for(int i = 0; i < 10; i++) {
+    // skip ahead a random number of microseconds (up to ~3 revolutions)
+    double skip_us = (double)(rand()%600000) + instr_times[rand()%7];
+    doJWD1797Cycle(jwd1797, skip_us);
+    unsigned long long t_ns = jwd1797->emulated_time_ns;
+    // expected position computed directly from the time stamp
+    unsigned long long bytes_passed = jwd1797->rotational_byte_origin +
+      (t_ns / jwd1797->rotational_byte_read_limit);
+    unsigned long expected_byte = bytes_passed % jwd1797->actual_num_track_bytes;
+    unsigned long long expected_revs = bytes_passed / jwd1797->actual_num_track_bytes;
+
+    printf("%s%f\n", "MASTER CLOCK: ", jwd1797->master_timer);
+    printf("%s%lu | %s%lu ", "Rot. Byte Ptr: ", jwd1797->rotational_byte_pointer,
+      "Expected: ", expected_byte);
+    printf("%s%llu | %s%llu ", "Revolutions: ", jwd1797->revolution_count,
+      "Expected: ", expected_revs);
+    printf("%s%d", "IP: ", jwd1797->index_pulse_pin);
+    if(jwd1797->rotational_byte_pointer == expected_byte &&
+      jwd1797->revolution_count == expected_revs) {
+      printf("%s\n", " -- POSITION CONFIRMED");
+    }
+    else {
+      printf("%s\n", " -- WRONG POSITION");
+    }
+    usleep(250000);
+  }
+}
+
+/* tests that two controllers can share one formatted base image - a write on
+  one controller goes to its own copy-on-write overlay and is never seen by the
+  other controller or the base image. Remounting the disk drops the overlay. */
+void sharedImageTest(JWD1797* jwd1797) {
+  printf("\n\n%s\n\n", "-------------- SHARED IMAGE TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  powerOnJWD1797(jwd1797);
+
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* second = newJWD1797(&config);
+  printf("%s%d\n", "image references: ", jwd1797->image->ref_count);
+
+  // both controllers start at the same rotational position on track 0 side 0
+  unsigned char base_byte = getFDiskByte(jwd1797);
+  unsigned char* track = getFDiskTrackForWrite(second, 0, 0);
+  track[second->rotational_byte_pointer] = ~base_byte;
+
+  printf("%s%X | %s%X | %s%d\n", "first: ", getFDiskByte(jwd1797), "second: ",
+    getFDiskByte(second), "dirty tracks: ", second->num_dirty_tracks);
+  if(getFDiskByte(jwd1797) == base_byte &&
+    getFDiskByte(second) == (unsigned char)~base_byte) {
+    printf("%s\n", "overlay write -- CONFIRMED");
+  }
+  else {printf("%s\n", "overlay write -- WRONG");}
+
+  // a controller reset keeps the disk - only taking the disk out drops writes
+  resetJWD1797(second);
+  if(getFDiskByte(second) == (unsigned char)~base_byte) {
+    printf("%s\n", "overlay kept across reset -- CONFIRMED");
+  }
+  else {printf("%s\n", "overlay kept across reset -- WRONG");}
+  JWD1797Image* image = second->image;
+  retainJWD1797Image(image);
+  unmountJWD1797Image(second);
+  mountJWD1797Image(second, image);
+  releaseJWD1797Image(image);
+  if(getFDiskByte(second) == base_byte && second->num_dirty_tracks == 0) {
+    printf("%s\n", "overlay dropped on remount -- CONFIRMED");
+  }
+  else {printf("%s\n", "overlay dropped on remount -- WRONG");}
+
+  freeJWD1797(second);
+  printf("%s%d\n", "image references: ", jwd1797->image->ref_count);
+  sleep(1);
+}
+
+/* tests the image loaders - a single sided raw dump (recognised by its size)
+  and an IMD container with an interleaved sector map, a compressed sector and a
+  deleted data sector are built from the Z-DOS payload, loaded and checked
+  sector by sector against the payload */
+void imageLoaderTest(JWD1797* jwd1797) {
+  printf("\n\n%s\n\n", "-------------- IMAGE LOADER TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  unsigned char* payload = diskImageToCharArray("Z_DOS_ver1.bin", jwd1797);
+  // offset from an ID address mark to the first data byte of its sector
+  int id_to_data = ID_TO_DATA_OFFSET;
+
+  // 160K single sided raw dump - first 320 sectors of the Z-DOS disk
+  FILE* f = fopen("test_ss.img", "wb");
+  fwrite(payload, 1, 163840, f);
+  fclose(f);
+  JWD1797Config ss_config = {.image_path = "test_ss.img", .no_cache = 1};
+  JWD1797* ss = newJWD1797(&ss_config);
+  printf("%s%d%s%d%s%d\n", "single sided raw - cylinders: ", ss->cylinders,
+    " heads: ", ss->num_heads, " sectors: ", ss->sectors_per_track);
+  int ss_ok = ss->cylinders == 40 && ss->num_heads == 1;
+  for(int cyl = 0; cyl < ss->cylinders && ss_ok; cyl++) {
+    for(int sec = 0; sec < ss->sectors_per_track; sec++) {
+      ss->current_track = cyl;
+      ss->sso_pin = 0;
+      ss->rotational_byte_pointer = ss->image->id_am_offsets[
+        cyl * ss->sectors_per_track + sec] + id_to_data;
+      if(getFDiskByte(ss) != payload[(cyl * 8 + sec) * 512]) {ss_ok = 0;}
+    }
+  }
+  // side 1 of a single sided disk has nothing on it
+  ss->sso_pin = 1;
+  if(getFDiskByte(ss) != 0x00) {ss_ok = 0;}
+  if(ss_ok) {printf("%s\n", "single sided raw layout -- CONFIRMED");}
+  else {printf("%s\n", "single sided raw layout -- WRONG");}
+  freeJWD1797(ss);
+
+  /* IMD - 2 cylinders, 2 heads, sectors 2:1 interleaved. Sector 2 of every
+    track is compressed (filled with 0xE5), sector 7 has deleted data. */
+  unsigned char sector_map[8] = {1, 5, 2, 6, 3, 7, 4, 8};
+  f = fopen("test_imd.imd", "wb");
+  fprintf(f, "IMD 1.18: test image\r\n");
+  fputc(0x1A, f);
+  for(int cyl = 0; cyl < 2; cyl++) {
+    for(int h = 0; h < 2; h++) {
+      // mode 5 (250 kbps MFM), cylinder, head, 8 sectors, 512 bytes
+      unsigned char track_header[5] = {5, cyl, h, 8, 2};
+      fwrite(track_header, 1, 5, f);
+      fwrite(sector_map, 1, 8, f);
+      for(int i = 0; i < 8; i++) {
+        int sec = sector_map[i];
+        if(sec == 2) {fputc(0x02, f); fputc(0xE5, f);}
+        else {
+          fputc(sec == 7 ? 0x03 : 0x01, f);
+          fwrite(payload + ((cyl * 2 + h) * 8 + (sec - 1)) * 512, 1, 512, f);
+        }
+      }
+    }
+  }
+  fclose(f);
+  JWD1797Config imd_config = {.image_path = "test_imd.imd", .no_cache = 1};
+  JWD1797Image* imd = loadJWD1797Image(&imd_config);
+  int imd_ok = imd != NULL && imd->cylinders == 2 && imd->num_heads == 2 &&
+    imd->sectors_per_track == 8;
+  for(int t = 0; imd_ok && t < imd->num_tracks; t++) {
+    unsigned char* track = imd->formattedDiskArray + imd->tracks[t].formatted_offset;
+    for(int i = 0; i < 8; i++) {
+      int sec = sector_map[i];
+      unsigned int id = imd->id_am_offsets[t * imd->sectors_per_track + i];
+      unsigned char* data = track + id + id_to_data;
+      if(track[id + 3] != sec) {imd_ok = 0;}
+      if(sec == 2 && (data[0] != 0xE5 || data[511] != 0xE5)) {imd_ok = 0;}
+      if(sec != 2 && memcmp(data, payload + (t * 8 + (sec - 1)) * 512, 512) != 0) {
+        imd_ok = 0;
+      }
+      // data address mark - deleted (0xF8) for sector 7
+      if(data[-1] != (sec == 7 ? 0xF8 : 0xFB)) {imd_ok = 0;}
+    }
+  }
+  if(imd_ok) {printf("%s\n", "IMD interleaved layout -- CONFIRMED");}
+  else {printf("%s\n", "IMD interleaved layout -- WRONG");}
+  releaseJWD1797Image(imd);
+
+  // IMD with an FM track (mode 2, 250 kbps FM) - the controller only reads MFM
+  f = fopen("test_fm.imd", "wb");
+  fprintf(f, "IMD 1.18: FM image\r\n");
+  fputc(0x1A, f);
+  unsigned char fm_header[5] = {2, 0, 0, 1, 2};
+  fwrite(fm_header, 1, 5, f);
+  fputc(1, f);
+  fputc(0x02, f);
+  fputc(0xE5, f);
+  fclose(f);
+  JWD1797Config fm_config = {.image_path = "test_fm.imd"};
+  JWD1797Image* fm = loadJWD1797Image(&fm_config);
+  if(fm == NULL) {printf("%s\n", "IMD FM track rejected -- CONFIRMED");}
+  else {
+    printf("%s\n", "IMD FM track rejected -- WRONG");
+    releaseJWD1797Image(fm);
+  }
+  // IMD with 2048 byte sectors (size code 4) - beyond the WD1797 ID field
+  f = fopen("test_fm.imd", "wb");
+  fprintf(f, "IMD 1.18: 2048 byte sectors\r\n");
+  fputc(0x1A, f);
+  unsigned char big_header[5] = {5, 0, 0, 1, 4};
+  fwrite(big_header, 1, 5, f);
+  fputc(1, f);
+  fputc(0x02, f);
+  fputc(0xE5, f);
+  fclose(f);
+  JWD1797Image* big = loadJWD1797Image(&fm_config);
+  if(big == NULL) {printf("%s\n", "IMD size code 4 rejected -- CONFIRMED");}
+  else {
+    printf("%s\n", "IMD size code 4 rejected -- WRONG");
+    releaseJWD1797Image(big);
+  }
+
+  remove("test_ss.img");
+  remove("test_imd.imd");
+  remove("test_fm.imd");
+  free(payload);
+  sleep(1);
+}
+
+/* tests a disk with tracks of different layouts - 8 x 512 byte sectors on
+  cylinder 0, 5 x 1024 byte sectors on cylinder 1. Each track has its own
+  length and byte time; stepping between them keeps the angle of the disk. */
+void variableTrackTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- VARIABLE TRACK LAYOUT TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  unsigned char* payload = diskImageToCharArray("Z_DOS_ver1.bin", jwd1797);
+
+  FILE* f = fopen("test_var.imd", "wb");
+  fprintf(f, "IMD 1.18: mixed track layouts\r\n");
+  fputc(0x1A, f);
+  for(int cyl = 0; cyl < 2; cyl++) {
+    int num_sectors = cyl == 0 ? 8 : 5;
+    int size_code = cyl == 0 ? 2 : 3;
+    unsigned char track_header[5] = {5, cyl, 0, num_sectors, size_code};
+    fwrite(track_header, 1, 5, f);
+    for(int sec = 1; sec <= num_sectors; sec++) {fputc(sec, f);}
+    for(int sec = 0; sec < num_sectors; sec++) {
+      fputc(0x01, f);
+      fwrite(payload + (cyl * 4096) + sec * (128 << size_code), 1, 128 << size_code, f);
+    }
+  }
+  fclose(f);
+  JWD1797Config config = {.image_path = "test_var.imd", .no_cache = 1};
+  JWD1797* var = newJWD1797(&config);
+  JWD1797TrackDescriptor* tracks = var->image->tracks;
+  for(int t = 0; t < 2; t++) {
+    printf("%s%d%s%llu%s%u%s%u\n", "track ", t, " - offset: ", tracks[t].formatted_offset,
+      " length: ", tracks[t].formatted_length, " byte time (ns): ", tracks[t].byte_time_ns);
+  }
+  int layout_ok = tracks[1].formatted_offset == tracks[0].formatted_length &&
+    tracks[0].formatted_length != tracks[1].formatted_length;
+
+  // spin for a while on track 0, then step to track 1
+  doJWD1797Cycle(var, 123456.0 + instr_times[rand()%7]);
+  double angle_before = (double)getJWD1797RotationalPhase(var, var->emulated_time_ns) /
+    ((double)var->actual_num_track_bytes * var->rotational_byte_read_limit);
+  var->current_track = 1;
+  doJWD1797Cycle(var, 0.2);
+  double angle_after = (double)getJWD1797RotationalPhase(var, var->emulated_time_ns) /
+    ((double)var->actual_num_track_bytes * var->rotational_byte_read_limit);
+  printf("%s%f | %s%f\n", "angle on track 0: ", angle_before, "angle on track 1: ",
+    angle_after);
+  if(var->actual_num_track_bytes != tracks[1].formatted_length ||
+    var->rotational_byte_read_limit != tracks[1].byte_time_ns ||
+    angle_after - angle_before > 0.001 || angle_before - angle_after > 0.001) {
+    layout_ok = 0;
+  }
+  // every sector of track 1 reads back through the head
+  for(int sec = 0; sec < 5; sec++) {
+    var->rotational_byte_pointer = var->image->id_am_offsets[
+      1 * var->image->sectors_per_track + sec] + ID_TO_DATA_OFFSET;
+    if(getFDiskByte(var) != payload[4096 + sec * 1024]) {layout_ok = 0;}
+  }
+  if(layout_ok) {printf("%s\n", "per-track layout and timing -- CONFIRMED");}
+  else {printf("%s\n", "per-track layout and timing -- WRONG");}
+
+  freeJWD1797(var);
+  remove("test_var.imd");
+  free(payload);
+  sleep(1);
+}
+
+/* tests direct sector access - every sector read through
+  getJWD1797SectorPtr() must match the disk image payload. A write through the
+  writable pointer must be seen by the head of that controller only. */
+void sectorAccessTest(JWD1797* jwd1797) {
+  printf("\n\n%s\n\n", "-------------- SECTOR ACCESS TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  powerOnJWD1797(jwd1797);
+  unsigned char* payload = diskImageToCharArray("Z_DOS_ver1.bin", jwd1797);
+
+  int sectors_ok = 0;
+  int sectors_read = 0;
+  unsigned long payload_pt = 0;
+  for(int cyl = 0; cyl < jwd1797->cylinders; cyl++) {
+    for(int h = 0; h < jwd1797->num_heads; h++) {
+      for(int sec = 1; sec <= jwd1797->sectors_per_track; sec++) {
+        unsigned int len = 0;
+        const unsigned char* data = getJWD1797SectorPtr(jwd1797, cyl, h, sec, &len);
+        if(data != NULL && len == jwd1797->sector_length &&
+          memcmp(data, payload + payload_pt, len) == 0) {sectors_ok++;}
+        sectors_read++;
+        payload_pt += jwd1797->sector_length;
+      }
+    }
+  }
+  printf("%s%d%s%d\n", "sectors matching the payload: ", sectors_ok, " of ", sectors_read);
+  if(sectors_ok == sectors_read) {printf("%s\n", "sector pointers -- CONFIRMED");}
+  else {printf("%s\n", "sector pointers -- WRONG");}
+  // no such sector
+  if(getJWD1797SectorPtr(jwd1797, 0, 0, jwd1797->sectors_per_track + 1, NULL) == NULL &&
+    getJWD1797SectorPtr(jwd1797, jwd1797->cylinders, 0, 1, NULL) == NULL) {
+    printf("%s\n", "missing sectors -- CONFIRMED");
+  }
+  else {printf("%s\n", "missing sectors -- WRONG");}
+
+  // write the first byte of cylinder 3, head 1, sector 5 on a second controller
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* second = newJWD1797(&config);
+  const unsigned char* base = getJWD1797SectorPtr(jwd1797, 3, 1, 5, NULL);
+  unsigned char old_byte = base[0];
+  unsigned char* data = getJWD1797SectorPtrForWrite(second, 3, 1, 5, NULL);
+  data[0] = ~old_byte;
+  // put the head of the second controller over that byte
+  second->current_track = 3;
+  second->sso_pin = 1;
+  second->rotational_byte_pointer = data - second->overlay_tracks[3 * 2 + 1];
+  printf("%s%X | %s%X | %s%d\n", "base: ", base[0], "head: ", getFDiskByte(second),
+    "dirty: ", isJWD1797SectorDirty(second, 3, 1, 5));
+  if(base[0] == old_byte && getFDiskByte(second) == (unsigned char)~old_byte &&
+    isJWD1797SectorDirty(second, 3, 1, 5) && !isJWD1797SectorDirty(second, 3, 1, 4) &&
+    getJWD1797SectorPtr(second, 3, 1, 5, NULL) == data) {
+    printf("%s\n", "sector write -- CONFIRMED");
+  }
+  else {printf("%s\n", "sector write -- WRONG");}
+  freeJWD1797(second);
+  free(payload);
+  sleep(1);
+}
+
+/* tests the high level emulation of READ SECTOR - a multi-record READ SECTOR
+  run through the host DMA callback must deposit the same sectors as the byte
+  level (DRQ) transfer and complete at the same emulated time with the same
+  status, in a fraction of the controller cycles. A deleted data sector reads
+  the same both ways. */
+void hleReadSectorTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- HLE READ SECTOR TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  unsigned char* payload = diskImageToCharArray("Z_DOS_ver1.bin", jwd1797);
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* byte_level = newJWD1797(&config);
+  JWD1797* hle = newJWD1797(&config);
+  unsigned int track_size = jwd1797->sectors_per_track * jwd1797->sector_length;
+  unsigned char* drq_memory = (unsigned char*)calloc(track_size, 1);
+  HLETestMemory dma = {hle, (unsigned char*)calloc(track_size, 1), 0, 0};
+  setJWD1797DMACallback(hle, hleTestDMA, &dma);
+  setJWD1797HLE(hle, 1);
+
+  // same SEEK to cylinder 2 on both controllers - load head, 6 ms step rate
+  JWD1797* both[2] = {byte_level, hle};
+  for(int c = 0; c < 2; c++) {
+    writeJWD1797(both[c], 0xB3, 2);
+    writeJWD1797(both[c], 0xB0, 0b00011000);
+    while(readJWD1797(both[c], 0xB0) & 1) {doJWD1797Cycle(both[c], 1.0);}
+  }
+  // READ SECTOR 1..n - multiple records, side 1
+  unsigned int received = 0;
+  unsigned long byte_cycles = 0;
+  writeJWD1797(byte_level, 0xB2, 1);
+  writeJWD1797(byte_level, 0xB0, 0b10010010);
+  unsigned int status = readJWD1797(byte_level, 0xB0);
+  while(status & 1) {
+    doJWD1797Cycle(byte_level, instr_times[0]);
+    byte_cycles++;
+    status = readJWD1797(byte_level, 0xB0);
+    // DRQ status bit
+    if((status >> 1) & 1) {
+      unsigned char r_byte = (unsigned char)readJWD1797(byte_level, 0xB3);
+      if(received < track_size) {drq_memory[received] = r_byte;}
+      received++;
+    }
+  }
+  unsigned long hle_calls = 0;
+  writeJWD1797(hle, 0xB2, 1);
+  writeJWD1797(hle, 0xB0, 0b10010010);
+  while(hle->statusRegister & 1) {
+    doJWD1797Cycle(hle, 1000.0);
+    hle_calls++;
+  }
+  unsigned long payload_pt = (2 * jwd1797->num_heads + 1) * track_size;
+  long long time_diff_ns = (long long)dma.last_ns - (long long)byte_level->emulated_time_ns;
+  printf("%s%u | %s%u\n", "DRQ bytes: ", received, "DMA bytes: ", dma.received);
+  printf("%s%lu | %s%lu\n", "byte level cycles: ", byte_cycles, "HLE cycles: ", hle_calls);
+  printf("%s%llu | %s%llu\n", "byte level done (ns): ", byte_level->emulated_time_ns,
+    "HLE done (ns): ", dma.last_ns);
+  printf("%s%X | %s%X | %s%X | %s%X\n", "byte level status: ", byte_level->statusRegister,
+    "HLE status: ", hle->statusRegister, "sector reg: ", byte_level->sectorRegister,
+    "HLE sector reg: ", hle->sectorRegister);
+  if(received == track_size && dma.received == track_size &&
+    memcmp(drq_memory, payload + payload_pt, track_size) == 0 &&
+    memcmp(dma.memory, payload + payload_pt, track_size) == 0) {
+    printf("%s\n", "HLE sector data -- CONFIRMED");
+  }
+  else {printf("%s\n", "HLE sector data -- WRONG");}
+  // within the host instruction that saw the last byte level byte
+  if(time_diff_ns <= 0 && time_diff_ns > -2000 && hle->intrq &&
+    hle->statusRegister == byte_level->statusRegister &&
+    hle->sectorRegister == byte_level->sectorRegister) {
+    printf("%s\n", "HLE status and INTRQ timing -- CONFIRMED");
+  }
+  else {printf("%s\n", "HLE status and INTRQ timing -- WRONG");}
+
+  /* READ SECTOR of a deleted data sector (sector 7 of a one track IMD) - both
+    ways return its data with the record type in status bit 5 */
+  FILE* f = fopen("test_del.imd", "wb");
+  fprintf(f, "IMD 1.18: deleted data sector\r\n");
+  fputc(0x1A, f);
+  // mode 5 (250 kbps MFM), cylinder 0, head 0, 8 sectors, 512 bytes
+  unsigned char track_header[5] = {5, 0, 0, 8, 2};
+  fwrite(track_header, 1, 5, f);
+  for(int sec = 1; sec <= 8; sec++) {fputc(sec, f);}
+  for(int sec = 1; sec <= 8; sec++) {
+    fputc(sec == 7 ? 0x03 : 0x01, f);
+    fwrite(payload + (sec - 1) * 512, 1, 512, f);
+  }
+  fclose(f);
+  JWD1797Config del_config = {.image_path = "test_del.imd", .no_cache = 1};
+  JWD1797* del_byte_level = newJWD1797(&del_config);
+  JWD1797* del_hle = newJWD1797(&del_config);
+  HLETestMemory del_dma = {del_hle, (unsigned char*)calloc(track_size, 1), 0, 0};
+  setJWD1797DMACallback(del_hle, hleTestDMA, &del_dma);
+  setJWD1797HLE(del_hle, 1);
+  received = 0;
+  writeJWD1797(del_byte_level, 0xB2, 7);
+  writeJWD1797(del_byte_level, 0xB0, 0b10000000);
+  do {
+    doJWD1797Cycle(del_byte_level, instr_times[0]);
+    status = readJWD1797(del_byte_level, 0xB0);
+    if((status >> 1) & 1) {
+      unsigned char r_byte = (unsigned char)readJWD1797(del_byte_level, 0xB3);
+      if(received < track_size) {drq_memory[received] = r_byte;}
+      received++;
+    }
+  } while(status & 1);
+  writeJWD1797(del_hle, 0xB2, 7);
+  writeJWD1797(del_hle, 0xB0, 0b10000000);
+  while(del_hle->statusRegister & 1) {doJWD1797Cycle(del_hle, 1000.0);}
+  printf("%s%u%s%X | %s%u%s%X\n", "deleted sector byte level: ", received,
+    " bytes, status ", del_byte_level->statusRegister, "HLE: ", del_dma.received,
+    " bytes, status ", del_hle->statusRegister);
+  if(received == 512 && del_dma.received == 512 &&
+    memcmp(drq_memory, payload + 6 * 512, 512) == 0 &&
+    memcmp(del_dma.memory, payload + 6 * 512, 512) == 0 &&
+    (del_byte_level->statusRegister & 0b00110000) == 0b00100000 &&
+    del_hle->statusRegister == del_byte_level->statusRegister) {
+    printf("%s\n", "deleted data sector byte level and HLE -- CONFIRMED");
+  }
+  else {printf("%s\n", "deleted data sector byte level and HLE -- WRONG");}
+  freeJWD1797(del_byte_level);
+  freeJWD1797(del_hle);
+  free(del_dma.memory);
+  remove("test_del.imd");
+
+  freeJWD1797(byte_level);
+  freeJWD1797(hle);
+  free(drq_memory);
+  free(dma.memory);
+  free(payload);
+  sleep(1);
+}
+
+/* host DMA callback of the HLE READ SECTOR test - copies the sector to guest
+  memory and notes the emulated time of the transfer */
+void hleTestDMA(void* context, const unsigned char* data, unsigned int len) {
+  HLETestMemory* dma = (HLETestMemory*)context;
+  unsigned int track_size = dma->w->sectors_per_track * dma->w->sector_length;
+  if(dma->received + len <= track_size) {memcpy(dma->memory + dma->received, data, len);}
+  dma->received += len;
+  dma->last_ns = dma->w->emulated_time_ns;
+}
+
+/* tests a multi-record READ SECTOR - every sector after the first is reached
+  through the track layout. The first byte of each sector must be handed over
+  while that exact byte is under the head, and all sectors must match the
+  payload. */
+void multiRecordReadTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- MULTI-RECORD READ SECTOR TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  unsigned char* payload = diskImageToCharArray("Z_DOS_ver1.bin", jwd1797);
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* w = newJWD1797(&config);
+  unsigned int track_size = w->sectors_per_track * w->sector_length;
+  unsigned char* memory = (unsigned char*)calloc(track_size, 1);
+
+  // SEEK to cylinder 5 - load head, 6 ms step rate
+  writeJWD1797(w, 0xB3, 5);
+  writeJWD1797(w, 0xB0, 0b00011000);
+  while(readJWD1797(w, 0xB0) & 1) {doJWD1797Cycle(w, instr_times[0]);}
+  // READ SECTOR 1..n - multiple records, side 0
+  writeJWD1797(w, 0xB2, 1);
+  writeJWD1797(w, 0xB0, 0b10010000);
+  unsigned int received = 0;
+  int positions_ok = 0;
+  unsigned int status = readJWD1797(w, 0xB0);
+  while(status & 1) {
+    doJWD1797Cycle(w, instr_times[0]);
+    status = readJWD1797(w, 0xB0);
+    // DRQ status bit
+    if((status >> 1) & 1) {
+      // first byte of a sector - the head must be over its first data byte
+      if(received % w->sector_length == 0) {
+        int n = findJWD1797Sector(w, 5, 0, received / w->sector_length + 1);
+        unsigned long data_byte = w->image->id_am_offsets[(5 * w->num_heads)
+          * w->sectors_per_track + n] + ID_TO_DATA_OFFSET;
+        printf("%s%u%s%lu%s%lu\n", "sector ", received / w->sector_length + 1,
+          " - head: ", w->rotational_byte_pointer, " data field: ", data_byte);
+        if(w->rotational_byte_pointer == data_byte) {positions_ok++;}
+      }
+      unsigned char r_byte = (unsigned char)readJWD1797(w, 0xB3);
+      if(received < track_size) {memory[received] = r_byte;}
+      received++;
+    }
+  }
+  unsigned long payload_pt = (5 * w->num_heads) * track_size;
+  printf("%s%u | %s%X | %s%X\n", "bytes: ", received, "status: ", w->statusRegister,
+    "sector reg: ", w->sectorRegister);
+  if(received == track_size && positions_ok == w->sectors_per_track &&
+    memcmp(memory, payload + payload_pt, track_size) == 0 &&
+    w->statusRegister == 0 && w->sectorRegister == w->sectors_per_track + 1) {
+    printf("%s\n", "multi-record read from the track layout -- CONFIRMED");
+  }
+  else {printf("%s\n", "multi-record read from the track layout -- WRONG");}
+
+  freeJWD1797(w);
+  free(memory);
+  free(payload);
+  sleep(1);
+}
+
+/* tests the address mark scanner and the layout index built from it. The
+  scalar, SSE2 and AVX2 scanners must find the same marks (also across vector
+  block boundaries), indexing every formatted track must give back the layout
+  of the formatter, and a rewritten overlay track must be indexed again. */
+void markScannerTest(JWD1797* jwd1797) {
+  printf("\n\n%s\n\n", "-------------- ADDRESS MARK SCANNER TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  printf("%s%s\n", "scanner: ", getAddressMarkScannerName());
+
+  // a mark at every offset from a block boundary, with payload around it
+  unsigned char buffer[256];
+  unsigned int scalar_marks[64], sse2_marks[64], avx2_marks[64];
+  int scanners_ok = 1;
+  for(int at = 0; at < 70; at++) {
+    for(int i = 0; i < 256; i++) {buffer[i] = (unsigned char)(i * 7);}
+    buffer[at] = 0xA1; buffer[at + 1] = 0xA1; buffer[at + 2] = 0xA1;
+    buffer[at + 3] = at % 2 ? 0xFE : 0xFB;
+    buffer[200] = 0xA1; buffer[201] = 0xA1; buffer[202] = 0xA1; buffer[203] = 0xF8;
+    unsigned int len = 120 + at;
+    unsigned int found = scanAddressMarksScalar(buffer, len, 0, scalar_marks, 64);
+    if(found != 1 || scalar_marks[0] != at + 3 ||
+      scanAddressMarksSSE2(buffer, len, 0, sse2_marks, 64) != found ||
+      scanAddressMarksAVX2(buffer, len, 0, avx2_marks, 64) != found ||
+      sse2_marks[0] != at + 3 || avx2_marks[0] != at + 3 ||
+      scanAddressMarks(buffer, 256, 0, scalar_marks, 64) != 2) {scanners_ok = 0;}
+  }
+  if(scanners_ok) {printf("%s\n", "scalar, SSE2 and AVX2 scanners -- CONFIRMED");}
+  else {printf("%s\n", "scalar, SSE2 and AVX2 scanners -- WRONG");}
+
+  // index every track of the formatted disk and compare with the formatter
+  JWD1797Image* img = jwd1797->image;
+  int tracks_ok = 0;
+  for(int t = 0; t < img->num_tracks; t++) {
+    JWD1797TrackDescriptor* base = &img->tracks[t];
+    JWD1797TrackDescriptor scanned = *base;
+    unsigned int offsets[JWD1797_MAX_SECTORS_PER_TRACK];
+    int n = indexJWD1797Track(img->formattedDiskArray + base->formatted_offset,
+      base->formatted_length, &scanned, offsets, img->sectors_per_track);
+    int ok = n == base->num_sectors && scanned.sector_length == base->sector_length;
+    for(int sec = 0; ok && sec < n; sec++) {
+      if(offsets[sec] != img->id_am_offsets[t * img->sectors_per_track + sec] ||
+        scanned.sector_ids[sec] != base->sector_ids[sec] ||
+        scanned.id_cylinders[sec] != base->id_cylinders[sec] ||
+        scanned.id_heads[sec] != base->id_heads[sec] ||
+        scanned.sector_flags[sec] != base->sector_flags[sec]) {ok = 0;}
+    }
+    tracks_ok += ok;
+  }
+  printf("%s%d%s%u\n", "tracks indexed like the formatter: ", tracks_ok, " of ",
+    img->num_tracks);
+  if(tracks_ok == img->num_tracks) {printf("%s\n", "track layout index -- CONFIRMED");}
+  else {printf("%s\n", "track layout index -- WRONG");}
+
+  /* rewrite cylinder 2, head 0 on a second controller: a mark inside the data
+    of sector 1 must stay payload, sector 3 is renumbered 0x33 */
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = img};
+  JWD1797* second = newJWD1797(&config);
+  unsigned char* data = getJWD1797SectorPtrForWrite(second, 2, 0, 1, NULL);
+  data[100] = 0xA1; data[101] = 0xA1; data[102] = 0xA1; data[103] = 0xFE;
+  unsigned int id_am = img->id_am_offsets[(2 * second->num_heads) * second->sectors_per_track
+    + findJWD1797Sector(second, 2, 0, 3)];
+  unsigned char* track = getFDiskTrackForWrite(second, 2, 0);
+  track[id_am + 3] = 0x33;
+  const unsigned char* moved = getJWD1797SectorPtr(second, 2, 0, 0x33, NULL);
+  printf("%s%d | %s%d | %s%d\n", "sector 0x33: ", findJWD1797Sector(second, 2, 0, 0x33),
+    "sector 3: ", findJWD1797Sector(second, 2, 0, 3), "sector 8: ",
+    findJWD1797Sector(second, 2, 0, 8));
+  if(moved == track + id_am + ID_TO_DATA_OFFSET && findJWD1797Sector(second, 2, 0, 3) < 0 &&
+    findJWD1797Sector(second, 2, 0, 8) == 7 && findJWD1797Sector(jwd1797, 2, 0, 3) >= 0) {
+    printf("%s\n", "rewritten track reindexed -- CONFIRMED");
+  }
+  else {printf("%s\n", "rewritten track reindexed -- WRONG");}
+  freeJWD1797(second);
+  sleep(1);
+}
+
+/* tests the activity tracer - a SEEK with verify and a READ SECTOR with E
+  delay must show up as balanced command and phase events with every phase
+  in between, DRQ as a pin counter, time stamps in emulated time order, and
+  export as Chrome trace JSON */
+void tracerTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- TRACER TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* w = newJWD1797(&config);
+  JWD1797Tracer* tracer = newJWD1797Tracer(1 << 18);
+  setJWD1797Tracer(w, tracer, 1);
+
+  // SEEK cylinder 1 - load head, verify, 6 ms step rate
+  writeJWD1797(w, 0xB3, 1);
+  writeJWD1797(w, 0xB0, 0b00011100);
+  while(readJWD1797(w, 0xB0) & 1) {doJWD1797Cycle(w, instr_times[0]);}
+  // READ SECTOR 2 - E delay, side 0
+  writeJWD1797(w, 0xB2, 2);
+  writeJWD1797(w, 0xB0, 0b10000100);
+  unsigned int status;
+  do {
+    doJWD1797Cycle(w, instr_times[0]);
+    status = readJWD1797(w, 0xB0);
+    if((status >> 1) & 1) {readJWD1797(w, 0xB3);}
+  } while(status & 1);
+  setJWD1797Tracer(w, NULL, 0);
+
+  const char* phases[6] = {"step", "settle", "E delay", "IDAM search", "DAM search",
+    "data transfer"};
+  int phases_seen[6] = {0, 0, 0, 0, 0, 0};
+  int commands_begun = 0, commands_ended = 0, phases_begun = 0, phases_ended = 0;
+  int drq_events = 0, in_order = 1;
+  unsigned long count = getJWD1797TraceEventCount(tracer);
+  for(unsigned long i = 0; i < count; i++) {
+    JWD1797TraceEvent* e = &tracer->events[i];
+    if(i > 0 && e->ts_ns < tracer->events[i - 1].ts_ns) {in_order = 0;}
+    if(strcmp(e->kind->category, "command") == 0 && e->phase == 'B') {commands_begun++;}
+    if(strcmp(e->kind->category, "command") == 0 && e->phase == 'E') {commands_ended++;}
+    if(strcmp(e->kind->category, "phase") == 0 && e->phase == 'B') {
+      phases_begun++;
+      for(int p = 0; p < 6; p++) {if(strcmp(e->name, phases[p]) == 0) {phases_seen[p] = 1;}}
+    }
+    if(strcmp(e->kind->category, "phase") == 0 && e->phase == 'E') {phases_ended++;}
+    if(strcmp(e->name, "DRQ") == 0) {drq_events++;}
+  }
+  int all_phases = 1;
+  for(int p = 0; p < 6; p++) {all_phases &= phases_seen[p];}
+  printf("%s%lu | %s%lu\n", "events: ", count, "dropped: ", getJWD1797TraceDropped(tracer));
+  printf("%s%d/%d | %s%d/%d | %s%d\n", "commands begun/ended: ", commands_begun,
+    commands_ended, "phases begun/ended: ", phases_begun, phases_ended,
+    "DRQ events: ", drq_events);
+  if(commands_begun == 2 && commands_ended == 2 && phases_begun == phases_ended &&
+    all_phases && drq_events >= 2 * w->sector_length && in_order) {
+    printf("%s\n", "command, phase and pin events -- CONFIRMED");
+  }
+  else {printf("%s\n", "command, phase and pin events -- WRONG");}
+
+  char head[32] = {0};
+  int written = writeJWD1797Trace(tracer, "test_trace.json") == 0;
+  FILE* f = fopen("test_trace.json", "r");
+  if(f != NULL) {
+    if(fread(head, 1, 31, f) == 0) {written = 0;}
+    fclose(f);
+  }
+  printf("%s%s\n", "trace file: ", head);
+  if(written && strncmp(head, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 31) == 0) {
+    printf("%s\n", "Chrome trace export -- CONFIRMED");
+  }
+  else {printf("%s\n", "Chrome trace export -- WRONG");}
+  remove("test_trace.json");
+  freeJWD1797Tracer(tracer);
+  freeJWD1797(w);
+  sleep(1);
+}
+
+/* tests the VCD pin waveform dump of a SEEK, a READ SECTOR and two idle
+  revolutions: the index pulses are a rotation apart, the head steps in (DIRC high), DRQ pulses
+  once per data byte and the time stamps never go back */
+void vcdWriterTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- VCD WRITER TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* w = newJWD1797(&config);
+  JWD1797VCDWriter* vcd = openJWD1797VCD("test_pins.vcd", "jwd1797");
+  int attached = vcd != NULL && setJWD1797VCD(w, vcd) == 0;
+
+  // SEEK cylinder 1 - load head, verify, 6 ms step rate
+  writeJWD1797(w, 0xB3, 1);
+  writeJWD1797(w, 0xB0, 0b00011100);
+  while(readJWD1797(w, 0xB0) & 1) {doJWD1797Cycle(w, instr_times[0]);}
+  // READ SECTOR 2 - side 0
+  writeJWD1797(w, 0xB2, 2);
+  writeJWD1797(w, 0xB0, 0b10000000);
+  unsigned int status;
+  do {
+    doJWD1797Cycle(w, instr_times[0]);
+    status = readJWD1797(w, 0xB0);
+    if((status >> 1) & 1) {readJWD1797(w, 0xB3);}
+  } while(status & 1);
+  // two more revolutions with the drive idle
+  unsigned long long idle_end = w->emulated_time_ns +
+    2ULL * w->actual_num_track_bytes * w->rotational_byte_read_limit;
+  while(w->emulated_time_ns < idle_end) {doJWD1797Cycle(w, instr_times[0]);}
+  setJWD1797VCD(w, NULL);
+  unsigned long changes = attached ? getJWD1797VCDChanges(vcd) : 0;
+  int closed = closeJWD1797VCD(vcd) == 0;
+
+  unsigned long long period_ns = (unsigned long long)w->actual_num_track_bytes *
+    w->rotational_byte_read_limit;
+  unsigned long long now = 0, last_ip_rise = 0;
+  int header = 0, in_order = 1, ip_rises = 0, ip_spacing_ok = 1, dirc_high = 0;
+  int drq_rises = 0;
+  char line[128];
+  FILE* f = fopen("test_pins.vcd", "r");
+  while(f != NULL && fgets(line, sizeof(line), f) != NULL) {
+    if(strncmp(line, "$enddefinitions", 15) == 0) {header = 1;}
+    else if(line[0] == '#') {
+      unsigned long long t = strtoull(line + 1, NULL, 10);
+      if(t < now) {in_order = 0;}
+      now = t;
+    }
+    // identifiers: ! IP, " HLD, # HLT, $ DIRC, % SSO, & TG43, ' DRQ, ( INTRQ
+    else if(strcmp(line, "1!\n") == 0) {
+      if(ip_rises > 0 && now - last_ip_rise != period_ns) {ip_spacing_ok = 0;}
+      last_ip_rise = now;
+      ip_rises++;
+    }
+    else if(strcmp(line, "1$\n") == 0) {dirc_high = 1;}
+    else if(strcmp(line, "1'\n") == 0) {drq_rises++;}
+  }
+  if(f != NULL) {fclose(f);}
+  remove("test_pins.vcd");
+  printf("%s%lu | %s%d | %s%d | %s%d\n", "value changes: ", changes,
+    "IP pulses: ", ip_rises, "DRQ pulses: ", drq_rises, "DIRC high: ", dirc_high);
+  if(attached && closed && header && in_order && ip_rises >= 2 && ip_spacing_ok &&
+    dirc_high && drq_rises == w->sector_length) {
+    printf("%s\n", "pin waveform dump -- CONFIRMED");
+  }
+  else {printf("%s\n", "pin waveform dump -- WRONG");}
+  freeJWD1797(w);
+  sleep(1);
+}
+
+// what a track sink of trackCaptureTest() received
+typedef struct {
+  unsigned char* data;
+  unsigned long bytes;
+  int chunks;
+  int tracks;             // chunks flagged last
+  int chunk_too_big;
+  int wrong_track;        // a track did not match the formatted bytes
+  int cylinder;
+  int head;
+  JWD1797* w;
+} CaptureResult;
+
+void captureTestSink(void* context, int cylinder, int head,
+  const unsigned char* data, unsigned int len, int last) {
+  CaptureResult* c = (CaptureResult*)context;
+  if(c->data != NULL) {memcpy(c->data + c->bytes, data, len);}
+  if(c->w != NULL && last) {
+    unsigned int length;
+    const unsigned char* track = getJWD1797TrackData(c->w,
+      cylinder * c->w->num_heads + head, &length);
+    if(length != len || memcmp(track, data, len) != 0) {c->wrong_track = 1;}
+  }
+  if(len > JWD1797_TRACK_SINK_CHUNK) {c->chunk_too_big = 1;}
+  c->bytes += len;
+  c->chunks++;
+  c->tracks += last;
+  c->cylinder = cylinder;
+  c->head = head;
+}
+
+/* tests the READ TRACK sink: capturing the whole disk hands every formatted
+  track over unchanged, a byte level READ TRACK streams the same bytes the
+  host reads through DRQ in bounded chunks, and the file sink writes the
+  whole disk */
+void trackCaptureTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- TRACK CAPTURE TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* w = newJWD1797(&config);
+
+  // whole disk without emulation
+  CaptureResult disk = {NULL, 0, 0, 0, 0, 0, 0, 0, w};
+  int tracks = captureJWD1797Disk(w, captureTestSink, &disk);
+  printf("%s%d | %s%lu | %s%lu\n", "tracks: ", tracks, "bytes: ", disk.bytes,
+    "disk bytes: ", w->image->formatted_disk_size);
+  if(tracks == w->image->num_tracks && disk.tracks == tracks && !disk.wrong_track &&
+    disk.bytes == w->image->formatted_disk_size) {
+    printf("%s\n", "disk capture -- CONFIRMED");
+  }
+  else {printf("%s\n", "disk capture -- WRONG");}
+
+  // byte level READ TRACK of cylinder 1 side 1 with the sink attached
+  unsigned char* streamed = (unsigned char*)malloc(2 * w->actual_num_track_bytes);
+  unsigned char* polled = (unsigned char*)malloc(2 * w->actual_num_track_bytes);
+  CaptureResult track = {streamed, 0, 0, 0, 0, 0, 0, 0, NULL};
+  setJWD1797TrackSink(w, captureTestSink, &track);
+  // SEEK cylinder 1 - load head, 6 ms step rate
+  writeJWD1797(w, 0xB3, 1);
+  writeJWD1797(w, 0xB0, 0b00011000);
+  while(readJWD1797(w, 0xB0) & 1) {doJWD1797Cycle(w, instr_times[0]);}
+  // READ TRACK - side 1
+  writeJWD1797(w, 0xB0, 0b11100010);
+  unsigned long polled_bytes = 0;
+  unsigned int status;
+  do {
+    doJWD1797Cycle(w, instr_times[0]);
+    status = readJWD1797(w, 0xB0);
+    if((status >> 1) & 1) {polled[polled_bytes++] = readJWD1797(w, 0xB3);}
+  } while(status & 1);
+  setJWD1797TrackSink(w, NULL, NULL);
+  printf("%s%lu | %s%lu | %s%d | %s%d\n", "polled: ", polled_bytes,
+    "streamed: ", track.bytes, "chunks: ", track.chunks, "tracks: ", track.tracks);
+  if(polled_bytes > 0 && track.bytes == polled_bytes &&
+    memcmp(streamed, polled, polled_bytes) == 0 && track.tracks == 1 &&
+    track.chunks == (int)((polled_bytes + JWD1797_TRACK_SINK_CHUNK - 1) /
+    JWD1797_TRACK_SINK_CHUNK) && !track.chunk_too_big &&
+    track.cylinder == 1 && track.head == 1) {
+    printf("%s\n", "READ TRACK stream -- CONFIRMED");
+  }
+  else {printf("%s\n", "READ TRACK stream -- WRONG");}
+  free(streamed);
+  free(polled);
+
+  // whole disk into a file
+  long file_size = -1;
+  FILE* f = fopen("test_tracks.bin", "wb");
+  if(f != NULL) {
+    captureJWD1797Disk(w, writeJWD1797TrackFile, f);
+    fclose(f);
+    f = fopen("test_tracks.bin", "rb");
+    fseek(f, 0, SEEK_END);
+    file_size = ftell(f);
+    fclose(f);
+    remove("test_tracks.bin");
+  }
+  printf("%s%ld\n", "file size: ", file_size);
+  if(file_size == (long)w->image->formatted_disk_size) {
+    printf("%s\n", "disk image file -- CONFIRMED");
+  }
+  else {printf("%s\n", "disk image file -- WRONG");}
+  freeJWD1797(w);
+  sleep(1);
+}
+
+/* tests the track verifier: every track of the formatted disk passes, and a
+  copy of a track with a bad ID CRC, an unknown length code, a lost data
+  address mark, a duplicated sector number and a bad data CRC reports each of
+  them */
+void verifyTrackTest(JWD1797* jwd1797) {
+  printf("\n\n%s\n\n", "-------------- TRACK VERIFIER TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Image* img = jwd1797->image;
+  JWD1797TrackReport r;
+  unsigned long errors = 0, sectors = 0;
+  for(int t = 0; t < img->num_tracks; t++) {
+    errors += verifyJWD1797Track(img->formattedDiskArray + img->tracks[t].formatted_offset,
+      img->tracks[t].formatted_length, &img->tracks[t], &r);
+    sectors += r.sectors;
+  }
+  printf("%s%lu | %s%lu\n", "sectors: ", sectors, "errors: ", errors);
+  if(errors == 0 && sectors == img->num_tracks * img->sectors_per_track) {
+    printf("%s\n", "formatted disk verified -- CONFIRMED");
+  }
+  else {printf("%s\n", "formatted disk verified -- WRONG");}
+
+  // damaged copy of track 1 (cylinder 0, side 1)
+  JWD1797TrackDescriptor* t = &img->tracks[1];
+  unsigned char* track = (unsigned char*)malloc(t->formatted_length);
+  memcpy(track, img->formattedDiskArray + t->formatted_offset, t->formatted_length);
+  // ID mark of sector n in marks[2n], its data mark in marks[2n + 1]
+  unsigned int marks[4 * JWD1797_MAX_SECTORS_PER_TRACK];
+  unsigned int num_marks = scanAddressMarks(track, t->formatted_length, 0, marks,
+    4 * JWD1797_MAX_SECTORS_PER_TRACK);
+  if(num_marks >= 12) {
+    // ID field: mark, cylinder, head, sector, length code, CRC1, CRC2
+    track[marks[2] + 5] = 0x00;                     // sector 1: ID CRC
+    track[marks[4] + 4] = 0x07;                     // sector 2: length code
+    track[marks[7]] = 0x4E;                         // sector 3: data mark
+    track[marks[8] + 3] = track[marks[0] + 3];      // sector 4: sector number
+    track[marks[11] + 1 + t->sector_length] = 0x00; // sector 5: data CRC
+  }
+  verifyJWD1797Track(track, t->formatted_length, t, &r);
+  free(track);
+  printf("%s%u | %s%u | %s%u | %s%u | %s%u | %s%u | %s%u | %s%u\n",
+    "bad ID CRC: ", r.bad_id_crc, "bad length: ", r.bad_length, "no data: ",
+    r.no_data, "duplicates: ", r.duplicates, "bad ID: ", r.bad_id, "missing: ",
+    r.missing, "bad data CRC: ", r.bad_data_crc, "errors: ", r.errors);
+  if(r.bad_id_crc == 1 && r.bad_length == 1 && r.no_data == 1 && r.duplicates == 1 &&
+    r.bad_id == 2 && r.missing == 1 && r.bad_data_crc == 1 && r.errors == 8) {
+    printf("%s\n", "damaged track reported -- CONFIRMED");
+  }
+  else {printf("%s\n", "damaged track reported -- WRONG");}
+  sleep(1);
+}
+
+/* tests the analytic TYPE I step deadlines: a SEEK steps exactly one step
+  rate apart from the command start with fine instruction times, and coarse
+  time slices covering several step deadlines step the head at each of them */
+void stepDeadlineTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- STEP DEADLINE TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* w = newJWD1797(&config);
+  unsigned long long step_ns = 6000000ULL;
+  unsigned long long slice_ns = (unsigned long long)(instr_times[0]*1000.0 + 0.5);
+
+  // SEEK cylinder 3 - no head load, 6 ms step rate
+  writeJWD1797(w, 0xB3, 3);
+  writeJWD1797(w, 0xB0, 0b00010000);
+  unsigned long long start_ns = w->emulated_time_ns;
+  int on_time = 1, track = w->current_track, done_intrq = 0;
+  while(readJWD1797(w, 0xB0) & 1) {
+    doJWD1797Cycle(w, instr_times[0]);
+    // reading the status register clears INTRQ - sample it first
+    done_intrq = w->intrq;
+    if(w->current_track != track) {
+      track = w->current_track;
+      // the step happened in the slice that just ended
+      unsigned long long due_ns = start_ns + track * step_ns;
+      if(w->emulated_time_ns < due_ns || w->emulated_time_ns >= due_ns + slice_ns) {
+        on_time = 0;
+      }
+    }
+  }
+  // the command ends in the slice of its last step, not the one after it
+  unsigned long long last_ns = start_ns + 3 * step_ns;
+  int done_on_time = w->emulated_time_ns >= last_ns &&
+    w->emulated_time_ns < last_ns + slice_ns && done_intrq;
+  printf("%s%d | %s%d | %s%d | %s%d\n", "track: ", w->current_track, "track register: ",
+    w->trackRegister, "steps on time: ", on_time, "done on time: ", done_on_time);
+  if(w->current_track == 3 && w->trackRegister == 3 && on_time && done_on_time) {
+    printf("%s\n", "step deadlines -- CONFIRMED");
+  }
+  else {printf("%s\n", "step deadlines -- WRONG");}
+
+  // back to track 0, then SEEK cylinder 5 in 10 ms slices
+  writeJWD1797(w, 0xB0, 0b00000000);
+  while(readJWD1797(w, 0xB0) & 1) {doJWD1797Cycle(w, instr_times[0]);}
+  writeJWD1797(w, 0xB3, 5);
+  writeJWD1797(w, 0xB0, 0b00010000);
+  int tracks[3];
+  for(int i = 0; i < 3; i++) {
+    doJWD1797Cycle(w, 10000.0);
+    tracks[i] = w->current_track;
+  }
+  // the last step lands on the end of the third slice and ends the command there
+  int intrq = w->intrq;
+  unsigned int status = readJWD1797(w, 0xB0);
+  printf("%s%d%s%d%s%d | %s%d | %s%02X\n", "tracks after 10/20/30 ms: ", tracks[0],
+    "/", tracks[1], "/", tracks[2], "DIRC: ", w->direction_pin, "status: ", status);
+  if(tracks[0] == 1 && tracks[1] == 3 && tracks[2] == 5 && w->direction_pin == 1 &&
+    !(status & 1) && !(status & 0x04) && intrq) {
+    printf("%s\n", "coarse slice stepping -- CONFIRMED");
+  }
+  else {printf("%s\n", "coarse slice stepping -- WRONG");}
+  freeJWD1797(w);
+  sleep(1);
+}
+
+/* tests the arena allocator: allocations are zeroed, cache line aligned and
+  do not overlap, a large allocation gets a block of its own, huge page
+  arenas come in whole huge pages, and controllers and images live in their
+  arenas */
+void arenaTest(JWD1797* jwd1797) {
+  printf("\n\n%s\n\n", "-------------- ARENA TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Arena* arena = newJWD1797Arena(4096, 0);
+  unsigned char* blocks[16];
+  int aligned = 1, zeroed = 1, apart = 1;
+  for(int i = 0; i < 16; i++) {
+    unsigned long size = 1 + i * 100;
+    blocks[i] = (unsigned char*)allocJWD1797Arena(arena, size);
+    if((unsigned long)blocks[i] % JWD1797_ARENA_ALIGN != 0) {aligned = 0;}
+    for(unsigned long b = 0; b < size; b++) {if(blocks[i][b] != 0) {zeroed = 0;}}
+    memset(blocks[i], 0xFF, size);
+    // a new allocation never lands in an earlier one
+    for(int j = 0; j < i; j++) {
+      if(blocks[i] < blocks[j] + 1 + j * 100 && blocks[j] < blocks[i] + size) {apart = 0;}
+    }
+  }
+  unsigned long before = getJWD1797ArenaSize(arena);
+  unsigned char* large = (unsigned char*)allocJWD1797Arena(arena, 100000);
+  unsigned long after = getJWD1797ArenaSize(arena);
+  // small allocations still come from the current block
+  unsigned char* small = (unsigned char*)allocJWD1797Arena(arena, 8);
+  int small_near = small > blocks[15] && small < blocks[15] + 4096;
+  printf("%s%d | %s%d | %s%d | %s%lu%s%lu | %s%d\n", "aligned: ", aligned,
+    "zeroed: ", zeroed, "apart: ", apart, "size: ", before, " -> ", after,
+    "small allocations stay: ", small_near);
+  if(aligned && zeroed && apart && large != NULL &&
+    (unsigned long)large % JWD1797_ARENA_ALIGN == 0 && after >= before + 100000 &&
+    small_near) {
+    printf("%s\n", "arena allocations -- CONFIRMED");
+  }
+  else {printf("%s\n", "arena allocations -- WRONG");}
+  freeJWD1797Arena(arena);
+
+  // huge pages - explicit ones if reserved, transparent ones otherwise
+  arena = newJWD1797Arena(1 << 20, JWD1797_ARENA_HUGE_PAGES);
+  unsigned char* huge = arena == NULL ? NULL :
+    (unsigned char*)allocJWD1797Arena(arena, 1 << 20);
+  unsigned long huge_size = arena == NULL ? 0 : getJWD1797ArenaSize(arena);
+  printf("%s%lu | %s%d\n", "huge page arena size: ", huge_size,
+    "explicit huge pages: ", arena == NULL ? 0 : arena->huge_pages);
+  if(huge != NULL && huge_size % JWD1797_HUGE_PAGE_SIZE == 0) {
+    huge[(1 << 20) - 1] = 1;
+    printf("%s\n", "huge page arena -- CONFIRMED");
+  }
+  else {printf("%s\n", "huge page arena -- WRONG");}
+  freeJWD1797Arena(arena);
+
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .huge_pages = 1};
+  JWD1797* w = newJWD1797(&config);
+  // a formatted disk mapped from the image cache is not in the arena
+  printf("%s%d | %s%d | %s%d\n", "controller aligned: ",
+    (unsigned long)w % JWD1797_ARENA_ALIGN == 0, "formatted disk aligned: ",
+    (unsigned long)w->formattedDiskArray % JWD1797_ARENA_ALIGN == 0,
+    "cache mapped: ", w->image->cache_map != NULL);
+  if(w->arena != NULL && w->image->arena != NULL &&
+    (unsigned long)w % JWD1797_ARENA_ALIGN == 0 &&
+    (w->image->cache_map != NULL ||
+    (unsigned long)w->formattedDiskArray % JWD1797_ARENA_ALIGN == 0)) {
+    printf("%s\n", "controller and image arenas -- CONFIRMED");
+  }
+  else {printf("%s\n", "controller and image arenas -- WRONG");}
+  freeJWD1797(w);
+  sleep(1);
+}
+
+/* tests the controller pool - a controller that ran a command and wrote a
+  sector comes back from the pool in the reset state of a new controller, with
+  the disk reading back as the shared base image */
+void controllerPoolTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- CONTROLLER POOL TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  int refs = jwd1797->image->ref_count;
+  JWD1797Pool* pool = newJWD1797Pool(&config, 2);
+  JWD1797* fresh = newJWD1797(&config);
+
+  JWD1797* w = acquireJWD1797(pool);
+  const unsigned char* base = getJWD1797SectorPtr(w, 5, 0, 1, NULL);
+  unsigned char base_byte = base[0];
+  // SEEK cylinder 5 - load head, 6 ms step rate - then write sector 1
+  writeJWD1797(w, 0xB3, 5);
+  writeJWD1797(w, 0xB0, 0b00011000);
+  while(readJWD1797(w, 0xB0) & 1) {doJWD1797Cycle(w, instr_times[0]);}
+  setJWD1797Quantum(w, 100.0);
+  getJWD1797SectorPtrForWrite(w, 5, 0, 1, NULL)[0] = ~base_byte;
+  printf("%s%d | %s%d | %s%d\n", "used - track reg: ", w->trackRegister,
+    "dirty tracks: ", w->num_dirty_tracks, "sector dirty: ",
+    isJWD1797SectorDirty(w, 5, 0, 1));
+  returnJWD1797(pool, w);
+
+  JWD1797* again = acquireJWD1797(pool);
+  printf("%s%d | %s%d | %s%X | %s%llu | %s%d\n", "reused: ", again == w,
+    "track reg: ", again->trackRegister, "status reg: ", again->statusRegister,
+    "time ns: ", again->emulated_time_ns, "dirty tracks: ", again->num_dirty_tracks);
+  if(again == w && again->trackRegister == fresh->trackRegister &&
+    again->current_track == fresh->current_track &&
+    again->statusRegister == fresh->statusRegister &&
+    again->commandRegister == fresh->commandRegister &&
+    again->sectorRegister == fresh->sectorRegister &&
+    again->emulated_time_ns == fresh->emulated_time_ns &&
+    again->rotational_byte_pointer == fresh->rotational_byte_pointer &&
+    again->cycle_quantum_ns == fresh->cycle_quantum_ns &&
+    again->active_track_data == fresh->active_track_data) {
+    printf("%s\n", "restored to reset state -- CONFIRMED");
+  }
+  else {printf("%s\n", "restored to reset state -- WRONG");}
+  if(again->num_dirty_tracks == 0 && !isJWD1797SectorDirty(again, 5, 0, 1) &&
+    getJWD1797SectorPtr(again, 5, 0, 1, NULL)[0] == base_byte) {
+    printf("%s\n", "written sector dropped -- CONFIRMED");
+  }
+  else {printf("%s\n", "written sector dropped -- WRONG");}
+
+  // more controllers than the pool keeps - the extra ones are made and freed
+  JWD1797* second = acquireJWD1797(pool);
+  JWD1797* third = acquireJWD1797(pool);
+  returnJWD1797(pool, again);
+  returnJWD1797(pool, second);
+  returnJWD1797(pool, third);
+  printf("%s%lu | %s%lu | %s%d\n", "created: ", pool->created, "reused: ",
+    pool->reused, "idle: ", pool->num_idle);
+  if(pool->created == 3 && pool->reused == 3 && pool->num_idle == 2) {
+    printf("%s\n", "pool sizing -- CONFIRMED");
+  }
+  else {printf("%s\n", "pool sizing -- WRONG");}
+  freeJWD1797Pool(pool);
+  freeJWD1797(fresh);
+  printf("%s%d\n", "image references: ", jwd1797->image->ref_count);
+  if(jwd1797->image->ref_count == refs) {
+    printf("%s\n", "image references released -- CONFIRMED");
+  }
+  else {printf("%s\n", "image references released -- WRONG");}
+  sleep(1);
+}
+
+/* tests the threaded front end - the same SEEK and READ SECTOR run on a
+  controller thread (status polled after every instruction) and directly must
+  read the same bytes and end in the same state at the same emulated time.
+  Then a stretch of instructions without port accesses is run as one. */
+void threadedFrontEndTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- THREADED FRONT END TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* direct = newJWD1797(&config);
+  JWD1797* threaded = newJWD1797(&config);
+  JWD1797Thread* t = startJWD1797Thread(threaded);
+  unsigned char direct_bytes[1024], threaded_bytes[1024];
+  int direct_n = 0, threaded_n = 0;
+  unsigned int direct_status = 0, threaded_status = 0;
+  // SEEK cylinder 5 - load head, 6 ms step rate - then READ SECTOR 3 side 0
+  unsigned int commands[2][3] = {{0xB3, 5, 0b00011000}, {0xB2, 3, 0b10000000}};
+  for(int c = 0; c < 2; c++) {
+    writeJWD1797(direct, commands[c][0], commands[c][1]);
+    writeJWD1797(direct, 0xB0, commands[c][2]);
+    do {
+      advanceJWD1797(direct, instr_times[0]);
+      direct_status = readJWD1797(direct, 0xB0);
+      if((direct_status & 2) && direct_n < 1024) {
+        direct_bytes[direct_n++] = readJWD1797(direct, 0xB3);
+      }
+    } while(direct_status & 1);
+    writeJWD1797Thread(t, commands[c][0], commands[c][1]);
+    writeJWD1797Thread(t, 0xB0, commands[c][2]);
+    do {
+      advanceJWD1797Thread(t, instr_times[0]);
+      threaded_status = readJWD1797Thread(t, 0xB0);
+      if((threaded_status & 2) && threaded_n < 1024) {
+        threaded_bytes[threaded_n++] = readJWD1797Thread(t, 0xB3);
+      }
+    } while(threaded_status & 1);
+  }
+  JWD1797Snapshot s;
+  syncJWD1797Thread(t, &s);
+  printf("%s%d%s%X%s%llu | %s%d%s%X%s%llu\n", "direct: ", direct_n, " bytes, status ",
+    direct_status, ", ns ", direct->emulated_time_ns, "threaded: ", threaded_n,
+    " bytes, status ", threaded_status, ", ns ", s.emulated_time_ns);
+  if(direct_n == threaded->sector_length && threaded_n == direct_n &&
+    memcmp(direct_bytes, threaded_bytes, direct_n) == 0 &&
+    direct_status == threaded_status &&
+    direct->emulated_time_ns == s.emulated_time_ns &&
+    s.ports[1] == direct->trackRegister && s.intrq == direct->intrq) {
+    printf("%s\n", "threaded READ SECTOR -- CONFIRMED");
+  }
+  else {printf("%s\n", "threaded READ SECTOR -- WRONG");}
+
+  // RESTORE, then 40 ms of instructions without a port access
+  writeJWD1797(direct, 0xB0, 0b00001000);
+  writeJWD1797Thread(t, 0xB0, 0b00001000);
+  unsigned long merged = t->merged;
+  for(int i = 0; i < 50000; i++) {
+    advanceJWD1797(direct, instr_times[0]);
+    advanceJWD1797Thread(t, instr_times[0]);
+  }
+  direct_status = readJWD1797(direct, 0xB0);
+  threaded_status = readJWD1797Thread(t, 0xB0);
+  syncJWD1797Thread(t, NULL);
+  merged = t->merged - merged;
+  stopJWD1797Thread(t);
+  printf("%s%X%s%d | %s%X%s%d | %s%d\n", "direct status: ", direct_status,
+    ", track ", direct->trackRegister, "threaded status: ", threaded_status,
+    ", track ", threaded->trackRegister, "advances run together: ", merged > 0);
+  if(merged > 0 && direct_status == threaded_status &&
+    threaded->trackRegister == direct->trackRegister &&
+    threaded->emulated_time_ns == direct->emulated_time_ns &&
+    threaded->intrq == direct->intrq) {
+    printf("%s\n", "threaded time advance -- CONFIRMED");
+  }
+  else {printf("%s\n", "threaded time advance -- WRONG");}
+
+  /* the same SEEK and READ SECTOR through the data FIFO with a 1 ms quantum -
+    DRQ and the data byte come from the snapshot, all but a few reads without
+    waiting for the controller thread to run them */
+  powerOnJWD1797(direct);
+  powerOnJWD1797(threaded);
+  setJWD1797DataFIFO(direct, 1);
+  setJWD1797DataFIFO(threaded, 1);
+  setJWD1797Quantum(direct, 1000.0);
+  setJWD1797Quantum(threaded, 1000.0);
+  t = startJWD1797Thread(threaded);
+  direct_n = 0;
+  threaded_n = 0;
+  for(int c = 0; c < 2; c++) {
+    writeJWD1797(direct, commands[c][0], commands[c][1]);
+    writeJWD1797(direct, 0xB0, commands[c][2]);
+    do {
+      advanceJWD1797(direct, instr_times[0]);
+      direct_status = readJWD1797(direct, 0xB0);
+      if((direct_status & 2) && direct_n < 1024) {
+        direct_bytes[direct_n++] = readJWD1797(direct, 0xB3);
+      }
+    } while(direct_status & 1);
+    writeJWD1797Thread(t, commands[c][0], commands[c][1]);
+    writeJWD1797Thread(t, 0xB0, commands[c][2]);
+    do {
+      advanceJWD1797Thread(t, instr_times[0]);
+      threaded_status = readJWD1797Thread(t, 0xB0);
+      if((threaded_status & 2) && threaded_n < 1024) {
+        threaded_bytes[threaded_n++] = readJWD1797Thread(t, 0xB3);
+      }
+    } while(threaded_status & 1);
+  }
+  unsigned long sync_reads = t->sync_reads;
+  stopJWD1797Thread(t);
+  const unsigned char* sector = getJWD1797SectorPtr(jwd1797, 5, 0, 3, NULL);
+  printf("%s%d%s%X | %s%d%s%X%s%lu\n", "FIFO direct: ", direct_n, " bytes, status ",
+    direct_status, "FIFO threaded: ", threaded_n, " bytes, status ", threaded_status,
+    ", reads run on the controller thread ", sync_reads);
+  if(direct_n == threaded->sector_length && threaded_n == direct_n &&
+    memcmp(direct_bytes, threaded_bytes, direct_n) == 0 &&
+    memcmp(threaded_bytes, sector, threaded_n) == 0 &&
+    direct_status == threaded_status && sync_reads * 8 < (unsigned long)threaded_n &&
+    threaded->emulated_time_ns == direct->emulated_time_ns) {
+    printf("%s\n", "threaded FIFO READ SECTOR -- CONFIRMED");
+  }
+  else {printf("%s\n", "threaded FIFO READ SECTOR -- WRONG");}
+  freeJWD1797(direct);
+  freeJWD1797(threaded);
+  sleep(1);
+}
+
+/* host loop of the data FIFO test - a multi-record READ SECTOR of cylinder 2
+  side 1 polling status after every instruction and reading a waiting byte
+  only every service_every instructions. Counts the status reads that show
+  lost data and returns the bytes received. */
+unsigned int dataFIFOTestRead(JWD1797* w, double instr_t, int service_every,
+  unsigned char* memory, unsigned int size, unsigned int* lost_reads) {
+  // SEEK cylinder 2 - load head, 6 ms step rate
+  writeJWD1797(w, 0xB3, 2);
+  writeJWD1797(w, 0xB0, 0b00011000);
+  while(readJWD1797(w, 0xB0) & 1) {doJWD1797Cycle(w, 1.0);}
+  unsigned int received = 0;
+  *lost_reads = 0;
+  writeJWD1797(w, 0xB2, 1);
+  writeJWD1797(w, 0xB0, 0b10010010);
+  unsigned int status;
+  int instructions = 0;
+  do {
+    advanceJWD1797(w, instr_t);
+    instructions++;
+    status = readJWD1797(w, 0xB0);
+    if(status & 0b00000100) {(*lost_reads)++;}
+    // DRQ status bit
+    if((status & 0b00000010) && instructions % service_every == 0) {
+      unsigned char r_byte = (unsigned char)readJWD1797(w, 0xB3);
+      if(received < size) {memory[received] = r_byte;}
+      received++;
+    }
+  } while(status & 1);
+  return received;
+}
+
+/* tests READ SECTOR through the data FIFO - a host too slow for the byte
+  rate must receive the same bytes and see lost data on the same status reads
+  as with the byte level transfer, and with a 1 ms quantum (which loses most
+  bytes at the byte level) a host reading in time receives every byte */
+void dataFIFOTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- DATA FIFO TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* byte_level = newJWD1797(&config);
+  JWD1797* fifo = newJWD1797(&config);
+  setJWD1797DataFIFO(fifo, 1);
+  unsigned int track_size = jwd1797->sectors_per_track * jwd1797->sector_length;
+  unsigned char* byte_memory = (unsigned char*)calloc(track_size, 1);
+  unsigned char* fifo_memory = (unsigned char*)calloc(track_size, 1);
+  const unsigned char* track_data = getJWD1797SectorPtr(jwd1797, 2, 1, 1, NULL);
+
+  // a byte is read every 50 instructions - slower than a byte time
+  unsigned int byte_lost, fifo_lost;
+  unsigned int byte_received = dataFIFOTestRead(byte_level, instr_times[0], 50,
+    byte_memory, track_size, &byte_lost);
+  unsigned int fifo_received = dataFIFOTestRead(fifo, instr_times[0], 50,
+    fifo_memory, track_size, &fifo_lost);
+  printf("%s%u%s%u | %s%u%s%u\n", "byte level: ", byte_received, " bytes, lost reads ",
+    byte_lost, "FIFO: ", fifo_received, " bytes, lost reads ", fifo_lost);
+  unsigned int n = byte_received < track_size ? byte_received : track_size;
+  // the status as the host reads it - DRQ of a FIFO transfer comes from the FIFO
+  unsigned int byte_status = readJWD1797(byte_level, 0xB0);
+  unsigned int fifo_status = readJWD1797(fifo, 0xB0);
+  printf("%s%X | %s%X\n", "byte level status: ", byte_status, "FIFO status: ",
+    fifo_status);
+  if(byte_lost > 0 && fifo_received == byte_received && fifo_lost == byte_lost &&
+    memcmp(byte_memory, fifo_memory, n) == 0 && fifo_status == byte_status) {
+    printf("%s\n", "FIFO lost data timing -- CONFIRMED");
+  }
+  else {printf("%s\n", "FIFO lost data timing -- WRONG");}
+
+  // 1 ms quantum, every byte read as soon as DRQ shows
+  powerOnJWD1797(byte_level);
+  powerOnJWD1797(fifo);
+  setJWD1797Quantum(byte_level, 1000.0);
+  setJWD1797Quantum(fifo, 1000.0);
+  byte_received = dataFIFOTestRead(byte_level, instr_times[0], 1, byte_memory,
+    track_size, &byte_lost);
+  fifo_received = dataFIFOTestRead(fifo, instr_times[0], 1, fifo_memory,
+    track_size, &fifo_lost);
+  printf("%s%u%s%u | %s%u%s%u\n", "1 ms quantum byte level: ", byte_received,
+    " bytes, lost reads ", byte_lost, "FIFO: ", fifo_received, " bytes, lost reads ",
+    fifo_lost);
+  // the sectors of a track are one after the other in the payload
+  unsigned char* payload = diskImageToCharArray("Z_DOS_ver1.bin", jwd1797);
+  unsigned long payload_pt = (2 * jwd1797->num_heads + 1) * track_size;
+  if(fifo_received == track_size && fifo_lost == 0 &&
+    memcmp(fifo_memory, payload + payload_pt, track_size) == 0 &&
+    fifo_memory[0] == track_data[0] && byte_received < track_size) {
+    printf("%s\n", "FIFO with 1 ms quantum -- CONFIRMED");
+  }
+  else {printf("%s\n", "FIFO with 1 ms quantum -- WRONG");}
+
+  freeJWD1797(byte_level);
+  freeJWD1797(fifo);
+  free(byte_memory);
+  free(fifo_memory);
+  free(payload);
+  sleep(1);
+}
+
+/* tests the sector interleave and skew of a raw image: interleave 2 and skew
+  1 put the sectors of cylinder 0 in the order 1 5 2 6 3 7 4 8 and start
+  cylinder 1 one slot later, every sector keeps its data, the tracks verify,
+  and a multi-record read of a track takes about a rotation longer than on
+  the disk in order (each next sector is two slots away - the wait for
+  sector 1 differs by the skew) */
+void interleaveTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- SECTOR INTERLEAVE TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .interleave = 2, .skew = 1};
+  JWD1797* interleaved = newJWD1797(&config);
+  JWD1797Image* img = interleaved->image;
+  unsigned char cyl0_ids[8] = {1, 5, 2, 6, 3, 7, 4, 8};
+  unsigned char cyl1_ids[8] = {8, 1, 5, 2, 6, 3, 7, 4};
+  printf("%s", "cylinder 0 / cylinder 1 sector order:");
+  for(int n = 0; n < img->tracks[0].num_sectors; n++) {
+    printf(" %d/%d", img->tracks[0].sector_ids[n], img->tracks[2].sector_ids[n]);
+  }
+  printf("\n");
+  if(img->tracks[0].num_sectors == 8 &&
+    memcmp(img->tracks[0].sector_ids, cyl0_ids, 8) == 0 &&
+    memcmp(img->tracks[1].sector_ids, cyl0_ids, 8) == 0 &&
+    memcmp(img->tracks[2].sector_ids, cyl1_ids, 8) == 0) {
+    printf("%s\n", "interleave and skew layout -- CONFIRMED");
+  }
+  else {printf("%s\n", "interleave and skew layout -- WRONG");}
+
+  // every sector has the data it has on the disk in order
+  unsigned long errors = 0, differences = 0;
+  JWD1797TrackReport r;
+  for(int t = 0; t < img->num_tracks; t++) {
+    errors += verifyJWD1797Track(img->formattedDiskArray + img->tracks[t].formatted_offset,
+      img->tracks[t].formatted_length, &img->tracks[t], &r);
+    for(int sector = 1; sector <= img->tracks[t].num_sectors; sector++) {
+      unsigned int length = 0;
+      const unsigned char* a = getJWD1797SectorPtr(jwd1797, t / img->num_heads,
+        t % img->num_heads, sector, &length);
+      const unsigned char* b = getJWD1797SectorPtr(interleaved, t / img->num_heads,
+        t % img->num_heads, sector, NULL);
+      if(a == NULL || b == NULL || memcmp(a, b, length) != 0) {differences++;}
+    }
+  }
+  printf("%s%lu | %s%lu\n", "verify errors: ", errors, "sectors differing: ",
+    differences);
+  if(errors == 0 && differences == 0) {
+    printf("%s\n", "interleaved sector data -- CONFIRMED");
+  }
+  else {printf("%s\n", "interleaved sector data -- WRONG");}
+
+  // multi-record read of a track on both disks
+  JWD1797Config in_order_config = {.image_path = "Z_DOS_ver1.bin",
+    .image = jwd1797->image};
+  JWD1797* in_order = newJWD1797(&in_order_config);
+  unsigned int track_size = jwd1797->sectors_per_track * jwd1797->sector_length;
+  unsigned char* in_order_memory = (unsigned char*)calloc(track_size, 1);
+  unsigned char* interleaved_memory = (unsigned char*)calloc(track_size, 1);
+  unsigned int lost;
+  unsigned long long start = in_order->emulated_time_ns;
+  dataFIFOTestRead(in_order, instr_times[0], 1, in_order_memory, track_size, &lost);
+  double in_order_ms = (in_order->emulated_time_ns - start)/1e6;
+  start = interleaved->emulated_time_ns;
+  dataFIFOTestRead(interleaved, instr_times[0], 1, interleaved_memory, track_size,
+    &lost);
+  double interleaved_ms = (interleaved->emulated_time_ns - start)/1e6;
+  printf("%s%.1f%s%.1f%s\n", "track read: in order ", in_order_ms,
+    " ms | interleave 2 ", interleaved_ms, " ms");
+  if(memcmp(in_order_memory, interleaved_memory, track_size) == 0 &&
+    interleaved_ms - in_order_ms > 100.0 && interleaved_ms - in_order_ms < 400.0) {
+    printf("%s\n", "interleaved track read time -- CONFIRMED");
+  }
+  else {printf("%s\n", "interleaved track read time -- WRONG");}
+
+  freeJWD1797(in_order);
+  freeJWD1797(interleaved);
+  free(in_order_memory);
+  free(interleaved_memory);
+  sleep(1);
+}
+
+/* host loop of the statistics test - SEEK cylinder 2, then READ SECTOR from
+  sector on side 1 (multi_record: to the end of the track). The byte level
+  controller is polled every instruction and reads each byte at once; the
+  HLE controller runs 1 ms slices. */
+void statsTestRead(JWD1797* w, double instr_t, int sector, int multi_record) {
+  // SEEK cylinder 2 - load head, 6 ms step rate
+  writeJWD1797(w, 0xB3, 2);
+  writeJWD1797(w, 0xB0, 0b00011000);
+  while(readJWD1797(w, 0xB0) & 1) {doJWD1797Cycle(w, 1.0);}
+  writeJWD1797(w, 0xB2, sector);
+  writeJWD1797(w, 0xB0, 0b10000010 | (multi_record << 4));
+  if(w->hle_enabled) {
+    while(w->statusRegister & 1) {doJWD1797Cycle(w, 1000.0);}
+    return;
+  }
+  unsigned int status;
+  do {
+    doJWD1797Cycle(w, instr_t);
+    status = readJWD1797(w, 0xB0);
+    // DRQ status bit
+    if(status & 0b00000010) {readJWD1797(w, 0xB3);}
+  } while(status & 1);
+}
+
+/* tests the guest I/O statistics: a SEEK is a TYPE I command with its
+  distance, a multi-record READ SECTOR has the same rotational waits byte
+  level and HLE and a DRQ latency for every byte, a sector that is not on
+  the track ends in an index timeout, and a slow host loses the same bytes
+  byte level and through the data FIFO */
+void statsTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- GUEST I/O STATISTICS TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .image = jwd1797->image};
+  JWD1797* byte_level = newJWD1797(&config);
+  JWD1797* hle = newJWD1797(&config);
+  HLETestMemory dma = {hle, NULL, 0, 0};
+  dma.memory = (unsigned char*)calloc(jwd1797->sectors_per_track * jwd1797->sector_length, 1);
+  setJWD1797DMACallback(hle, hleTestDMA, &dma);
+  setJWD1797HLE(hle, 1);
+  JWD1797Stats b, h;
+
+  statsTestRead(byte_level, instr_times[0], 1, 1);
+  statsTestRead(hle, instr_times[0], 1, 1);
+  getJWD1797Stats(byte_level, &b);
+  getJWD1797Stats(hle, &h);
+  printf("%s%lu%s%lu%s%llu | %s%lu%s%lu\n", "TYPE I: ", b.commands[0],
+    " commands, seek distance samples ", b.seek_distance[0].samples, " max ",
+    b.seek_distance[0].max, "TYPE II: ", b.commands[1], " commands, seek samples ",
+    b.seek_distance[1].samples);
+  if(b.commands[0] == 1 && b.seek_distance[0].samples == 1 &&
+    b.seek_distance[0].sum == 2 && b.seek_distance[0].buckets[2] == 1 &&
+    b.commands[1] == 1 && b.seek_distance[1].samples == 1 &&
+    b.seek_distance[1].sum == 0) {
+    printf("%s\n", "command counts and seek distance -- CONFIRMED");
+  }
+  else {printf("%s\n", "command counts and seek distance -- WRONG");}
+
+  printf("%s%lu%s%llu%s%llu | %s%lu%s%llu%s%llu\n", "byte level waits: ",
+    b.rotational_wait[1].samples, " sum ", b.rotational_wait[1].sum, " max ",
+    b.rotational_wait[1].max, "HLE waits: ", h.rotational_wait[1].samples, " sum ",
+    h.rotational_wait[1].sum, " max ", h.rotational_wait[1].max);
+  if(b.rotational_wait[1].samples == jwd1797->sectors_per_track &&
+    h.rotational_wait[1].samples == jwd1797->sectors_per_track &&
+    memcmp(b.rotational_wait[1].buckets, h.rotational_wait[1].buckets,
+    sizeof(b.rotational_wait[1].buckets)) == 0 &&
+    b.rotational_wait[1].max < jwd1797->actual_num_track_bytes) {
+    printf("%s\n", "rotational wait byte level and HLE -- CONFIRMED");
+  }
+  else {printf("%s\n", "rotational wait byte level and HLE -- WRONG");}
+
+  // every byte read within an instruction of its DRQ
+  printf("%s%lu%s%llu%s%lu\n", "DRQ latency samples: ", b.drq_latency[1].samples,
+    " max (ns) ", b.drq_latency[1].max, " | lost data: ", b.lost_data[1]);
+  if(b.drq_latency[1].samples == jwd1797->sectors_per_track * jwd1797->sector_length &&
+    b.drq_latency[1].max <= (unsigned long long)(2 * instr_times[0] * 1000.0) &&
+    b.lost_data[1] == 0 && h.drq_latency[1].samples == 0) {
+    printf("%s\n", "DRQ service latency -- CONFIRMED");
+  }
+  else {printf("%s\n", "DRQ service latency -- WRONG");}
+
+  // sector 20 is not on the track
+  clearJWD1797Stats(byte_level);
+  clearJWD1797Stats(hle);
+  statsTestRead(byte_level, instr_times[0], 20, 0);
+  statsTestRead(hle, instr_times[0], 20, 0);
+  getJWD1797Stats(byte_level, &b);
+  getJWD1797Stats(hle, &h);
+  printf("%s%lu%s%lu | %s%lu%s%lu\n", "byte level index timeouts: ",
+    b.index_timeouts[1], " waits ", b.rotational_wait[1].samples,
+    "HLE index timeouts: ", h.index_timeouts[1], " waits ", h.rotational_wait[1].samples);
+  if(b.index_timeouts[1] == 1 && h.index_timeouts[1] == 1 &&
+    b.rotational_wait[1].samples == 0 && h.rotational_wait[1].samples == 0 &&
+    b.commands[0] == 1 && b.seek_distance[0].sum == 0) {
+    printf("%s\n", "index timeout -- CONFIRMED");
+  }
+  else {printf("%s\n", "index timeout -- WRONG");}
+
+  // a host reading a byte every 50 instructions
+  JWD1797* fifo = newJWD1797(&config);
+  setJWD1797DataFIFO(fifo, 1);
+  powerOnJWD1797(byte_level);
+  clearJWD1797Stats(byte_level);
+  unsigned int track_size = jwd1797->sectors_per_track * jwd1797->sector_length;
+  unsigned char* memory = (unsigned char*)calloc(track_size, 1);
+  unsigned int lost_reads;
+  dataFIFOTestRead(byte_level, instr_times[0], 50, memory, track_size, &lost_reads);
+  dataFIFOTestRead(fifo, instr_times[0], 50, memory, track_size, &lost_reads);
+  getJWD1797Stats(byte_level, &b);
+  getJWD1797Stats(fifo, &h);
+  printf("%s%lu%s%lu | %s%lu%s%lu\n", "byte level lost bytes: ", b.lost_data[1],
+    " DRQ latency samples ", b.drq_latency[1].samples, "FIFO lost bytes: ",
+    h.lost_data[1], " DRQ latency samples ", h.drq_latency[1].samples);
+  if(b.lost_data[1] > 0 && b.lost_data[1] == h.lost_data[1] &&
+    b.drq_latency[1].samples == h.drq_latency[1].samples &&
+    b.drq_latency[1].sum == h.drq_latency[1].sum) {
+    printf("%s\n", "lost data byte level and FIFO -- CONFIRMED");
+  }
+  else {printf("%s\n", "lost data byte level and FIFO -- WRONG");}
+
+  freeJWD1797(byte_level);
+  freeJWD1797(hle);
+  freeJWD1797(fifo);
+  free(dma.memory);
+  free(memory);
+  sleep(1);
+}
+
+/* tests the disk format profiles on raw 720K, 1.2M and 1.44M images - each
+  gets its profile from the geometry, tracks of one revolution at the data
+  rate (300 RPM 250 kbit/s, 360 RPM and 300 RPM 500 kbit/s), the step rates
+  of its clock, and the last sector of cylinder 79 reads byte level without
+  lost data */
+void formatProfileTest(JWD1797* jwd1797, double instr_times[]) {
+  printf("\n\n%s\n\n", "-------------- DISK FORMAT PROFILE TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  long sizes[3] = {737280, 1228800, 1474560};
+  int sectors[3] = {9, 15, 18};
+  unsigned int formats[3] = {JWD1797_FORMAT_DD80, JWD1797_FORMAT_HD,
+    JWD1797_FORMAT_HD144};
+  unsigned int track_bytes[3] = {6250, 10416, 12500};
+  unsigned int byte_times[3] = {32000, 16000, 16000};
+  int slow_step_rates[3] = {30, 15, 15};
+  for(int d = 0; d < 3; d++) {
+    unsigned char* payload = (unsigned char*)malloc(sizes[d]);
+    for(long i = 0; i < sizes[d]; i++) {payload[i] = (unsigned char)((i >> 9) * 31 + i);}
+    FILE* f = fopen("test_fmt.img", "wb");
+    fwrite(payload, 1, sizes[d], f);
+    fclose(f);
+    JWD1797Config config = {.image_path = "test_fmt.img", .no_cache = 1};
+    JWD1797* w = newJWD1797(&config);
+    JWD1797Image* img = w->image;
+    unsigned long errors = 0;
+    JWD1797TrackReport r;
+    for(int t = 0; t < img->num_tracks; t++) {
+      errors += verifyJWD1797Track(img->formattedDiskArray + img->tracks[t].formatted_offset,
+        img->tracks[t].formatted_length, &img->tracks[t], &r);
+    }
+    printf("%s%ld%s%s%s%u%s%u%s%lu\n", "image ", sizes[d], ": ", w->format->name,
+      " - track bytes: ", img->tracks[0].formatted_length, " byte time (ns): ",
+      img->tracks[0].byte_time_ns, " verify errors: ", errors);
+    if(img->format == formats[d] && img->cylinders == 80 &&
+      img->tracks[0].formatted_length == track_bytes[d] &&
+      img->tracks[0].byte_time_ns == byte_times[d] &&
+      w->actual_num_track_bytes == track_bytes[d] && errors == 0) {
+      printf("%s\n", "format profile and track timing -- CONFIRMED");
+    }
+    else {printf("%s\n", "format profile and track timing -- WRONG");}
+
+    // SEEK cylinder 79 at the slowest step rate of the clock
+    unsigned long long start = w->emulated_time_ns;
+    writeJWD1797(w, 0xB3, 79);
+    writeJWD1797(w, 0xB0, 0b00011011);
+    while(readJWD1797(w, 0xB0) & 1) {doJWD1797Cycle(w, 10.0);}
+    double seek_ms = (w->emulated_time_ns - start)/1e6;
+    printf("%s%d%s%.1f%s%d\n", "step rate (ms): ", w->stepRate, " seek to 79: ",
+      seek_ms, " ms, track: ", w->current_track);
+    if(w->stepRate == slow_step_rates[d] && w->current_track == 79 &&
+      seek_ms >= 79.0 * w->stepRate && seek_ms < 80.0 * w->stepRate) {
+      printf("%s\n", "format step rate -- CONFIRMED");
+    }
+    else {printf("%s\n", "format step rate -- WRONG");}
+
+    // READ SECTOR - last sector of side 1
+    unsigned char data[512];
+    int count = 0;
+    unsigned int status;
+    writeJWD1797(w, 0xB2, sectors[d]);
+    writeJWD1797(w, 0xB0, 0b10000010);
+    do {
+      doJWD1797Cycle(w, instr_times[0]);
+      status = readJWD1797(w, 0xB0);
+      if((status & 0b00000010) && count < 512) {data[count++] = readJWD1797(w, 0xB3);}
+    } while(status & 1);
+    long lba = ((79 * 2 + 1) * sectors[d]) + sectors[d] - 1;
+    printf("%s%d%s%02X\n", "bytes read: ", count, " status: ", status);
+    if(count == 512 && (status & 0b00011100) == 0 &&
+      memcmp(data, payload + lba * 512, 512) == 0) {
+      printf("%s\n", "last sector read -- CONFIRMED");
+    }
+    else {printf("%s\n", "last sector read -- WRONG");}
+
+    freeJWD1797(w);
+    remove("test_fmt.img");
+    free(payload);
+  }
+  sleep(1);
+}
+
+/* tests master reset and disk hot swapping - reset loads the MR register
+  values without touching the disk, the emulated time, the rotation or the
+  host quantum, the RESTORE it loads steps the head out at its step rate, and
+  taking the disk out / putting it back fires the READY to NOT READY /
+  NOT READY to READY forced interrupts */
+void resetMountTest(JWD1797* jwd1797) {
+  printf("\n\n%s\n\n", "-------------- RESET / MOUNT TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+  // spin a while, with host time pending in a 1 ms quantum
+  doJWD1797Cycle(jwd1797, 123456.8);
+  setJWD1797Quantum(jwd1797, 1000.0);
+  advanceJWD1797(jwd1797, 300.0);
+  unsigned long long time_ns = jwd1797->emulated_time_ns;
+  unsigned long long bytes_passed = getJWD1797BytesPassed(jwd1797, time_ns);
+  unsigned long long pending_ns = jwd1797->quantum_accumulator_ns;
+  resetJWD1797(jwd1797);
+  printf("%s%llu%s%llu | %s%llu%s%llu\n", "time (ns): ", time_ns, " -> ",
+    jwd1797->emulated_time_ns, "bytes passed: ", bytes_passed, " -> ",
+    getJWD1797BytesPassed(jwd1797, jwd1797->emulated_time_ns));
+  if(jwd1797->emulated_time_ns == time_ns && pending_ns > 0 &&
+    getJWD1797BytesPassed(jwd1797, jwd1797->emulated_time_ns) == bytes_passed &&
+    jwd1797->cycle_quantum_ns == 1000000 &&
+    jwd1797->quantum_accumulator_ns == pending_ns) {
+    printf("%s\n", "time base and quantum kept across reset -- CONFIRMED");
+  }
+  else {printf("%s\n", "time base and quantum kept across reset -- WRONG");}
+  setJWD1797Quantum(jwd1797, 0.0);
+  printf("%s%X | %s%X | %s%X\n", "command reg: ", jwd1797->commandRegister,
+    "sector reg: ", jwd1797->sectorRegister, "status reg: ", jwd1797->statusRegister);
+  if(jwd1797->commandRegister == 0x03 && jwd1797->sectorRegister == 0x01 &&
+    jwd1797->trackRegister == 0 && jwd1797->statusRegister == 0x04 &&
+    jwd1797->image != NULL) {
+    printf("%s\n", "master reset -- CONFIRMED");
+  }
+  else {printf("%s\n", "master reset -- WRONG");}
+
+  // off track 00 the RESTORE of the reset steps out like one written by the host
+  jwd1797->current_track = 3;
+  resetJWD1797(jwd1797);
+  unsigned long long start_ns = jwd1797->emulated_time_ns;
+  unsigned long long restore_ns = 3 * (unsigned long long)jwd1797->stepRate * 1000000;
+  int busy = jwd1797->statusRegister & 1, restore_intrq = 0;
+  while(readJWD1797(jwd1797, 0xB0) & 1) {
+    doJWD1797Cycle(jwd1797, 100.0);
+    // reading the status register clears INTRQ - sample it first
+    restore_intrq = jwd1797->intrq;
+  }
+  unsigned long long elapsed_ns = jwd1797->emulated_time_ns - start_ns;
+  printf("%s%d | %s%llu%s%llu | %s%d%s%X\n", "busy after reset: ", busy,
+    "RESTORE from track 3 (ns): ", elapsed_ns, " for ", restore_ns, "track: ",
+    jwd1797->current_track, " status: ", jwd1797->statusRegister);
+  if(busy && elapsed_ns >= restore_ns && elapsed_ns < restore_ns + 100000 &&
+    restore_intrq && jwd1797->current_track == 0 && jwd1797->trackRegister == 0 &&
+    jwd1797->statusRegister == 0x04) {
+    printf("%s\n", "RESTORE after reset steps in time -- CONFIRMED");
+  }
+  else {printf("%s\n", "RESTORE after reset steps in time -- WRONG");}
+
+  JWD1797Image* image = jwd1797->image;
+  retainJWD1797Image(image);
+  // forced interrupt - INTRQ on READY to NOT READY transition
+  writeJWD1797(jwd1797, 0xB0, 0xD2);
+  doJWD1797Cycle(jwd1797, 1.0);
+  unmountJWD1797Image(jwd1797);
+  printf("%s%d | %s%d\n", "disk out - READY: ", jwd1797->ready_pin,
+    "INTRQ: ", jwd1797->intrq);
+  if(!jwd1797->ready_pin && jwd1797->intrq && (jwd1797->statusRegister & 0x80)) {
+    printf("%s\n", "READY to NOT READY interrupt -- CONFIRMED");
+  }
+  else {printf("%s\n", "READY to NOT READY interrupt -- WRONG");}
+  // forced interrupt - INTRQ on NOT READY to READY transition
+  writeJWD1797(jwd1797, 0xB0, 0xD1);
+  doJWD1797Cycle(jwd1797, 1.0);
+  mountJWD1797Image(jwd1797, image);
+  releaseJWD1797Image(image);
+  printf("%s%d | %s%d\n", "disk in - READY: ", jwd1797->ready_pin,
+    "INTRQ: ", jwd1797->intrq);
+  if(jwd1797->ready_pin && jwd1797->intrq && !(jwd1797->statusRegister & 0x80)) {
+    printf("%s\n", "NOT READY to READY interrupt -- CONFIRMED");
+  }
+  else {printf("%s\n", "NOT READY to READY interrupt -- WRONG");}
+  // clear the interrupt
+  readJWD1797(jwd1797, 0xB0);
+  sleep(1);
+}
+
+/* tests the formatted disk cache - an image formatted from scratch (cache file
+  removed first) and an image mapped from the cache it wrote must be identical */
+void imageCacheTest(JWD1797* jwd1797) {
+  printf("\n\n%s\n\n", "-------------- IMAGE CACHE TEST --------------");
+  printf("\n\n%s\n\n", "press <ENTER> key to continue...");
+  while(getchar() != '\n') {};
+
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin"};
+  char* cache_path = getJWD1797ImageCachePath(jwd1797->image);
+  remove(cache_path);
+  JWD1797Image* built = loadJWD1797Image(&config);
+  JWD1797Image* mapped = loadJWD1797Image(&config);
+  printf("%s%s\n", "cache file: ", cache_path);
+  printf("%s%p | %s%p\n", "built from payload, cache map: ", built->cache_map,
+    "second load, cache map: ", mapped->cache_map);
+
+  unsigned long disk_size = built->formatted_disk_size;
+  unsigned long index_size = sizeof(unsigned int) * built->cylinders
+    * built->num_heads * built->sectors_per_track;
+  if(built->cache_map == NULL && mapped->cache_map != NULL &&
+    built->formatted_disk_size == mapped->formatted_disk_size &&
+    built->actual_num_track_bytes == mapped->actual_num_track_bytes &&
+    built->rotational_byte_read_limit == mapped->rotational_byte_read_limit &&
+    memcmp(built->formattedDiskArray, mapped->formattedDiskArray, disk_size) == 0 &&
+    memcmp(built->id_am_offsets, mapped->id_am_offsets, index_size) == 0) {
+    printf("%s\n", "cached formatted disk -- CONFIRMED");
+  }
+  else {printf("%s\n", "cached formatted disk -- WRONG");}
+  // every indexed ID address mark must really be one
+  int marks_ok = mapped->num_tracks == built->num_tracks;
+  for(int t = 0; t < built->num_tracks && marks_ok; t++) {
+    for(int sec = 0; sec < built->tracks[t].num_sectors; sec++) {
+      unsigned int offset = mapped->id_am_offsets[t * built->sectors_per_track + sec];
+      unsigned char* track = mapped->formattedDiskArray +
+        mapped->tracks[t].formatted_offset;
+      if(track[offset] != 0xFE ||
+        track[offset + 3] != mapped->tracks[t].sector_ids[sec]) {marks_ok = 0;}
+    }
+  }
+  if(marks_ok) {printf("%s\n", "address mark index -- CONFIRMED");}
+  else {printf("%s\n", "address mark index -- WRONG");}
+
+  /* other options get a cache file of their own, a cache directory takes the
+    cache and no_cache neither reads nor writes one */
+  JWD1797Config layout_config = {.image_path = "Z_DOS_ver1.bin", .interleave = 2,
+    .cache_dir = "/tmp"};
+  JWD1797Image* redirected = loadJWD1797Image(&layout_config);
+  char* redirected_path = getJWD1797ImageCachePath(redirected);
+  JWD1797Config no_cache_config = {.image_path = "Z_DOS_ver1.bin", .no_cache = 1};
+  JWD1797Image* uncached = loadJWD1797Image(&no_cache_config);
+  printf("%s%s | %s%p\n", "redirected cache: ", redirected_path,
+    "no_cache map: ", uncached->cache_map);
+  if(strncmp(redirected_path, "/tmp/Z_DOS_ver1.bin.", 20) == 0 &&
+    strcmp(redirected_path + 20, cache_path + 15) != 0 &&
+    access(redirected_path, R_OK) == 0 && uncached->cache_map == NULL &&
+    getJWD1797ImageCachePath(uncached) == NULL &&
+    memcmp(uncached->formattedDiskArray, built->formattedDiskArray, disk_size) == 0) {
+    printf("%s\n", "cache file per options, directory and no_cache -- CONFIRMED");
+  }
+  else {printf("%s\n", "cache file per options, directory and no_cache -- WRONG");}
+  remove(redirected_path);
+
+  /* an image file with the size, mtime and inode the cache was written for is
+    mapped without reading it - a file modified in place keeping all three
+    still gets the cached disk. A new mtime makes the payload hash decide. */
+  FILE* f = fopen("test_stamp.bin", "wb");
+  FILE* src = fopen("Z_DOS_ver1.bin", "rb");
+  unsigned char buffer[4096];
+  size_t n;
+  while((n = fread(buffer, 1, sizeof(buffer), src)) > 0) {fwrite(buffer, 1, n, f);}
+  fclose(src);
+  fclose(f);
+  struct utimbuf old_stamp = {time(NULL) - 3600, time(NULL) - 3600};
+  utime("test_stamp.bin", &old_stamp);
+  JWD1797Config stamp_config = {.image_path = "test_stamp.bin"};
+  JWD1797Image* stamp_built = loadJWD1797Image(&stamp_config);
+  char* stamp_path = getJWD1797ImageCachePath(stamp_built);
+  releaseJWD1797Image(stamp_built);
+  remove(stamp_path);
+  stamp_built = loadJWD1797Image(&stamp_config);
+  f = fopen("test_stamp.bin", "r+b");
+  fputc(0xA5, f);
+  fclose(f);
+  utime("test_stamp.bin", &old_stamp);
+  JWD1797Image* stamp_mapped = loadJWD1797Image(&stamp_config);
+  utime("test_stamp.bin", NULL);
+  JWD1797Image* stamp_rebuilt = loadJWD1797Image(&stamp_config);
+  printf("%s%p | %s%p\n", "same stamp, cache map: ", stamp_mapped->cache_map,
+    "new mtime, cache map: ", stamp_rebuilt->cache_map);
+  if(stamp_built->cache_map == NULL && stamp_mapped->cache_map != NULL &&
+    memcmp(stamp_mapped->formattedDiskArray, built->formattedDiskArray, disk_size) == 0 &&
+    stamp_rebuilt->cache_map == NULL &&
+    memcmp(stamp_rebuilt->formattedDiskArray, built->formattedDiskArray, disk_size) != 0) {
+    printf("%s\n", "cache keyed on image file size, mtime and inode -- CONFIRMED");
+  }
+  else {printf("%s\n", "cache keyed on image file size, mtime and inode -- WRONG");}
+  releaseJWD1797Image(stamp_built);
+  releaseJWD1797Image(stamp_mapped);
+  releaseJWD1797Image(stamp_rebuilt);
+  remove(stamp_path);
+  remove("test_stamp.bin");
+  free(stamp_path);
+
+  releaseJWD1797Image(built);
+  releaseJWD1797Image(mapped);
+  releaseJWD1797Image(redirected);
+  releaseJWD1797Image(uncached);
+  free(cache_path);
+  free(redirected_path);
+  sleep(1);
+}
+
 /* tests that incoming commands affect the correct flags and are received as
   expected */
 void commandWriteTests(JWD1797* jwd1797) {
@@ -80,122 +1932,122 @@ void commandWriteTests(JWD1797* jwd1797) {
   /* command write tests... */
   int port = 0xb0;
   // Restore - rate-6, verify, load head
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b00001100);
   printCommandFlags(jwd1797);
   usleep(500000);
   // Restore - rate-20, no verify, load head
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b00001010);
   printCommandFlags(jwd1797);
   usleep(500000);
   // Seek - rate-20, no verify, load head
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b00011010);
   printCommandFlags(jwd1797);
   usleep(500000);
   // Seek - rate-12, verify, unload head
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b00010101);
   printCommandFlags(jwd1797);
   usleep(500000);
   // Step - rate-20, no verify, load head, update track reg
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b00111010);
   printCommandFlags(jwd1797);
   usleep(500000);
   // Step - rate-30, verify, unload head, no track reg update
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b00100111);
   printCommandFlags(jwd1797);
   usleep(500000);
   // StepIn - rate-30, no verify, load head, update track reg
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b01011011);
   printCommandFlags(jwd1797);
   usleep(500000);
   // StepOut - rate-12, verify, unload head, no track reg update
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b01100101);
   printCommandFlags(jwd1797);
   usleep(500000);
   // ReadSector - update SSO, no 15ms delay, 0 sector length, single record
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   jwd1797->ready_pin = 1; // set drive to ready for TYPE II and III commands
   writeJWD1797(jwd1797, port, 0b10000010);
   printCommandFlags(jwd1797);
   usleep(500000);
   // ReadSector - no update SSO, 15ms delay, 1 sector length, multiple record
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   jwd1797->ready_pin = 1;
   writeJWD1797(jwd1797, port, 0b10011100);
   printCommandFlags(jwd1797);
   usleep(500000);
   // WriteSector - DAM, no update SSO, 15ms delay, 1 sector length, multiple record
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   jwd1797->ready_pin = 1;
   writeJWD1797(jwd1797, port, 0b10111100);
   printCommandFlags(jwd1797);
   usleep(500000);
   // WriteSector - deleted DAM, update SSO, no 15ms delay, 1 sector length, single record
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   jwd1797->ready_pin = 1;
   writeJWD1797(jwd1797, port, 0b10101011);
   printCommandFlags(jwd1797);
   usleep(500000);
   // ReadAddress - update SSO, no 15ms delay
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   jwd1797->ready_pin = 1;
   writeJWD1797(jwd1797, port, 0b11000010);
   printCommandFlags(jwd1797);
   usleep(500000);
   // ReadTrack - no update SSO, 15ms delay
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   jwd1797->ready_pin = 1;
   writeJWD1797(jwd1797, port, 0b11100100);
   printCommandFlags(jwd1797);
   usleep(500000);
   // WriteTrack - update SSO, 15ms delay
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   jwd1797->ready_pin = 1;
   writeJWD1797(jwd1797, port, 0b11110110);
   printCommandFlags(jwd1797);
   usleep(500000);
 
   // ForceInterrupt - no INTRQ/terminate current command
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b11010000);
   jwd1797->currentCommandType = 4;
   printCommandFlags(jwd1797);
   usleep(500000);
   // ForceInterrupt - INTRQ on NR to R
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b11010001);
   jwd1797->currentCommandType = 4;
   printCommandFlags(jwd1797);
   usleep(500000);
   // ForceInterrupt - INTRQ on R to NR
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b11010010);
   jwd1797->currentCommandType = 4;
   printCommandFlags(jwd1797);
   usleep(500000);
   // ForceInterrupt - INTRQ on INDEX PULSE
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b11010100);
   jwd1797->currentCommandType = 4;
   printCommandFlags(jwd1797);
   usleep(500000);
   /* ForceInterrupt -
   immediate INTRQ/terminate current command */
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b11011000);
   jwd1797->currentCommandType = 4;
   printCommandFlags(jwd1797);
   usleep(500000);
   /* ForceInterrupt -
   INTRQ on NR to R/INTRQ on INDEX PULSE */
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   writeJWD1797(jwd1797, port, 0b11010101);
   jwd1797->currentCommandType = 4;
   printCommandFlags(jwd1797);
@@ -212,7 +2064,7 @@ void indexPulseTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n\n%s\n", "-------------- INDEX PULSE TEST --------------");
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   // set track to 5 to have RESTORE command do some work
   jwd1797->current_track = 5;
   /* send RESTORE command to jwd_controller to begin a TYPE I command - index
@@ -256,7 +2108,7 @@ void restoreCommandTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
 
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   // set track to 3 to have RESTORE command do some work
   jwd1797->current_track = 3;
   jwd1797->trackRegister = 3;
@@ -283,7 +2135,7 @@ void restoreCommandTest(JWD1797* jwd1797, double instr_times[]) {
     }
   }
 
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   // set track to 3 to have RESTORE command do some work
   jwd1797->current_track = 3;
   jwd1797->trackRegister = 3;
@@ -321,7 +2173,7 @@ void seekCommandTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
 
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   jwd1797->current_track = 7;
   writeJWD1797(jwd1797, 0xB1, 0b00000111);  // write 7 to track register
   writeJWD1797(jwd1797, 0xB3, 0b00000101);  // write 5 to data register
@@ -353,7 +2205,7 @@ void stepCommandTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n%s\n\n", "------- STEP from track 6 -> 7: h=1, V=1 -------");
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   jwd1797->current_track = 6;
   jwd1797->direction_pin = 1;
   writeJWD1797(jwd1797, 0xB0, 0b00110111);
@@ -379,7 +2231,7 @@ void stepInCommandTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n%s\n\n", "------- STEP-IN from track 5 -> 6: h=1, V=1 -------");
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   jwd1797->current_track = 5;
   writeJWD1797(jwd1797, 0xB0, 0b01011111);
 
@@ -406,7 +2258,7 @@ void stepOutCommandTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n%s\n\n", "------- STEP-IN from track 5 -> 4: h=1, V=1 -------");
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
   // jwd1797->HLD_pin = 1;
   // jwd1797->HLT_pin = 1;
   jwd1797->current_track = 5;
@@ -436,7 +2288,7 @@ void readSectorTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n\n%s\n", "-------------- READ SECTOR COMMAND TEST --------------");
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
 
   printf("\n");
   // issue restore command
@@ -709,6 +2561,7 @@ void readSectorTest(JWD1797* jwd1797, double instr_times[]) {
   print_bin8_representation(readJWD1797(jwd1797, 0xB0));
   printf("\n\n");
 
+  free(payload_test_data);
 }
 
 
@@ -717,7 +2570,7 @@ void readAddressTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
 
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
 
 
   printf("\n\n%s\n", "-- SEEK TRACK 2 --");
@@ -771,7 +2624,7 @@ void readAddressTest(JWD1797* jwd1797, double instr_times[]) {
     doJWD1797Cycle(jwd1797, instr_t); // pass instruction time elapsed to WD1797
   }
 
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
 
   // _____________________________________________________
   printf("\n\n%s\n", "-- SEEK TRACK 6 --");
@@ -840,7 +2693,7 @@ void readTrackTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
 
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
 
   printf("\n\n%s\n", "-------------- SEEK TRACK 10 --------------");
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
@@ -913,7 +2766,7 @@ void readTrackTest(JWD1797* jwd1797, double instr_times[]) {
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
   while(getchar() != '\n') {};
 
-  resetJWD1797(jwd1797);
+  powerOnJWD1797(jwd1797);
 
   printf("\n\n%s\n", "-------------- SEEK TRACK 31 --------------");
   printf("\n\n%s\n\n", "press <ENTER> key to continue...");
@@ -12,3 +12,28 @@ void readSectorTest(JWD1797*, double[]);
 void readAddressTest(JWD1797*, double[]);
 void readTrackTest(JWD1797*, double[]);
 void getFByteTest(JWD1797*, double[]);
+void rotationalPositionTest(JWD1797*, double[]);
+void sharedImageTest(JWD1797*);
+void imageCacheTest(JWD1797*);
+void resetMountTest(JWD1797*);
+void imageLoaderTest(JWD1797*);
+void variableTrackTest(JWD1797*, double[]);
+void sectorAccessTest(JWD1797*);
+void hleReadSectorTest(JWD1797*, double[]);
+void multiRecordReadTest(JWD1797*, double[]);
+void markScannerTest(JWD1797*);
+void tracerTest(JWD1797*, double[]);
+void vcdWriterTest(JWD1797*, double[]);
+void trackCaptureTest(JWD1797*, double[]);
+void verifyTrackTest(JWD1797*);
+void stepDeadlineTest(JWD1797*, double[]);
+void arenaTest(JWD1797*);
+void controllerPoolTest(JWD1797*, double[]);
+void threadedFrontEndTest(JWD1797*, double[]);
+unsigned int dataFIFOTestRead(JWD1797*, double, int, unsigned char*, unsigned int,
+  unsigned int*);
+void dataFIFOTest(JWD1797*, double[]);
+void interleaveTest(JWD1797*, double[]);
+void statsTestRead(JWD1797*, double, int, int);
+void statsTest(JWD1797*, double[]);
+void formatProfileTest(JWD1797*, double[]);
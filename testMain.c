@@ -14,8 +14,9 @@ int main(int argc, char* argv[]) {
 
   printf("\nstart WD1797 disk drive controller test MAIN...\n\n");
 
-  jwd1797 = newJWD1797();
-  // resetJWD1797(jwd1797);
+  // Z-DOS disk image - geometry is taken from the loader disk parameter table
+  JWD1797Config config = {.image_path = "Z_DOS_ver1.bin", .verbose = 1};
+  jwd1797 = newJWD1797(&config);
   // print pointer for new jwd1797 to verify creation
   printf("jwd1797 pointer: %p\n\n", jwd1797);
   /* simulate various instruction timings by picking randomly from this list
@@ -35,6 +36,87 @@ int main(int argc, char* argv[]) {
     position */
   getFByteTest(jwd1797, instruction_times);
 
+  /* test that the rotational byte pointer and revolution count are derived from
+    absolute time, even when the controller is left un-cycled for a long time */
+  rotationalPositionTest(jwd1797, instruction_times);
+
+  /* test that a second controller can share the formatted disk image and that
+    writes only land in that controller's copy-on-write overlay */
+  sharedImageTest(jwd1797);
+
+  /* test that the formatted disk mapped from the sidecar cache file matches a
+    freshly formatted one */
+  imageCacheTest(jwd1797);
+
+  /* test that master reset leaves the disk alone and that swapping disks
+    fires the READY forced interrupt conditions */
+  resetMountTest(jwd1797);
+
+  /* test that raw (single sided) and IMD images are loaded into the same
+    track layout */
+  imageLoaderTest(jwd1797);
+
+  /* test that tracks with different lengths and sector sizes each get their
+    own layout and rotational timing */
+  variableTrackTest(jwd1797, instruction_times);
+
+  // test that sector data can be read and written directly, without timing
+  sectorAccessTest(jwd1797);
+
+  /* test that an HLE READ SECTOR hands the sectors to the host DMA callback
+    with the status and timing of the byte level transfer */
+  hleReadSectorTest(jwd1797, instruction_times);
+
+  /* test that a multi-record READ SECTOR moves on to the next sector through
+    the track layout with exact rotational timing */
+  multiRecordReadTest(jwd1797, instruction_times);
+
+  /* test that the address mark scanner finds the layout of every track and
+    that rewritten tracks are indexed again */
+  markScannerTest(jwd1797);
+
+  // test that the tracer records the controller activity on a timeline
+  tracerTest(jwd1797, instruction_times);
+
+  // test that the pin levels are dumped as a VCD waveform
+  vcdWriterTest(jwd1797, instruction_times);
+
+  // test that READ TRACK streams whole tracks to a sink
+  trackCaptureTest(jwd1797, instruction_times);
+
+  // test that the track verifier passes the disk and reports damaged tracks
+  verifyTrackTest(jwd1797);
+
+  // test that TYPE I commands step the head at exact step deadlines
+  stepDeadlineTest(jwd1797, instruction_times);
+
+  // test that controllers, images and tracers get their memory from arenas
+  arenaTest(jwd1797);
+
+  /* test that pooled controllers come back in the reset state with their
+    written tracks dropped */
+  controllerPoolTest(jwd1797, instruction_times);
+
+  /* test that a controller run on its own thread reads the same bytes as a
+    directly driven one */
+  threadedFrontEndTest(jwd1797, instruction_times);
+
+  /* test that READ SECTOR through the data FIFO loses the same bytes as the
+    byte level transfer and none with a coarse quantum */
+  dataFIFOTest(jwd1797, instruction_times);
+
+  /* test that interleave and skew lay the sectors of a raw image out in the
+    configured order with their data */
+  interleaveTest(jwd1797, instruction_times);
+
+  /* test the guest I/O statistics - byte level, HLE and data FIFO transfers
+    give the same samples */
+  statsTest(jwd1797, instruction_times);
+
+  /* test that 80 track DD and HD images get the rotational timing, gaps and
+    step rates of their disk format */
+  formatProfileTest(jwd1797, instruction_times);
+
   // test that the WD1797 is properly recognizing commands
   commandWriteTests(jwd1797);
 
@@ -70,5 +152,6 @@ int main(int argc, char* argv[]) {
   printf("\t%s\n", "*** ALL TESTS ARE COMPLETE! ***");
   printf("\t%s\n\n\n", "*******************************");
 
+  freeJWD1797(jwd1797);
   return 0;
 }
@@ -0,0 +1,183 @@
+// work-stealing thread pool
+// used by the multi-instance harness to drive many independent JWD1797
+// controllers across all cores
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "thread_pool.h"
+
+/* takes the newest task from the bottom of a worker's own deque.
+  Returns 1 and fills task if there was one, 0 otherwise. */
+int popThreadPoolTask(ThreadPoolDeque* d, ThreadPoolTask* task) {
+  int found = 0;
+  pthread_mutex_lock(&d->lock);
+  if(d->bottom > d->top) {
+    d->bottom--;
+    *task = d->tasks[d->bottom % THREAD_POOL_DEQUE_SIZE];
+    found = 1;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+/* takes the oldest task from the top of another worker's deque.
+  Returns 1 and fills task if there was one, 0 otherwise. */
+int stealThreadPoolTask(ThreadPoolDeque* d, ThreadPoolTask* task) {
+  int found = 0;
+  pthread_mutex_lock(&d->lock);
+  if(d->bottom > d->top) {
+    *task = d->tasks[d->top % THREAD_POOL_DEQUE_SIZE];
+    d->top++;
+    d->steals++;
+    found = 1;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+// finds work for worker id - own deque first, then steal from the others
+int findThreadPoolTask(ThreadPool* pool, int id, ThreadPoolTask* task) {
+  int found = popThreadPoolTask(&pool->deques[id], task);
+  for(int i = 1; i < pool->num_threads && !found; i++) {
+    int victim = (id + i) % pool->num_threads;
+    found = stealThreadPoolTask(&pool->deques[victim], task);
+  }
+  if(found) {
+    pthread_mutex_lock(&pool->lock);
+    pool->queued--;
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return found;
+}
+
+void* threadPoolWorkerLoop(void* arg) {
+  ThreadPoolWorker* worker = (ThreadPoolWorker*)arg;
+  ThreadPool* pool = worker->pool;
+  ThreadPoolTask task;
+
+  while(1) {
+    if(findThreadPoolTask(pool, worker->id, &task)) {
+      task.fn(task.arg);
+      pthread_mutex_lock(&pool->lock);
+      pool->pending--;
+      if(pool->pending == 0) {pthread_cond_broadcast(&pool->all_done);}
+      pthread_mutex_unlock(&pool->lock);
+      continue;
+    }
+    /* nothing to run or steal - sleep until new work is queued or the pool
+      shuts down. The queued count is checked under the pool lock so a task
+      submitted in between is never missed. */
+    pthread_mutex_lock(&pool->lock);
+    while(pool->queued == 0 && !pool->shutdown) {
+      pthread_cond_wait(&pool->work_available, &pool->lock);
+    }
+    if(pool->queued == 0 && pool->shutdown) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return NULL;
+}
+
+ThreadPool* newThreadPool(int num_threads) {
+  ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+  pool->num_threads = num_threads;
+  pool->deques = (ThreadPoolDeque*)aligned_alloc(64,
+    sizeof(ThreadPoolDeque) * num_threads);
+  pool->workers = (ThreadPoolWorker*)calloc(num_threads, sizeof(ThreadPoolWorker));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_available, NULL);
+  pthread_cond_init(&pool->all_done, NULL);
+
+  for(int i = 0; i < num_threads; i++) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pool->deques[i].top = 0;
+    pool->deques[i].bottom = 0;
+    pool->deques[i].steals = 0;
+  }
+  for(int i = 0; i < num_threads; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].id = i;
+    pthread_create(&pool->workers[i].thread, NULL, threadPoolWorkerLoop,
+      &pool->workers[i]);
+  }
+  return pool;
+}
+
+// stops all workers (after the queued tasks have run) and frees the pool
+void freeThreadPool(ThreadPool* pool) {
+  waitThreadPool(pool);
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work_available);
+  pthread_mutex_unlock(&pool->lock);
+  for(int i = 0; i < pool->num_threads; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+    pthread_mutex_destroy(&pool->deques[i].lock);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work_available);
+  pthread_cond_destroy(&pool->all_done);
+  free(pool->deques);
+  free(pool->workers);
+  free(pool);
+}
+
+/* queues a task. Tasks are dealt round-robin onto the worker deques; workers
+  that run out of their own tasks steal from the others. If every deque is
+  full the task runs on the calling thread. */
+void submitThreadPoolTask(ThreadPool* pool, void (*fn)(void*), void* arg) {
+  ThreadPoolTask task = {fn, arg};
+  /* count the task as queued before it becomes visible in a deque, so a
+    worker that takes it right away never sees the count go negative */
+  pthread_mutex_lock(&pool->lock);
+  pool->pending++;
+  pool->queued++;
+  unsigned long start = pool->next_deque++;
+  pthread_mutex_unlock(&pool->lock);
+
+  for(int i = 0; i < pool->num_threads; i++) {
+    ThreadPoolDeque* d = &pool->deques[(start + i) % pool->num_threads];
+    pthread_mutex_lock(&d->lock);
+    if(d->bottom - d->top < THREAD_POOL_DEQUE_SIZE) {
+      d->tasks[d->bottom % THREAD_POOL_DEQUE_SIZE] = task;
+      d->bottom++;
+      pthread_mutex_unlock(&d->lock);
+      pthread_mutex_lock(&pool->lock);
+      pthread_cond_signal(&pool->work_available);
+      pthread_mutex_unlock(&pool->lock);
+      return;
+    }
+    pthread_mutex_unlock(&d->lock);
+  }
+  // no room anywhere - run it here
+  pthread_mutex_lock(&pool->lock);
+  pool->queued--;
+  pthread_mutex_unlock(&pool->lock);
+  fn(arg);
+  pthread_mutex_lock(&pool->lock);
+  pool->pending--;
+  if(pool->pending == 0) {pthread_cond_broadcast(&pool->all_done);}
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// blocks until every submitted task has finished
+void waitThreadPool(ThreadPool* pool) {
+  pthread_mutex_lock(&pool->lock);
+  while(pool->pending > 0) {
+    pthread_cond_wait(&pool->all_done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// total number of tasks that were stolen by a worker other than their owner
+unsigned long getThreadPoolSteals(ThreadPool* pool) {
+  unsigned long steals = 0;
+  for(int i = 0; i < pool->num_threads; i++) {
+    pthread_mutex_lock(&pool->deques[i].lock);
+    steals += pool->deques[i].steals;
+    pthread_mutex_unlock(&pool->deques[i].lock);
+  }
+  return steals;
+}
@@ -0,0 +1,50 @@
+// work-stealing thread pool (header)
+
+#include <pthread.h>
+
+#define THREAD_POOL_DEQUE_SIZE 4096
+
+typedef struct {
+  void (*fn)(void*);
+  void* arg;
+} ThreadPoolTask;
+
+/* one task deque per worker. The owner pushes and pops at the bottom, idle
+  workers steal from the top. Each deque is padded to its own cache lines so
+  workers do not false-share their indices. */
+typedef struct {
+  pthread_mutex_t lock;
+  ThreadPoolTask tasks[THREAD_POOL_DEQUE_SIZE];
+  unsigned long top;      // next task to steal
+  unsigned long bottom;   // next free slot
+  unsigned long steals;   // tasks taken from this deque by other workers
+} __attribute__((aligned(64))) ThreadPoolDeque;
+
+typedef struct ThreadPool ThreadPool;
+
+typedef struct {
+  ThreadPool* pool;
+  int id;
+  pthread_t thread;
+} ThreadPoolWorker;
+
+struct ThreadPool {
+  int num_threads;
+  ThreadPoolDeque* deques;
+  ThreadPoolWorker* workers;
+  // tasks submitted but not finished yet
+  unsigned long pending;
+  // tasks sitting in a deque, waiting for a worker
+  unsigned long queued;
+  unsigned long next_deque;   // round-robin submit position
+  int shutdown;
+  pthread_mutex_t lock;
+  pthread_cond_t work_available;
+  pthread_cond_t all_done;
+};
+
+ThreadPool* newThreadPool(int);
+void freeThreadPool(ThreadPool*);
+void submitThreadPoolTask(ThreadPool*, void (*)(void*), void*);
+void waitThreadPool(ThreadPool*);
+unsigned long getThreadPoolSteals(ThreadPool*);
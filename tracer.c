@@ -0,0 +1,147 @@
+// controller activity tracer
+// records command, phase, pin and port events of one or more controllers in
+// a lock-free buffer and exports them as Chrome trace JSON (chrome://tracing,
+// Perfetto) with emulated time stamps
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "tracer.h"
+
+/* tracer with room for capacity events. NULL if it can not be allocated.
+  The tracer and its events share one arena block on huge pages (where the
+  host has them) - a large event buffer then takes few TLB entries. */
+JWD1797Tracer* newJWD1797Tracer(unsigned long capacity) {
+  JWD1797Arena* arena = newJWD1797Arena(sizeof(JWD1797Tracer) +
+    capacity * sizeof(JWD1797TraceEvent) + JWD1797_ARENA_ALIGN, JWD1797_ARENA_HUGE_PAGES);
+  if(arena == NULL) {return NULL;}
+  // arena allocations keep the cursors on their own cache lines
+  JWD1797Tracer* tracer = (JWD1797Tracer*)allocJWD1797Arena(arena, sizeof(JWD1797Tracer));
+  tracer->arena = arena;
+  tracer->events = (JWD1797TraceEvent*)allocJWD1797Arena(arena,
+    capacity * sizeof(JWD1797TraceEvent));
+  if(tracer->events == NULL) {
+    freeJWD1797Arena(arena);
+    return NULL;
+  }
+  /* touch every page now - otherwise the first event written to each page
+    pays a page fault while the controller is running */
+  memset(tracer->events, 0, capacity * sizeof(JWD1797TraceEvent));
+  tracer->capacity = capacity;
+  return tracer;
+}
+
+void freeJWD1797Tracer(JWD1797Tracer* tracer) {
+  if(tracer == NULL) {return;}
+  freeJWD1797Arena(tracer->arena);
+}
+
+// drops every recorded event - no controller may be writing at the time
+void clearJWD1797Tracer(JWD1797Tracer* tracer) {
+  unsigned long claimed = getJWD1797TraceClaimed(tracer);
+  for(unsigned long i = 0; i < claimed; i++) {tracer->events[i].committed = 0;}
+  memset(tracer->cursors, 0, sizeof(tracer->cursors));
+  tracer->dropped = 0;
+  __atomic_store_n(&tracer->next, 0, __ATOMIC_RELEASE);
+}
+
+/* records one event. The slot is taken from the writer's cursor (refilled
+  with one atomic add per JWD1797_TRACE_CHUNK events) or claimed with an
+  atomic add, filled, then marked committed so an exporter never sees half an
+  event. The arguments are 16 bits - ports, commands, status and pin values. */
+void addJWD1797TraceEvent(JWD1797Tracer* tracer, unsigned long long ts_ns,
+  char phase, const char* name, const JWD1797TraceKind* kind, int tid,
+  unsigned short arg0, unsigned short arg1) {
+  unsigned long slot;
+  if(tid >= 0 && tid < JWD1797_TRACE_MAX_CURSORS) {
+    JWD1797TraceCursor* c = &tracer->cursors[tid];
+    // a cursor left at the end of the buffer stays there
+    if(c->next == c->end && c->end < tracer->capacity) {
+      c->next = __atomic_fetch_add(&tracer->next, JWD1797_TRACE_CHUNK,
+        __ATOMIC_RELAXED);
+      c->end = c->next + JWD1797_TRACE_CHUNK;
+      // last chunk - or nothing left at all
+      if(c->end > tracer->capacity) {c->end = tracer->capacity;}
+      if(c->next > c->end) {c->next = c->end;}
+    }
+    if(c->next == c->end) {
+      __atomic_store_n(&c->dropped, c->dropped + 1, __ATOMIC_RELAXED);
+      return;
+    }
+    slot = c->next++;
+  }
+  else {
+    slot = __atomic_fetch_add(&tracer->next, 1, __ATOMIC_RELAXED);
+    if(slot >= tracer->capacity) {
+      __atomic_fetch_add(&tracer->dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+  JWD1797TraceEvent* e = &tracer->events[slot];
+  e->ts_ns = ts_ns;
+  e->name = name;
+  e->kind = kind;
+  e->args[0] = arg0;
+  e->args[1] = arg1;
+  e->tid = tid;
+  e->phase = phase;
+  __atomic_store_n(&e->committed, 1, __ATOMIC_RELEASE);
+}
+
+/* number of slots handed out to writers - the events are among them, with
+  uncommitted slots in between if several controllers write */
+unsigned long getJWD1797TraceClaimed(JWD1797Tracer* tracer) {
+  unsigned long next = __atomic_load_n(&tracer->next, __ATOMIC_ACQUIRE);
+  return next < tracer->capacity ? next : tracer->capacity;
+}
+
+/* number of events recorded (at most the capacity) - exact while no
+  controller is writing */
+unsigned long getJWD1797TraceEventCount(JWD1797Tracer* tracer) {
+  unsigned long used = getJWD1797TraceClaimed(tracer);
+  // claimed slots the cursors have not filled yet
+  for(int i = 0; i < JWD1797_TRACE_MAX_CURSORS; i++) {
+    used -= tracer->cursors[i].end - tracer->cursors[i].next;
+  }
+  return used;
+}
+
+// number of events dropped because the buffer was full
+unsigned long getJWD1797TraceDropped(JWD1797Tracer* tracer) {
+  unsigned long dropped = __atomic_load_n(&tracer->dropped, __ATOMIC_RELAXED);
+  for(int i = 0; i < JWD1797_TRACE_MAX_CURSORS; i++) {
+    dropped += __atomic_load_n(&tracer->cursors[i].dropped, __ATOMIC_RELAXED);
+  }
+  return dropped;
+}
+
+/* writes the recorded events to fileName as Chrome trace JSON. Time stamps
+  are emulated microseconds; each controller is one thread (tid) of process
+  1. Returns 0 on success, -1 if the file can not be written. */
+int writeJWD1797Trace(JWD1797Tracer* tracer, const char* fileName) {
+  FILE* f = fopen(fileName, "w");
+  if(f == NULL) {return -1;}
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  unsigned long claimed = getJWD1797TraceClaimed(tracer);
+  int first = 1;
+  for(unsigned long i = 0; i < claimed; i++) {
+    JWD1797TraceEvent* e = &tracer->events[i];
+    if(!__atomic_load_n(&e->committed, __ATOMIC_ACQUIRE)) {continue;}
+    fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03llu,"
+      "\"pid\":1,\"tid\":%d", first ? "" : ",", e->name, e->kind->category, e->phase,
+      e->ts_ns/1000, e->ts_ns%1000, e->tid);
+    first = 0;
+    // instant events belong to their thread's row
+    if(e->phase == 'i') {fprintf(f, ",\"s\":\"t\"");}
+    const char* const* arg_names = e->kind->arg_names;
+    if(arg_names[0] != NULL) {
+      fprintf(f, ",\"args\":{\"%s\":%u", arg_names[0], e->args[0]);
+      if(arg_names[1] != NULL) {fprintf(f, ",\"%s\":%u", arg_names[1], e->args[1]);}
+      fprintf(f, "}");
+    }
+    fprintf(f, "}");
+  }
+  fprintf(f, "\n]}\n");
+  return fclose(f) == 0 ? 0 : -1;
+}
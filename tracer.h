@@ -0,0 +1,57 @@
+// controller activity tracer (header)
+
+/* the category of an event and the names of its arguments. Kinds (like
+  event names) must be static - events only keep the pointers. */
+typedef struct {
+  const char* category;
+  const char* arg_names[2];   // NULL - argument not used
+} JWD1797TraceKind;
+
+// one recorded event (32 bytes - two to a cache line)
+typedef struct {
+  unsigned long long ts_ns;   // emulated time stamp (NANOSECONDS)
+  const char* name;
+  const JWD1797TraceKind* kind;
+  unsigned short args[2];     // 16 bits each - the event stays 32 bytes
+  unsigned short tid;         // controller (timeline row) the event belongs to
+  char phase;                 // Chrome trace phase: B(egin) E(nd) C(ounter) i(nstant)
+  char committed;             // set last - the event is complete
+} JWD1797TraceEvent;
+
+// slots a writer claims at a time (see JWD1797TraceCursor)
+#define JWD1797_TRACE_CHUNK 256
+// timeline rows (tid) below this get their own cursor
+#define JWD1797_TRACE_MAX_CURSORS 64
+
+/* the slots one writer has claimed but not filled yet, and the events it had
+  to drop. Only the writer (one controller - one thread at a time) touches
+  its cursor; each cursor has its own cache line. */
+typedef struct {
+  unsigned long next;
+  unsigned long end;
+  unsigned long dropped;
+} __attribute__((aligned(64))) JWD1797TraceCursor;
+
+/* fixed size event buffer shared by any number of controllers (and
+  threads). Writers claim slots with one atomic add - no locks. Rows 0 to
+  JWD1797_TRACE_MAX_CURSORS-1 claim JWD1797_TRACE_CHUNK slots at a time,
+  other rows one slot per event. Events past the capacity are dropped and
+  counted. */
+typedef struct JWD1797Tracer {
+  struct JWD1797Arena* arena;   // holds the tracer and its events
+  JWD1797TraceEvent* events;
+  unsigned long capacity;
+  unsigned long next;         // next unclaimed slot (may run past capacity)
+  unsigned long dropped;      // dropped by rows without a cursor
+  JWD1797TraceCursor cursors[JWD1797_TRACE_MAX_CURSORS];
+} JWD1797Tracer;
+
+JWD1797Tracer* newJWD1797Tracer(unsigned long);
+void freeJWD1797Tracer(JWD1797Tracer*);
+void clearJWD1797Tracer(JWD1797Tracer*);
+void addJWD1797TraceEvent(JWD1797Tracer*, unsigned long long, char, const char*,
+  const JWD1797TraceKind*, int, unsigned short, unsigned short);
+unsigned long getJWD1797TraceClaimed(JWD1797Tracer*);
+unsigned long getJWD1797TraceEventCount(JWD1797Tracer*);
+unsigned long getJWD1797TraceDropped(JWD1797Tracer*);
+int writeJWD1797Trace(JWD1797Tracer*, const char*);
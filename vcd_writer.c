@@ -0,0 +1,146 @@
+// VCD waveform writer
+// streams pin level changes with emulated time stamps to a Value Change Dump
+// file that GTKWave (and most logic analyzer software) opens directly
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vcd_writer.h"
+
+// room a single writeJWD1797VCDValues() call may need in the buffer
+#define VCD_MAX_RECORD (24 + 3 * JWD1797_VCD_MAX_SIGNALS + 16)
+
+/* writer for a new VCD file fileName with the signals in module scope. NULL
+  if the file can not be created. */
+JWD1797VCDWriter* openJWD1797VCD(const char* fileName, const char* scope) {
+  JWD1797VCDWriter* vcd = (JWD1797VCDWriter*)calloc(1, sizeof(JWD1797VCDWriter));
+  if(vcd == NULL) {return NULL;}
+  vcd->file = fopen(fileName, "w");
+  if(vcd->file == NULL) {
+    free(vcd);
+    return NULL;
+  }
+  vcd->scope = scope;
+  return vcd;
+}
+
+/* adds a signal - only before the first values are written. Returns its
+  index (its bit in the values) or -1. */
+int addJWD1797VCDSignal(JWD1797VCDWriter* vcd, const char* name) {
+  if(vcd->started || vcd->num_signals == JWD1797_VCD_MAX_SIGNALS) {return -1;}
+  vcd->names[vcd->num_signals] = name;
+  return vcd->num_signals++;
+}
+
+// writes the buffered output to the file
+void flushJWD1797VCD(JWD1797VCDWriter* vcd) {
+  if(vcd->used > 0 && fwrite(vcd->buffer, 1, vcd->used, vcd->file) != vcd->used) {
+    vcd->failed = 1;
+  }
+  vcd->used = 0;
+}
+
+/* appends a time stamp line (#<ns>) to the buffer. Written for every
+  change - the digits are made two at a time in 32 bit arithmetic. */
+void appendJWD1797VCDTime(JWD1797VCDWriter* vcd, unsigned long long ts_ns) {
+  static const char pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  char digits[24];
+  int n = 24;
+  // at most nine digits per 32 bit part
+  unsigned int part = (unsigned int)(ts_ns % 1000000000ULL);
+  unsigned long long high = ts_ns / 1000000000ULL;
+  while(1) {
+    int end = n - 9;
+    while(part >= 100) {
+      n -= 2;
+      memcpy(digits + n, pairs + (part % 100) * 2, 2);
+      part /= 100;
+    }
+    if(part >= 10) {
+      n -= 2;
+      memcpy(digits + n, pairs + part * 2, 2);
+    }
+    else {digits[--n] = '0' + part;}
+    if(high == 0) {break;}
+    // zero fill the lower part
+    while(n > end) {digits[--n] = '0';}
+    part = (unsigned int)(high % 1000000000ULL);
+    high /= 1000000000ULL;
+  }
+  vcd->buffer[vcd->used++] = '#';
+  memcpy(vcd->buffer + vcd->used, digits + n, 24 - n);
+  vcd->used += 24 - n;
+  vcd->buffer[vcd->used++] = '\n';
+}
+
+// appends a value change line (<value><id>) of signal n to the buffer
+void appendJWD1797VCDValue(JWD1797VCDWriter* vcd, int n, unsigned int value) {
+  vcd->buffer[vcd->used++] = value ? '1' : '0';
+  // identifiers are the printable characters from '!' on
+  vcd->buffer[vcd->used++] = '!' + n;
+  vcd->buffer[vcd->used++] = '\n';
+}
+
+/* records the values of all signals (signal n in bit n) at ts_ns. The first
+  call writes the header and the initial values, later calls only the
+  signals that changed. Time stamps that go back (a controller reset starts
+  its emulated time over) continue from the last one written. */
+void writeJWD1797VCDValues(JWD1797VCDWriter* vcd, unsigned long long ts_ns,
+  unsigned int values) {
+  ts_ns += vcd->base_ns;
+  if(ts_ns < vcd->last_ns) {
+    vcd->base_ns += vcd->last_ns - ts_ns;
+    ts_ns = vcd->last_ns;
+  }
+  if(!vcd->started) {
+    fprintf(vcd->file, "$version jwd1797 $end\n$timescale 1ns $end\n"
+      "$scope module %s $end\n", vcd->scope);
+    for(int n = 0; n < vcd->num_signals; n++) {
+      fprintf(vcd->file, "$var wire 1 %c %s $end\n", '!' + n, vcd->names[n]);
+    }
+    fprintf(vcd->file, "$upscope $end\n$enddefinitions $end\n");
+    appendJWD1797VCDTime(vcd, ts_ns);
+    memcpy(vcd->buffer + vcd->used, "$dumpvars\n", 10);
+    vcd->used += 10;
+    for(int n = 0; n < vcd->num_signals; n++) {
+      appendJWD1797VCDValue(vcd, n, (values >> n) & 1);
+    }
+    memcpy(vcd->buffer + vcd->used, "$end\n", 5);
+    vcd->used += 5;
+    vcd->started = 1;
+    vcd->values = values;
+    vcd->last_ns = ts_ns;
+    return;
+  }
+  unsigned int changed = values ^ vcd->values;
+  if(changed == 0) {return;}
+  if(vcd->used > JWD1797_VCD_BUFFER_SIZE - VCD_MAX_RECORD) {flushJWD1797VCD(vcd);}
+  if(ts_ns != vcd->last_ns) {appendJWD1797VCDTime(vcd, ts_ns);}
+  for(int n = 0; changed != 0; n++, changed >>= 1) {
+    if(changed & 1) {
+      appendJWD1797VCDValue(vcd, n, (values >> n) & 1);
+      vcd->changes++;
+    }
+  }
+  vcd->values = values;
+  vcd->last_ns = ts_ns;
+}
+
+// number of value changes written after the initial values
+unsigned long getJWD1797VCDChanges(JWD1797VCDWriter* vcd) {
+  return vcd->changes;
+}
+
+/* writes out what is buffered, closes the file and frees the writer.
+  Returns 0 on success, -1 if any part of the file could not be written. */
+int closeJWD1797VCD(JWD1797VCDWriter* vcd) {
+  if(vcd == NULL) {return 0;}
+  flushJWD1797VCD(vcd);
+  int failed = vcd->failed;
+  if(fclose(vcd->file) != 0) {failed = 1;}
+  free(vcd);
+  return failed ? -1 : 0;
+}
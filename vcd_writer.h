@@ -0,0 +1,30 @@
+// VCD waveform writer (header)
+
+// signals one file can hold (one bit each)
+#define JWD1797_VCD_MAX_SIGNALS 32
+// output is collected here and written out in blocks of about this size
+#define JWD1797_VCD_BUFFER_SIZE (1 << 16)
+
+/* streams single bit signals to a Value Change Dump file (IEEE 1364) with a
+  1 ns time scale - only changes are written. Signal names and the scope
+  must be string literals (or otherwise outlive the writer). */
+typedef struct JWD1797VCDWriter {
+  FILE* file;
+  const char* scope;
+  const char* names[JWD1797_VCD_MAX_SIGNALS];
+  int num_signals;
+  int started;                  // header written - no more signals
+  int failed;                   // a write to the file failed
+  unsigned int values;          // last written value of signal n in bit n
+  unsigned long long last_ns;   // last time stamp written
+  unsigned long long base_ns;   // added to every time stamp (see writeJWD1797VCDValues())
+  unsigned long changes;        // value changes written
+  unsigned int used;            // bytes waiting in buffer
+  char buffer[JWD1797_VCD_BUFFER_SIZE];
+} JWD1797VCDWriter;
+
+JWD1797VCDWriter* openJWD1797VCD(const char*, const char*);
+int addJWD1797VCDSignal(JWD1797VCDWriter*, const char*);
+void writeJWD1797VCDValues(JWD1797VCDWriter*, unsigned long long, unsigned int);
+unsigned long getJWD1797VCDChanges(JWD1797VCDWriter*);
+int closeJWD1797VCD(JWD1797VCDWriter*);
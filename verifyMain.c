@@ -0,0 +1,167 @@
+// disk image verifier MAIN for jwd1797
+// Joe Matta
+
+/* checks that every track of a set of disk images is formatted the way the
+  controller will parse it - ID address marks, sector IDs, length codes and
+  CRC bytes (see verifyJWD1797Track()) - and prints a report for each track.
+  The work runs on a work-stealing thread pool: one task loads an image, then
+  one task per track checks it. An image is released as soon as its last
+  track is checked, so a large library never has to fit in memory.
+    ./verify_jwd [-j threads] [-q] [-c cache_dir] image...
+  -q only reports the tracks with errors. The images are only read - no
+  formatted disk cache is written unless -c gives a directory for it. The
+  exit status is 1 if any image could not be loaded or has errors. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "jwd1797.h"
+#include "thread_pool.h"
+
+typedef struct Disk Disk;
+
+// one track check - the task argument
+typedef struct {
+  Disk* disk;
+  int track;
+} TrackJob;
+
+/* one image. Loaded and written by the workers, read by main once the pool is
+  done. */
+struct Disk {
+  const char* path;
+  const char* cache_dir;         // NULL - no formatted disk cache
+  ThreadPool* pool;
+  JWD1797Image* image;
+  int loaded;
+  unsigned int num_tracks;
+  unsigned int num_heads;
+  unsigned int cylinders;
+  TrackJob* jobs;
+  JWD1797TrackReport* reports;   // [cylinder * num_heads + head]
+  unsigned int remaining;        // tracks not checked yet
+};
+
+double hostSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+// checks one track - the last one of an image releases it
+void verifyTrack(void* arg) {
+  TrackJob* job = (TrackJob*)arg;
+  Disk* d = job->disk;
+  JWD1797TrackDescriptor* t = &d->image->tracks[job->track];
+  verifyJWD1797Track(d->image->formattedDiskArray + t->formatted_offset,
+    t->formatted_length, t, &d->reports[job->track]);
+  if(__atomic_sub_fetch(&d->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+    releaseJWD1797Image(d->image);
+    d->image = NULL;
+  }
+}
+
+// loads (formats) an image and queues a check of each of its tracks
+void loadDisk(void* arg) {
+  Disk* d = (Disk*)arg;
+  JWD1797Config config = {.image_path = d->path, .cache_dir = d->cache_dir,
+    .no_cache = d->cache_dir == NULL};
+  d->image = loadJWD1797Image(&config);
+  if(d->image == NULL) {return;}
+  d->loaded = 1;
+  d->num_tracks = d->image->num_tracks;
+  d->num_heads = d->image->num_heads;
+  d->cylinders = d->image->cylinders;
+  if(d->num_tracks == 0) {
+    releaseJWD1797Image(d->image);
+    d->image = NULL;
+    return;
+  }
+  d->jobs = (TrackJob*)malloc(sizeof(TrackJob) * d->num_tracks);
+  d->reports = (JWD1797TrackReport*)calloc(d->num_tracks, sizeof(JWD1797TrackReport));
+  d->remaining = d->num_tracks;
+  for(unsigned int i = 0; i < d->num_tracks; i++) {
+    d->jobs[i].disk = d;
+    d->jobs[i].track = i;
+    submitThreadPoolTask(d->pool, verifyTrack, &d->jobs[i]);
+  }
+}
+
+// prints the report of an image - returns its number of errors
+unsigned long printDiskReport(Disk* d, int quiet) {
+  if(!d->loaded) {
+    printf("%s%s\n", d->path, ": ERROR: could not load disk image");
+    return 0;
+  }
+  unsigned long errors = 0;
+  for(unsigned int i = 0; i < d->num_tracks; i++) {errors += d->reports[i].errors;}
+  printf("%s%s%u%s%u%s%lu%s\n", d->path, ": ", d->cylinders, " cylinders, ",
+    d->num_heads, " heads, ", errors, " errors");
+  if(quiet && errors == 0) {return 0;}
+  printf("%5s %4s %7s %7s %6s %7s %6s %8s %7s %4s %7s %7s\n", "cyl", "head",
+    "sectors", "missing", "bad_id", "bad_len", "id_crc", "data_crc", "no_data",
+    "dups", "deleted", "foreign");
+  for(unsigned int i = 0; i < d->num_tracks; i++) {
+    JWD1797TrackReport* r = &d->reports[i];
+    if(quiet && r->errors == 0) {continue;}
+    printf("%5u %4u %7u %7u %6u %7u %6u %8u %7u %4u %7u %7u%s\n",
+      i / d->num_heads, i % d->num_heads, r->sectors, r->missing, r->bad_id,
+      r->bad_length, r->bad_id_crc, r->bad_data_crc, r->no_data, r->duplicates,
+      r->deleted, r->foreign, r->errors ? "  <--" : "");
+  }
+  return errors;
+}
+
+int main(int argc, char* argv[]) {
+  int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int quiet = 0;
+  const char* cache_dir = NULL;
+  int opt;
+  while((opt = getopt(argc, argv, "j:qc:")) != -1) {
+    if(opt == 'j') {threads = atoi(optarg);}
+    else if(opt == 'q') {quiet = 1;}
+    else if(opt == 'c') {cache_dir = optarg;}
+    else {
+      printf("%s\n", "usage: verify_jwd [-j threads] [-q] [-c cache_dir] image...");
+      return 2;
+    }
+  }
+  if(threads < 1) {threads = 1;}
+  int num_disks = argc - optind;
+  if(num_disks < 1) {
+    printf("%s\n", "usage: verify_jwd [-j threads] [-q] [-c cache_dir] image...");
+    return 2;
+  }
+
+  Disk* disks = (Disk*)calloc(num_disks, sizeof(Disk));
+  ThreadPool* pool = newThreadPool(threads);
+  double start = hostSeconds();
+  for(int i = 0; i < num_disks; i++) {
+    disks[i].path = argv[optind + i];
+    disks[i].cache_dir = cache_dir;
+    disks[i].pool = pool;
+    submitThreadPoolTask(pool, loadDisk, &disks[i]);
+  }
+  waitThreadPool(pool);
+  double elapsed = hostSeconds() - start;
+  freeThreadPool(pool);
+
+  unsigned long errors = 0, tracks = 0;
+  int failed = 0, bad_disks = 0;
+  for(int i = 0; i < num_disks; i++) {
+    unsigned long disk_errors = printDiskReport(&disks[i], quiet);
+    errors += disk_errors;
+    tracks += disks[i].num_tracks;
+    if(!disks[i].loaded) {failed++;}
+    if(disk_errors > 0) {bad_disks++;}
+    free(disks[i].jobs);
+    free(disks[i].reports);
+  }
+  printf("\n%d%s%lu%s%lu%s%d%s%d%s%.3f%s%d%s\n", num_disks, " images, ", tracks,
+    " tracks, ", errors, " errors (", bad_disks, " images with errors, ", failed,
+    " not loaded) in ", elapsed, " s on ", threads, " threads");
+  free(disks);
+  return (errors > 0 || failed > 0) ? 1 : 0;
+}